@@ -0,0 +1,43 @@
+//
+// BenchUtils.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+    #include <malloc.h>
+#elif defined(__APPLE__)
+    #include <malloc/malloc.h>
+#endif
+
+namespace snej::smol::bench {
+
+/// Reads a file into a string; returns an empty string on failure.
+static inline std::string readFile(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    return in ? contents.str() : std::string();
+}
+
+
+/// The number of bytes currently allocated by malloc, or 0 if the platform can't tell.
+static inline size_t mallocBytesInUse() {
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#elif defined(__APPLE__)
+    malloc_statistics_t stats;
+    malloc_zone_statistics(nullptr, &stats);
+    return stats.size_in_use;
+#else
+    return 0;
+#endif
+}
+
+}
@@ -0,0 +1,331 @@
+//
+// Bench_Collections.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifdef HAVE_ABSL
+    #include "absl/container/flat_hash_set.h"
+#endif
+
+#include "Benchmark.hh"
+#include "BenchUtils.hh"
+#include "smol_world.hh"
+#include "SparseArray.hh"
+#include "sparse_hash.hh"
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <unordered_set>
+
+using namespace std;
+using namespace snej::smol;
+using namespace snej::smol::bench;
+
+
+static vector<string> makeNames(size_t count, const char *prefix) {
+    vector<string> names;
+    names.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        names.push_back(prefix + to_string(i));
+    return names;
+}
+
+
+// Dict lookup and update-in-place, versus the number of entries.
+BENCHMARK(Dict) {
+    for (unsigned n : {4, 16, 64, 256, 1024}) {
+        Heap heap(1 << 20);
+        UsingHeap u(heap);
+        vector<Maybe<Symbol>> keys;
+        for (auto &name : makeNames(n, "key"))
+            keys.push_back(newSymbol(name, heap).value());
+        shuffle(keys.begin(), keys.end(), mt19937(1234));
+        Handle<Dict> dict = newDict(n, heap).value();
+        for (unsigned i = 0; i < n; ++i)
+            (void)dict.set(keys[i].value(), int(i));
+
+        runner.measure("Dict/find/" + to_string(n), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                for (auto &key : keys)
+                    doNotOptimize(dict.find(key.value()));
+            }
+        }, n);
+        runner.measure("Dict/set/" + to_string(n), [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                for (auto &key : keys)
+                    doNotOptimize(dict.set(key.value(), int(i)));
+            }
+        }, n);
+    }
+}
+
+
+// SymbolTable::create for existing symbols (hits) and for new ones (misses, which insert.)
+// Also `createBatch`, in batches the size of a wide JSON object.
+BENCHMARK(Symbols) {
+    constexpr size_t kCount = 10'000;
+    constexpr size_t kBatch = 50;
+    auto names = makeNames(kCount, "symbol_");
+    vector<string_view> strs(names.begin(), names.end());
+    vector<Maybe<Symbol>> syms(kBatch);
+
+    auto createBatches = [&](SymbolTable &table) {
+        for (size_t b = 0; b < kCount; b += kBatch)
+            doNotOptimize(table.createBatch({&strs[b], kBatch}, {syms.data(), kBatch}));
+    };
+
+    {
+        Heap heap(4 << 20);
+        SymbolTable &table = heap.symbolTable();
+        for (auto &name : names)
+            (void)table.create(name);
+        runner.measure("SymbolTable/create/hit", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                for (auto &name : names)
+                    doNotOptimize(table.create(name));
+            }
+        }, kCount);
+        runner.measure("SymbolTable/createBatch/hit", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+                createBatches(table);
+        }, kCount);
+    }
+
+    unique_ptr<Heap> heap;
+    runner.measureOnce("SymbolTable/create/miss", [&]{
+        heap = make_unique<Heap>(4 << 20);
+        (void)heap->symbolTable();
+    }, [&]{
+        SymbolTable &table = heap->symbolTable();
+        for (auto &name : names)
+            doNotOptimize(table.create(name));
+    }, kCount);
+    runner.measureOnce("SymbolTable/createBatch/miss", [&]{
+        heap = make_unique<Heap>(4 << 20);
+        (void)heap->symbolTable();
+    }, [&]{
+        createBatches(heap->symbolTable());
+    }, kCount);
+
+    // Growing a HashSet from empty to a million strings. (A SymbolTable can't hold that many,
+    // since Symbol IDs are 16-bit.) `heapBytes` includes the garbage left by outgrown buckets and
+    // tables, since there's no GC. `maxInsertNs` is the slowest single insertion, from an extra
+    // run that times each one.
+    constexpr size_t kGrowCount = 1'000'000;
+    auto growNames = makeNames(kGrowCount, "symbol_");
+    unique_ptr<HashSet> set;
+    auto setup = [&]{
+        set.reset();
+        heap = make_unique<Heap>(256 << 20);
+        set = make_unique<HashSet>(*heap, 0u);
+    };
+    auto insert = [&](string const& name) {
+        return set->findOrInsert(name, [&](Heap &heap) -> Value {
+            return newString(name, heap);
+        });
+    };
+    Result *r = runner.measureOnce("HashSet/grow/1M", setup, [&]{
+        UsingHeap u(*heap);
+        for (auto &name : growNames)
+            doNotOptimize(insert(name));
+    }, kGrowCount);
+    if (r) {
+        runner.addCounter(r, "heapBytes", double(heap->used()));
+        setup();
+        UsingHeap u(*heap);
+        chrono::nanoseconds maxTime {0};
+        for (auto &name : growNames) {
+            auto start = chrono::steady_clock::now();
+            doNotOptimize(insert(name));
+            maxTime = max(maxTime, chrono::nanoseconds(chrono::steady_clock::now() - start));
+        }
+        runner.addCounter(r, "maxInsertNs", double(maxTime.count()));
+    }
+    set.reset();
+    heap.reset();
+}
+
+
+// HashMap lookups with Int keys and with String keys (distinct objects from the stored keys),
+// and inserting Int keys into an empty map.
+BENCHMARK(HashMap) {
+    constexpr int kCount = 10'000;
+    auto names = makeNames(kCount, "key_");
+    {
+        Heap heap(8 << 20);
+        UsingHeap u(heap);
+        HashMap map(heap);
+        for (int i = 0; i < kCount; ++i) {
+            (void)map.set(i, i);
+            (void)map.set(newString(names[i], heap).value(), i);
+        }
+        runner.measure("HashMap/get/int", [&](uint64_t iterations) {
+            for (uint64_t n = 0; n < iterations; ++n) {
+                for (int i = 0; i < kCount; ++i)
+                    doNotOptimize(map.get(i));
+            }
+        }, kCount);
+
+        Handle<Array> keys = newArray(kCount, heap).value();
+        for (int i = 0; i < kCount; ++i)
+            keys[i] = newString(names[i], heap).value();
+        runner.measure("HashMap/get/string", [&](uint64_t iterations) {
+            for (uint64_t n = 0; n < iterations; ++n) {
+                for (Val const& key : keys)
+                    doNotOptimize(map.get(key));
+            }
+        }, kCount);
+    }
+
+    unique_ptr<Heap> heap;
+    unique_ptr<HashMap> map;
+    runner.measureOnce("HashMap/set/int", [&]{
+        map.reset();
+        heap = make_unique<Heap>(8 << 20);
+        map = make_unique<HashMap>(*heap);
+    }, [&]{
+        for (int i = 0; i < kCount; ++i)
+            doNotOptimize(map->set(i, i));
+    }, kCount);
+    map.reset();
+}
+
+
+// SparseArray random gets, iteration and counting on a half-full array, and random puts into
+// an empty one.
+BENCHMARK(SparseArray) {
+    for (unsigned size : {1024, 65536}) {
+        mt19937 rng(1234);
+        vector<unsigned> indexes(size);
+        for (unsigned i = 0; i < size; ++i)
+            indexes[i] = i;
+        shuffle(indexes.begin(), indexes.end(), rng);
+        indexes.resize(size / 2);
+
+        {
+            Heap heap(8 << 20);
+            UsingHeap u(heap);
+            SparseArray array(size, heap);
+            for (unsigned i : indexes)
+                (void)array.put(i, int(i));
+            vector<unsigned> probes(size);
+            for (auto &p : probes)
+                p = rng() % size;
+            runner.measure("SparseArray/get/" + to_string(size), [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    for (unsigned p : probes)
+                        doNotOptimize(array.get(p));
+                }
+            }, size);
+            runner.measure("SparseArray/visit/" + to_string(size), [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    array.visit([&](unsigned i, Value val) {
+                        doNotOptimize(val);
+                        return true;
+                    });
+                }
+            }, indexes.size());
+            runner.measure("SparseArray/count/" + to_string(size), [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i)
+                    doNotOptimize(array.nonNullCount());
+            });
+        }
+
+        unique_ptr<Heap> heap;
+        unique_ptr<SparseArray> array;
+        runner.measureOnce("SparseArray/put/" + to_string(size), [&]{
+            array.reset();
+            heap = make_unique<Heap>(8 << 20);
+            array = make_unique<SparseArray>(size, *heap);
+        }, [&]{
+            for (unsigned i : indexes)
+                doNotOptimize(array->put(i, int(i)));
+        }, indexes.size());
+        array.reset();
+    }
+}
+
+
+namespace {
+    // 64-to-32-bit hash for the off-heap tables (the MurmurHash3 finalizer.)
+    struct IntHash {
+        uint32_t operator() (uint64_t k) const {
+            k ^= k >> 33;  k *= 0xff51afd7ed558ccdull;
+            k ^= k >> 33;  k *= 0xc4ceb9fe1a85ec53ull;
+            k ^= k >> 33;
+            return uint32_t(k);
+        }
+    };
+
+    template <class Table>
+    void benchIntSet(Runner &runner, string const& name,
+                     vector<uint64_t> const& keys, vector<uint64_t> const& misses)
+    {
+        auto contains = [](Table const& table, uint64_t key) {
+            if constexpr (requires {table.get(key);})
+                return table.get(key) != nullptr;
+            else
+                return table.find(key) != table.end();
+        };
+
+        size_t mallocBefore = mallocBytesInUse();
+        auto table = make_unique<Table>();
+        for (uint64_t key : keys)
+            table->insert(key);
+        size_t bytesUsed = mallocBytesInUse() - mallocBefore;
+
+        Result *r = runner.measure("OffHeapHash/get/" + name, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                for (uint64_t key : keys)
+                    doNotOptimize(contains(*table, key));
+            }
+        }, keys.size());
+        runner.addCounter(r, "bytesPerItem", double(bytesUsed) / keys.size());
+        runner.measure("OffHeapHash/miss/" + name, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                for (uint64_t key : misses)
+                    doNotOptimize(contains(*table, key));
+            }
+        }, misses.size());
+        runner.measureOnce("OffHeapHash/insert/" + name, [&]{
+            table = make_unique<Table>();
+        }, [&]{
+            for (uint64_t key : keys)
+                table->insert(key);
+        }, keys.size());
+    }
+}
+
+
+// The off-heap sparse & dense hash tables versus std::unordered_set, and absl::flat_hash_set if
+// it's available: lookup hits & misses and insertion, with 64-bit integer items. The "get"
+// results include a `bytesPerItem` counter, measured from malloc, so allocator overhead counts.
+BENCHMARK(OffHeapHash) {
+    constexpr size_t kCount = 100'000;
+    mt19937_64 rng(1234);
+    vector<uint64_t> keys(kCount), misses(kCount);
+    for (auto &key : keys)
+        key = rng() | 1;
+    for (auto &key : misses)
+        key = rng() & ~uint64_t(1);
+
+    benchIntSet<sparse_hash_table<uint64_t,uint64_t,IntHash>>(runner, "sparse", keys, misses);
+    benchIntSet<dense_hash_table<uint64_t,uint64_t,IntHash>>(runner, "dense", keys, misses);
+    benchIntSet<unordered_set<uint64_t>>(runner, "std", keys, misses);
+#ifdef HAVE_ABSL
+    benchIntSet<absl::flat_hash_set<uint64_t>>(runner, "absl", keys, misses);
+#endif
+}
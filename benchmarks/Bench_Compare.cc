@@ -0,0 +1,371 @@
+//
+// Bench_Compare.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Head-to-head comparison of smol_world with other in-memory representations of a JSON
+// document: a typical `std::variant` tree, rapidjson's DOM, and nlohmann::json (if available.)
+// For each one it measures the time to build the document from JSON, to traverse it, and to
+// write it back out as JSON; the memory it occupies; and, on Linux, the number of cache and TLB
+// misses during a traversal (see PerfCounters.hh.)
+
+// Third-party headers come first, since smol's `pure` macro trips up nlohmann's attribute checks.
+#if __has_include(<nlohmann/json.hpp>)
+    #include <nlohmann/json.hpp>
+    #define HAVE_NLOHMANN 1
+#endif
+
+#if __has_include("rapidjson/document.h")
+    #include "rapidjson/document.h"
+    #define HAVE_RAPIDJSON_DOM 1
+#endif
+
+#include "rapidjson/reader.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include "Benchmark.hh"
+#include "BenchUtils.hh"
+#include "smol_world.hh"
+#include <iostream>
+#include <variant>
+#include <vector>
+
+#if defined(__GNUC__) && !defined(__clang__)
+    // GCC 12 gives bogus "may be used uninitialized" warnings about moving std::variants.
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+using namespace std;
+using namespace snej::smol;
+using namespace snej::smol::bench;
+
+
+namespace {
+
+    /// Statistics gathered by traversing a document, to keep the traversal from being optimized
+    /// away, and to check that all the representations are equivalent.
+    struct WalkStats {
+        size_t nodes = 0;
+        size_t stringBytes = 0;
+    };
+
+
+#pragma mark - SMOL:
+
+
+    void walk(Value v, WalkStats &stats) {
+        stats.nodes++;
+        switch (v.type()) {
+            case Type::String:
+                stats.stringBytes += v.as<String>().size();
+                break;
+            case Type::Array:
+                for (Val const& item : v.as<Array>())
+                    walk(item, stats);
+                break;
+            case Type::Vector:
+                for (Val const& item : v.as<Vector>())
+                    walk(item, stats);
+                break;
+            case Type::Dict:
+                for (DictEntry const& entry : v.as<Dict>()) {
+                    stats.stringBytes += Value(entry.key).as<Symbol>().size();
+                    walk(entry.value, stats);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+
+#pragma mark - STD::VARIANT:
+
+
+    /// A conventional JSON tree built from standard library types.
+    struct StdValue {
+        using Array = std::vector<StdValue>;
+        using Object = std::vector<std::pair<std::string, StdValue>>;
+        std::variant<nullptr_t, bool, int64_t, double, std::string, Array, Object> value;
+    };
+
+
+    /// rapidjson SAX handler that builds a StdValue tree.
+    class StdValueBuilder {
+    public:
+        StdValue root;
+
+        bool Null()                 {return add(nullptr);}
+        bool Bool(bool b)           {return add(b);}
+        bool Int(int i)             {return add(int64_t(i));}
+        bool Uint(unsigned u)       {return add(int64_t(u));}
+        bool Int64(int64_t i)       {return add(i);}
+        bool Uint64(uint64_t u)     {return add(int64_t(u));}
+        bool Double(double d)       {return add(d);}
+        bool RawNumber(const char*, rapidjson::SizeType, bool) {return false;}
+        bool String(const char* str, rapidjson::SizeType len, bool) {return add(std::string(str, len));}
+        bool StartObject()          {return start(StdValue::Object{});}
+        bool Key(const char* str, rapidjson::SizeType len, bool) {
+            _key.assign(str, len);
+            return true;
+        }
+        bool EndObject(rapidjson::SizeType) {_stack.pop_back(); return true;}
+        bool StartArray()           {return start(StdValue::Array{});}
+        bool EndArray(rapidjson::SizeType)  {_stack.pop_back(); return true;}
+
+    private:
+        template <typename T>
+        StdValue* add(T&& value) {
+            if (_stack.empty()) {
+                root.value = std::forward<T>(value);
+                return &root;
+            }
+            auto &parent = _stack.back()->value;
+            if (auto array = get_if<StdValue::Array>(&parent)) {
+                array->push_back(StdValue{std::forward<T>(value)});
+                return &array->back();
+            } else {
+                auto &object = get<StdValue::Object>(parent);
+                object.emplace_back(_key, StdValue{std::forward<T>(value)});
+                return &object.back().second;
+            }
+        }
+
+        template <typename T>
+        bool start(T&& container) {
+            _stack.push_back(add(std::forward<T>(container)));
+            return true;
+        }
+
+        vector<StdValue*> _stack;
+        std::string _key;
+    };
+
+
+    void walk(StdValue const& v, WalkStats &stats) {
+        stats.nodes++;
+        if (auto str = get_if<std::string>(&v.value)) {
+            stats.stringBytes += str->size();
+        } else if (auto array = get_if<StdValue::Array>(&v.value)) {
+            for (auto &item : *array)
+                walk(item, stats);
+        } else if (auto object = get_if<StdValue::Object>(&v.value)) {
+            for (auto &[key, item] : *object) {
+                stats.stringBytes += key.size();
+                walk(item, stats);
+            }
+        }
+    }
+
+
+    template <class WRITER>
+    void write(StdValue const& v, WRITER &writer) {
+        std::visit([&](auto const& val) {
+            using T = std::decay_t<decltype(val)>;
+            if constexpr (std::is_same_v<T, nullptr_t>) {
+                writer.Null();
+            } else if constexpr (std::is_same_v<T, bool>) {
+                writer.Bool(val);
+            } else if constexpr (std::is_same_v<T, int64_t>) {
+                writer.Int64(val);
+            } else if constexpr (std::is_same_v<T, double>) {
+                writer.Double(val);
+            } else if constexpr (std::is_same_v<T, std::string>) {
+                writer.String(val.data(), rapidjson::SizeType(val.size()));
+            } else if constexpr (std::is_same_v<T, StdValue::Array>) {
+                writer.StartArray();
+                for (auto &item : val)
+                    write(item, writer);
+                writer.EndArray();
+            } else {
+                writer.StartObject();
+                for (auto &[key, item] : val) {
+                    writer.Key(key.data(), rapidjson::SizeType(key.size()));
+                    write(item, writer);
+                }
+                writer.EndObject();
+            }
+        }, v.value);
+    }
+
+
+    StdValue parseStdValue(std::string const& json) {
+        StdValueBuilder builder;
+        rapidjson::Reader reader;
+        rapidjson::StringStream in(json.c_str());
+        reader.Parse(in, builder);
+        return std::move(builder.root);
+    }
+
+
+    std::string toJSON(StdValue const& v) {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        write(v, writer);
+        return std::string(buffer.GetString(), buffer.GetSize());
+    }
+
+
+#pragma mark - RAPIDJSON:
+
+
+#if HAVE_RAPIDJSON_DOM
+    void walk(rapidjson::Value const& v, WalkStats &stats) {
+        stats.nodes++;
+        if (v.IsString()) {
+            stats.stringBytes += v.GetStringLength();
+        } else if (v.IsArray()) {
+            for (auto &item : v.GetArray())
+                walk(item, stats);
+        } else if (v.IsObject()) {
+            for (auto &member : v.GetObject()) {
+                stats.stringBytes += member.name.GetStringLength();
+                walk(member.value, stats);
+            }
+        }
+    }
+#endif
+
+
+#pragma mark - NLOHMANN:
+
+
+#if HAVE_NLOHMANN
+    void walk(nlohmann::json const& v, WalkStats &stats) {
+        stats.nodes++;
+        if (v.is_string()) {
+            stats.stringBytes += v.get_ref<std::string const&>().size();
+        } else if (v.is_array()) {
+            for (auto &item : v)
+                walk(item, stats);
+        } else if (v.is_object()) {
+            for (auto &[key, item] : v.items()) {
+                stats.stringBytes += key.size();
+                walk(item, stats);
+            }
+        }
+    }
+#endif
+
+
+#pragma mark - HARNESS:
+
+
+    /// Runs the build/traverse/serialize benchmarks for one representation.
+    /// - `build()` parses `json` and returns the document;
+    /// - `walkDoc(doc, stats)` traverses it;
+    /// - `toJSON(doc)` serializes it.
+    /// Memory use is the growth of malloc's in-use bytes while building (or, for smol, the Heap's
+    /// `used()` size, passed in as `heapBytes`.)
+    template <typename BUILD, typename WALK, typename WRITE>
+    void compare(Runner &runner, const char *kind, std::string const& json,
+                 BUILD build, WALK walkDoc, WRITE toJSON,
+                 function_ref<size_t()> heapBytes = nullptr)
+    {
+        string prefix = string("Compare/") + kind + "/";
+        string buildName = prefix + "build", traverseName = prefix + "traverse",
+               serializeName = prefix + "serialize";
+        if (!runner.wants(buildName) && !runner.wants(traverseName) && !runner.wants(serializeName))
+            return;
+
+        size_t mallocBefore = mallocBytesInUse();
+        auto doc = build();
+        size_t bytesUsed = heapBytes ? heapBytes() : mallocBytesInUse() - mallocBefore;
+
+        Result *result = runner.measure(buildName, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+                doNotOptimize(build());
+        }, 1, json.size());
+        runner.addCounter(result, "bytes_used", double(bytesUsed));
+        runner.addCounter(result, "bytes_used_per_json_byte", double(bytesUsed) / json.size());
+
+        // Each build may reuse the memory of the previous one (smol resets its Heap), so the
+        // document to traverse and serialize has to come from the last build:
+        doc = build();
+
+        WalkStats stats;
+        result = runner.measure(traverseName, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                stats = WalkStats{};
+                walkDoc(doc, stats);
+                doNotOptimize(stats);
+            }
+        }, 1, json.size());
+        runner.addCounter(result, "nodes", double(stats.nodes));
+        runner.addMissCounters(result, [&]{
+            WalkStats ignored;
+            walkDoc(doc, ignored);
+        });
+
+        runner.measure(serializeName, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+                doNotOptimize(toJSON(doc));
+        }, 1, json.size());
+    }
+
+}
+
+
+BENCHMARK(Compare) {
+    std::string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping comparison benchmarks: couldn't read twitter.json\n";
+        return;
+    }
+
+    {
+        // The Heap is reset before each build, so all builds reuse the same memory.
+        Heap heap(json.size() * 4 + 100000);
+        UsingHeap u(heap);
+        compare(runner, "smol", json,
+                [&] {
+                    heap.reset();
+                    return newFromJSON(json, heap);
+                },
+                [](Value root, WalkStats &stats) {walk(root, stats);},
+                [](Value root) {return snej::smol::toJSON(root);},
+                [&] {return heap.used();});
+    }
+
+    compare(runner, "std_variant", json,
+            [&] {return parseStdValue(json);},
+            [](StdValue const& root, WalkStats &stats) {walk(root, stats);},
+            [](StdValue const& root) {return toJSON(root);});
+
+#if HAVE_RAPIDJSON_DOM
+    compare(runner, "rapidjson", json,
+            [&] {
+                auto doc = make_unique<rapidjson::Document>();
+                doc->Parse(json.c_str());
+                return doc;
+            },
+            [](unique_ptr<rapidjson::Document> const& doc, WalkStats &stats) {walk(*doc, stats);},
+            [](unique_ptr<rapidjson::Document> const& doc) {
+                rapidjson::StringBuffer buffer;
+                rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+                doc->Accept(writer);
+                return std::string(buffer.GetString(), buffer.GetSize());
+            });
+#endif
+
+#if HAVE_NLOHMANN
+    compare(runner, "nlohmann", json,
+            [&] {return nlohmann::json::parse(json);},
+            [](nlohmann::json const& doc, WalkStats &stats) {walk(doc, stats);},
+            [](nlohmann::json const& doc) {return doc.dump();});
+#endif
+}
@@ -0,0 +1,123 @@
+//
+// Bench_Heap.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Benchmark.hh"
+#include "smol_world.hh"
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace snej::smol;
+using namespace snej::smol::bench;
+
+
+// Allocation throughput by block size. The heap is reset whenever it fills up.
+BENCHMARK(Alloc) {
+    Heap heap(64 << 20);
+    for (heapsize size : {0, 4, 16, 64, 256, 1024, 8192}) {
+        runner.measure("Alloc/" + to_string(size), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                Block *block = heap.allocBlock(size, Type::Blob);
+                if (_unlikely(!block)) {
+                    heap.reset();
+                    block = heap.allocBlock(size, Type::Blob);
+                }
+                doNotOptimize(block);
+            }
+        }, 1, Block::sizeForData(size));
+        heap.reset();
+    }
+}
+
+
+// Builds a graph of `nObjects` 4-item Arrays, reachable from a root Array. Each item is, with
+// probability `density`, a pointer to a random other object; otherwise it's an Int.
+static void buildGraph(Heap &heap, unsigned nObjects, double density) {
+    UsingHeap u(heap);
+    mt19937 rng(1234);
+    uniform_real_distribution<double> coin;
+    uniform_int_distribution<unsigned> pick(0, nObjects - 1);
+
+    Handle<Array> root = newArray(nObjects, heap).value();
+    heap.setRoot(root);
+    for (unsigned i = 0; i < nObjects; ++i)
+        root[i] = newArray(4, heap).value();
+    for (unsigned i = 0; i < nObjects; ++i) {
+        Array obj = root[i].as<Array>();
+        for (Val &item : obj) {
+            if (coin(rng) < density)
+                item = root[pick(rng)];
+            else
+                item = int(i);
+        }
+    }
+}
+
+
+// GC pause time versus the number of live objects and the fraction of Vals that are pointers.
+// (All objects are live, so every GC copies the whole graph.)
+BENCHMARK(GC) {
+    for (unsigned nObjects : {1000, 10'000, 100'000, 1'000'000}) {
+        for (int percent : {0, 50, 100}) {
+            string name = "GC/" + to_string(nObjects) + "/ptrs:" + to_string(percent) + "%";
+            if (!runner.wants(name))
+                continue;
+            size_t capacity = 64 << 20;
+            Heap heap(capacity), other(capacity);
+            buildGraph(heap, nObjects, percent / 100.0);
+            GarbageCollector::run(heap, other);     // start from a compacted heap
+            auto live = heap.used();
+            runner.measureOnce(name, []{}, [&]{
+                GarbageCollector::run(heap, other);
+            }, nObjects, live);
+        }
+    }
+}
+
+
+// `Heap::heapContaining` lookups, and Heap construction + destruction, with many Heaps.
+BENCHMARK(HeapContaining) {
+    for (unsigned nHeaps : {10, 1000, 10'000}) {
+        string suffix = "/" + to_string(nHeaps) + "heaps";
+        vector<unique_ptr<Heap>> heaps;
+        vector<Block*> blocks;
+        for (unsigned i = 0; i < nHeaps; ++i) {
+            heaps.push_back(make_unique<Heap>(256));
+            blocks.push_back(heaps.back()->allocBlock(4, Type::Blob));
+        }
+        mt19937 rng(1234);
+        shuffle(blocks.begin(), blocks.end(), rng);
+
+        // Same heap every time; this hits the per-thread cache:
+        runner.measure("HeapContaining/same" + suffix, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i)
+                doNotOptimize(Heap::heapContaining(blocks[0]));
+        });
+        // A different heap every time:
+        runner.measure("HeapContaining/random" + suffix, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i)
+                doNotOptimize(Heap::heapContaining(blocks[i % nHeaps]));
+        });
+        runner.measure("HeapContaining/create" + suffix, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i)
+                Heap heap(256);
+        });
+    }
+}
@@ -0,0 +1,288 @@
+//
+// Bench_JSON.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Benchmark.hh"
+#include "BenchUtils.hh"
+#include "smol_world.hh"
+#include <iostream>
+
+using namespace std;
+using namespace snej::smol;
+using namespace snej::smol::bench;
+
+
+// Parsing & generating JSON, in MB/s of JSON text.
+BENCHMARK(JSON) {
+    for (const char *file : {"svg_menu.json", "update-center.json", "twitter.json"}) {
+        string json = readFile(runner.dataDir + file);
+        if (json.empty()) {
+            cerr << "Skipping JSON benchmarks of " << file << ": couldn't read it\n";
+            continue;
+        }
+        Heap heap(json.size() * 4 + 100000);
+        UsingHeap u(heap);
+
+        runner.measure(string("JSON/parse/") + file, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                heap.reset();
+                doNotOptimize(newFromJSON(json, heap));
+            }
+        }, 1, json.size());
+
+        heap.reset();
+        Value root = newFromJSON(json, heap);
+        if (!root) {
+            cerr << "Skipping JSON benchmarks of " << file << ": couldn't parse it\n";
+            continue;
+        }
+        size_t outputSize = toJSON(root).size();
+        runner.measure(string("JSON/generate/") + file, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+                doNotOptimize(toJSON(root));
+        }, 1, outputSize);
+    }
+}
+
+
+// Parsing JSON made of wide objects: a thousand records with 200 fields each.
+BENCHMARK(WideJSON) {
+    string json = "[";
+    for (int r = 0; r < 1000; ++r) {
+        json += (r ? ",{" : "{");
+        for (int f = 0; f < 200; ++f)
+            json += (f ? ",\"field_" : "\"field_") + to_string(f) + "\":" + to_string(r * f);
+        json += "}";
+    }
+    json += "]";
+    Heap heap(json.size() * 4 + 100000);
+    UsingHeap u(heap);
+
+    runner.measure("JSON/parse/wide", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            heap.reset();
+            doNotOptimize(newFromJSON(json, heap));
+        }
+    }, 1, json.size());
+}
+
+
+// Parsing only a few fields of each tweet, versus parsing the whole document.
+BENCHMARK(ProjectedJSON) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping ProjectedJSON benchmark: couldn't read twitter.json\n";
+        return;
+    }
+    Heap heap(json.size() * 4 + 100000);
+    UsingHeap u(heap);
+    JSONProjection projection {"statuses.*.id", "statuses.*.user.screen_name"};
+
+    Result *result = runner.measure("JSON/parse/projected", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            heap.reset();
+            doNotOptimize(newFromJSON(json, heap, projection));
+        }
+    }, 1, json.size());
+    runner.addCounter(result, "heap bytes", double(heap.used()));
+}
+
+
+// Indexing a document as a LazyJSON, then reading a few fields of each tweet.
+BENCHMARK(LazyJSON) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping LazyJSON benchmark: couldn't read twitter.json\n";
+        return;
+    }
+    Heap heap(json.size() * 4 + 100000);
+    UsingHeap u(heap);
+
+    Result *result = runner.measure("JSON/lazy/index", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            heap.reset();
+            doNotOptimize(LazyJSON::create(json, heap));
+        }
+    }, 1, json.size());
+    runner.addCounter(result, "heap bytes", double(heap.used()));
+
+    runner.measure("JSON/lazy/read", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            heap.reset();
+            auto doc = LazyJSON::create(json, heap);
+            auto statuses = doc->root()["statuses"];
+            for (uint32_t s = 0, n = statuses.count(); s < n; ++s) {
+                doNotOptimize(statuses[s]["id"].value());
+                doNotOptimize(statuses[s]["user"]["screen_name"].value());
+            }
+        }
+    }, 1, json.size());
+}
+
+
+// Evaluating a compiled Path against a parsed document, versus compiling it every time.
+BENCHMARK(Path) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping Path benchmarks: couldn't read twitter.json\n";
+        return;
+    }
+    Heap heap(json.size() * 4 + 100000);
+    UsingHeap u(heap);
+    Value root = newFromJSON(json, heap);
+    const char *kPath = "$.statuses[*].user.screen_name";
+
+    Path path(kPath, heap);
+    size_t matches = path.count(root);
+    Result *result = runner.measure("Path/count/compiled", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            doNotOptimize(path.count(root));
+    }, matches);
+    runner.addCounter(result, "matches", double(matches));
+    runner.measure("Path/count/uncompiled", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            doNotOptimize(Path(kPath, heap).count(root));
+    }, matches);
+}
+
+
+// Counts the nodes in a document, touching every object and string the way a reader would.
+static size_t countNodes(Value v) {
+    size_t n = 1;
+    switch (v.type()) {
+        case Type::String:
+            doNotOptimize(v.as<String>().str().back());
+            break;
+        case Type::Array:
+            for (Val const& item : v.as<Array>())
+                n += countNodes(item);
+            break;
+        case Type::Vector:
+            for (Val const& item : v.as<Vector>())
+                n += countNodes(item);
+            break;
+        case Type::Dict:
+            for (DictEntry const& entry : v.as<Dict>())
+                n += countNodes(entry.value);
+            break;
+        default:
+            break;
+    }
+    return n;
+}
+
+
+// How the GC's copy order affects the time to traverse a parsed document afterwards, compared
+// to its layout straight out of the parser. Also measures the GC time of each order.
+BENCHMARK(GCOrder) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping GCOrder benchmarks: couldn't read twitter.json\n";
+        return;
+    }
+    size_t capacity = json.size() * 4 + 100000;
+    Heap heap(capacity), other(capacity);
+    UsingHeap u(heap);
+
+    auto traverse = [&](string const& name) {
+        size_t nodes = 0;
+        Result *result = runner.measure("GCOrder/traverse/" + name, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+                nodes = countNodes(heap.root());
+            doNotOptimize(nodes);
+        }, 1, heap.used());
+        runner.addCounter(result, "nodes", double(nodes));
+        runner.addMissCounters(result, [&]{doNotOptimize(countNodes(heap.root()));});
+    };
+
+    heap.setRoot(newFromJSON(json, heap).as<Object>());
+    traverse("parsed");
+
+    for (GCOrder order : {GCOrder::BreadthFirst, GCOrder::DepthFirst}) {
+        string name = (order == GCOrder::BreadthFirst) ? "breadth-first" : "depth-first";
+        GarbageCollector::run(heap, other, order);
+        runner.measureOnce("GCOrder/gc/" + name, []{}, [&]{
+            GarbageCollector::run(heap, other, order);
+        }, 1, heap.used());
+        traverse(name);
+    }
+}
+
+
+// Hash-consing a parsed document, and the traversal speed and heap size afterwards.
+BENCHMARK(Deduplicate) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping Deduplicate benchmarks: couldn't read twitter.json\n";
+        return;
+    }
+    Heap heap(json.size() * 4 + 100000);
+    UsingHeap u(heap);
+
+    size_t shared = 0, usedBefore = 0;
+    Result *result = runner.measureOnce("Deduplicate/gc", [&]{
+        heap.reset();
+        heap.setRoot(newFromJSON(json, heap).as<Object>());
+        GarbageCollector::run(heap);
+        usedBefore = heap.used();
+    }, [&]{
+        shared = GarbageCollector::runDeduplicating(heap);
+    });
+    runner.addCounter(result, "heap before", double(usedBefore));
+    runner.addCounter(result, "heap after", double(heap.used()));
+    runner.addCounter(result, "bytes shared", double(shared));
+
+    size_t nodes = 0;
+    Result *traversal = runner.measure("Deduplicate/traverse", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            nodes = countNodes(heap.root());
+        doNotOptimize(nodes);
+    }, 1, heap.used());
+    runner.addMissCounters(traversal, [&]{doNotOptimize(countNodes(heap.root()));});
+}
+
+
+// Deep equality, hashing and ordering of two separately-parsed copies of a document, which
+// share no objects, so every node is examined.
+BENCHMARK(DeepCompare) {
+    string json = readFile(runner.dataDir + "twitter.json");
+    if (json.empty()) {
+        cerr << "Skipping DeepCompare benchmarks: couldn't read twitter.json\n";
+        return;
+    }
+    Heap heap(json.size() * 8);
+    UsingHeap u(heap);
+    Value a = newFromJSON(json, heap), b = newFromJSON(json, heap);
+    if (!a || !b || !deepEquals(a, b)) {
+        cerr << "DeepCompare: couldn't parse twitter.json, or copies weren't equal\n";
+        return;
+    }
+    size_t nodes = countNodes(a);
+
+    runner.measure("DeepCompare/equals", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            doNotOptimize(deepEquals(a, b));
+    }, nodes, heap.used() / 2);
+    runner.measure("DeepCompare/hash", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            doNotOptimize(deepHash(a));
+    }, nodes, heap.used() / 2);
+    runner.measure("DeepCompare/compare", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+            doNotOptimize(deepCompare(a, b));
+    }, nodes, heap.used() / 2);
+}
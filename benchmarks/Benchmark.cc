@@ -0,0 +1,274 @@
+//
+// Benchmark.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Benchmark.hh"
+#include "PerfCounters.hh"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace snej::smol::bench {
+
+using namespace std;
+using clock = std::chrono::steady_clock;
+
+
+#pragma mark - REGISTRY:
+
+
+struct Registered {
+    const char* name;
+    BenchmarkFn fn;
+};
+
+static vector<Registered>& registry() {
+    static vector<Registered> sRegistry;
+    return sRegistry;
+}
+
+Registrar::Registrar(const char *name, BenchmarkFn fn) {
+    registry().push_back({name, fn});
+}
+
+
+#pragma mark - RUNNER:
+
+
+static double elapsedNs(clock::time_point start) {
+    return double(chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count());
+}
+
+
+Runner::Runner()
+:log(&cout)
+{ }
+
+
+bool Runner::wants(string const& name) const {
+    return filter.empty() || name.find(filter) != string::npos;
+}
+
+
+Result* Runner::measure(string const& name, Body body,
+                        uint64_t opsPerIteration, uint64_t bytesPerIteration)
+{
+    if (!wants(name))
+        return nullptr;
+    // Calibrate: find an iteration count that takes at least minSampleTime:
+    uint64_t iterations = 1;
+    while (true) {
+        auto start = clock::now();
+        body(iterations);
+        if (elapsedNs(start) >= minSampleTime.count() || iterations >= (uint64_t(1) << 40))
+            break;
+        iterations *= 2;
+    }
+
+    vector<double> sampleNs;
+    for (unsigned i = 0; i < samples; ++i) {
+        auto start = clock::now();
+        body(iterations);
+        sampleNs.push_back(elapsedNs(start));
+    }
+    return addResult(name, sampleNs, iterations, opsPerIteration, bytesPerIteration);
+}
+
+
+Result* Runner::measureOnce(string const& name,
+                            function_ref<void()> setup,
+                            function_ref<void()> body,
+                            uint64_t opsPerRun, uint64_t bytesPerRun)
+{
+    if (!wants(name))
+        return nullptr;
+    vector<double> sampleNs;
+    for (unsigned i = 0; i < samples; ++i) {
+        setup();
+        auto start = clock::now();
+        body();
+        sampleNs.push_back(elapsedNs(start));
+    }
+    return addResult(name, sampleNs, 1, opsPerRun, bytesPerRun);
+}
+
+
+Result* Runner::addResult(string const& name, vector<double> &sampleNs,
+                          uint64_t iterations, uint64_t opsPerIteration, uint64_t bytesPerIteration)
+{
+    std::sort(sampleNs.begin(), sampleNs.end());
+    double ops = double(iterations) * double(opsPerIteration);
+    double median = sampleNs[sampleNs.size() / 2];
+    Result result {name, iterations, opsPerIteration, median / ops, sampleNs[0] / ops, 0.0};
+    if (bytesPerIteration)
+        result.bytesPerSec = double(bytesPerIteration) * double(iterations) / (median / 1e9);
+    _results.push_back(result);
+
+    ostream &out = *log;
+    out << left << setw(44) << name << right << fixed << setprecision(2)
+        << setw(12) << result.nsPerOp << " ns/op";
+    if (result.bytesPerSec)
+        out << setw(10) << result.bytesPerSec / 1e6 << " MB/s";
+    out << defaultfloat << endl;
+    return &_results.back();
+}
+
+
+void Runner::addCounter(Result *result, string const& name, double value) {
+    if (!result)
+        return;
+    result->counters.emplace_back(name, value);
+    *log << "    " << left << setw(40) << name << right << setw(16) << value << endl;
+}
+
+
+void Runner::addMissCounters(Result *result, function_ref<void()> fn) {
+    if (!result || !PerfCounts::available())
+        return;
+    PerfCounts start = PerfCounts::now();
+    fn();
+    PerfCounts counts = PerfCounts::now() - start;
+    for (PerfEvent event : {PerfEvent::L1DMisses, PerfEvent::LLCMisses, PerfEvent::DTLBMisses}) {
+        if (PerfCounts::available(event))
+            addCounter(result, PerfEventName(event), double(counts[event]));
+    }
+}
+
+
+static void writeJSONString(ostream &out, string_view str) {
+    out << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (uint8_t(c) < 0x20)
+            out << "\\u00" << hex << setw(2) << setfill('0') << int(c) << dec << setfill(' ');
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+
+void Runner::writeJSON(ostream &out) const {
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    out << "{\n  \"context\": {\"date\": \"" << date << "\", \"compiler\": ";
+    writeJSONString(out, __VERSION__);
+#ifdef NDEBUG
+    out << ", \"build_type\": \"release\"";
+#else
+    out << ", \"build_type\": \"debug\"";
+#endif
+    out << "},\n  \"benchmarks\": [";
+    bool first = true;
+    out << setprecision(6);
+    for (auto &r : _results) {
+        out << (first ? "\n" : ",\n") << "    {\"name\": ";
+        writeJSONString(out, r.name);
+        out << ", \"iterations\": " << r.iterations
+            << ", \"ops_per_iteration\": " << r.opsPerIteration
+            << ", \"ns_per_op\": " << r.nsPerOp
+            << ", \"min_ns_per_op\": " << r.minNsPerOp;
+        if (r.bytesPerSec)
+            out << ", \"bytes_per_second\": " << r.bytesPerSec;
+        for (auto &[key, value] : r.counters) {
+            out << ", ";
+            writeJSONString(out, key);
+            out << ": " << value;
+        }
+        out << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
+
+
+using namespace snej::smol;
+using namespace snej::smol::bench;
+
+static void usage() {
+    fprintf(stderr, "usage: smol_bench [--filter SUBSTRING] [--json FILE] [--data DIR] [--samples N] [--perf]\n"
+                    "  --filter   only run benchmarks whose names contain SUBSTRING\n"
+                    "  --json     write results as JSON to FILE ('-' for stdout)\n"
+                    "  --data     directory containing the JSON test files (default tests/data/)\n"
+                    "  --samples  number of timed samples per benchmark (default 7)\n"
+                    "  --perf     count hardware events in GC & JSON parsing, and print totals\n");
+}
+
+
+int main(int argc, const char *argv[]) {
+    Runner runner;
+    const char *jsonPath = nullptr;
+    bool perf = false;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--perf") == 0) {
+            perf = true;
+            continue;
+        } else if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        if (strcmp(arg, "--filter") == 0) {
+            runner.filter = argv[++i];
+        } else if (strcmp(arg, "--json") == 0) {
+            jsonPath = argv[++i];
+        } else if (strcmp(arg, "--data") == 0) {
+            runner.dataDir = argv[++i];
+            if (!runner.dataDir.ends_with('/'))
+                runner.dataDir += '/';
+        } else if (strcmp(arg, "--samples") == 0) {
+            runner.samples = std::max(1, atoi(argv[++i]));
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (jsonPath && strcmp(jsonPath, "-") == 0)
+        runner.log = &std::cerr;
+    if (perf && !PerfRegion::setEnabled(true))
+        *runner.log << "(Performance counters are not available)\n";
+    for (auto &bench : registry())
+        bench.fn(runner);
+    if (PerfRegion::enabled()) {
+        *runner.log << "\nPerformance counter totals:\n";
+        PerfRegion::writeStats(*runner.log);
+    }
+
+    if (jsonPath) {
+        if (strcmp(jsonPath, "-") == 0) {
+            runner.writeJSON(std::cout);
+        } else {
+            std::ofstream out(jsonPath);
+            runner.writeJSON(out);
+            if (!out) {
+                fprintf(stderr, "Couldn't write %s\n", jsonPath);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+//
+// Benchmark.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "function_ref.hh"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace snej::smol::bench {
+
+/// The measured result of one benchmark.
+struct Result {
+    std::string name;
+    uint64_t    iterations;         ///< Iterations per sample
+    uint64_t    opsPerIteration;    ///< Operations performed by each iteration
+    double      nsPerOp;            ///< Median over all samples
+    double      minNsPerOp;         ///< Fastest sample
+    double      bytesPerSec;        ///< Throughput, if `bytesPerIteration` was given; else 0
+    std::vector<std::pair<std::string,double>> counters;   ///< Extra named measurements
+};
+
+
+/// Runs benchmarks and collects their Results.
+///
+/// Each measurement calls its function with an iteration count, first doubling the count until
+/// one call takes at least `minSampleTime`, then taking `samples` timed calls at that count.
+/// Reported times are per operation (iterations × opsPerIteration) and are the median of the
+/// samples, which is less noisy than the mean.
+class Runner {
+public:
+    using Body = function_ref<void(uint64_t iterations)>;
+
+    /// Measures `body`. `opsPerIteration` is the number of operations each iteration performs,
+    /// and `bytesPerIteration` (if nonzero) the number of bytes it processes, for throughput.
+    /// Returns the Result, or nullptr if the name didn't match the filter.
+    Result* measure(std::string const& name, Body body,
+                 uint64_t opsPerIteration = 1,
+                 uint64_t bytesPerIteration = 0);
+
+    /// Measures a single run of `body`, repeated `samples` times, with a fresh call to `setup`
+    /// (untimed) before each. For operations too expensive or stateful to loop over, like GC.
+    Result* measureOnce(std::string const& name,
+                     function_ref<void()> setup,
+                     function_ref<void()> body,
+                     uint64_t opsPerRun = 1,
+                     uint64_t bytesPerRun = 0);
+
+    /// Attaches an extra named value, like memory used, to a Result. Does nothing if it's null.
+    void addCounter(Result*, std::string const& name, double value);
+
+    /// Runs `fn` once, attaching the number of cache and TLB misses it caused to the Result,
+    /// if hardware performance counters are available. Does nothing if the Result is null.
+    void addMissCounters(Result*, function_ref<void()> fn);
+
+    /// True if the benchmark name matches the command-line filter.
+    bool wants(std::string const& name) const;
+
+    std::deque<Result> const& results() const       {return _results;}
+
+    void writeJSON(std::ostream&) const;
+
+    std::string filter;                                 ///< Substring names must contain
+    std::chrono::nanoseconds minSampleTime = std::chrono::milliseconds(20);
+    unsigned samples = 7;
+    std::string dataDir = "tests/data/";                ///< Directory of JSON test files
+    std::ostream* log;                                  ///< Where to print results as they finish
+
+    Runner();
+
+private:
+    Result* addResult(std::string const& name, std::vector<double> &sampleNs,
+                   uint64_t iterations, uint64_t opsPerIteration, uint64_t bytesPerIteration);
+
+    std::deque<Result> _results;
+};
+
+
+/// Signature of a benchmark function; it calls `measure` one or more times.
+using BenchmarkFn = void (*)(Runner&);
+
+/// Registers a benchmark function at static-init time; use via the `BENCHMARK` macro.
+struct Registrar {
+    Registrar(const char *name, BenchmarkFn);
+};
+
+
+/// Prevents the optimizer from discarding a computed value.
+template <typename T>
+inline void doNotOptimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+}
+
+
+/// Defines and registers a benchmark function, whose parameter is `Runner& runner`.
+#define BENCHMARK(NAME) \
+    static void bench_##NAME(snej::smol::bench::Runner&); \
+    static snej::smol::bench::Registrar bench_##NAME##_registrar(#NAME, &bench_##NAME); \
+    static void bench_##NAME(snej::smol::bench::Runner& runner)
@@ -0,0 +1,199 @@
+//
+// FuzzMain.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// A standalone driver for the fuzz targets, for compilers without libFuzzer.
+// It runs the target on every file named on the command line (directories are expanded), or
+// on stdin if there are none, which makes it usable as an AFL target. With `-runs=N` it also
+// runs each input through N random mutations, which makes a quick smoke test under sanitizers.
+// If an input crashes, it's saved to a file named `crash` (prefixed by `-artifact_prefix`.)
+//
+//      smol_fuzz_JSON [-runs=N] [-seed=N] [-max_len=N] [-artifact_prefix=P] FILE_OR_DIR ...
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Called by the sanitizer runtimes, if present, before they exit after reporting an error.
+extern "C" void __sanitizer_set_death_callback(void (*)()) __attribute__((weak));
+
+
+using Input = vector<uint8_t>;
+
+
+static Input readInput(istream &in) {
+    return Input(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+
+static void addInputs(filesystem::path const& path, vector<filesystem::path> &paths) {
+    if (filesystem::is_directory(path)) {
+        for (auto &entry : filesystem::directory_iterator(path))
+            if (entry.is_regular_file())
+                paths.push_back(entry.path());
+    } else {
+        paths.push_back(path);
+    }
+}
+
+
+/// Applies a few random edits of the kinds that tend to find bugs in binary formats:
+/// bit flips, "interesting" byte values, and insertion, deletion or duplication of bytes.
+static void mutate(Input &input, size_t maxLen, mt19937 &rng) {
+    auto rand = [&](size_t n) {return size_t(uniform_int_distribution<size_t>(0, n - 1)(rng));};
+    static constexpr uint8_t kInteresting[] = {0x00, 0x01, 0x7F, 0x80, 0xFF};
+    for (size_t n = 1 + rand(4); n > 0; --n) {
+        if (input.empty()) {
+            input.push_back(uint8_t(rand(256)));
+            continue;
+        }
+        size_t pos = rand(input.size());
+        switch (rand(6)) {
+            case 0: input[pos] ^= uint8_t(1 << rand(8)); break;
+            case 1: input[pos] = uint8_t(rand(256)); break;
+            case 2: input[pos] = kInteresting[rand(size(kInteresting))]; break;
+            case 3: input.insert(input.begin() + pos, uint8_t(rand(256))); break;
+            case 4: input.erase(input.begin() + pos); break;
+            case 5: {
+                // Copy a short run of bytes over another position:
+                size_t len = min(1 + rand(8), input.size() - pos);
+                size_t dst = rand(input.size() - len + 1);
+                memmove(&input[dst], &input[pos], len);
+                break;
+            }
+        }
+    }
+    if (input.size() > maxLen)
+        input.resize(maxLen);
+}
+
+
+static string sCrashPath = "crash";
+static Input const* sCurInput;
+
+
+// Writes the current input to the crash file. Called from signal handlers, so it must only
+// make async-signal-safe calls.
+static void saveCrash() {
+    if (!sCurInput)
+        return;
+    int fd = ::open(sCrashPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        (void)::write(fd, sCurInput->data(), sCurInput->size());
+        ::close(fd);
+        static constexpr char kMsg[] = "Saved crashing input\n";
+        (void)::write(STDERR_FILENO, kMsg, sizeof(kMsg) - 1);
+    }
+    sCurInput = nullptr;
+}
+
+
+static void crashHandler(int sig) {
+    saveCrash();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+static void installCrashHandlers() {
+    if (__sanitizer_set_death_callback) {
+        // The sanitizer handles crashes; don't get in the way of its reports.
+        __sanitizer_set_death_callback(&saveCrash);
+        signal(SIGABRT, &crashHandler);                 // Assertion failures don't go through it
+    } else {
+        for (int sig : {SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL})
+            signal(sig, &crashHandler);
+    }
+}
+
+
+static void run(Input const& input) {
+    // Run on an exactly-sized heap copy, so ASan can catch reads past the end:
+    auto copy = make_unique<uint8_t[]>(input.size());
+    if (!input.empty())
+        memcpy(copy.get(), input.data(), input.size());
+    sCurInput = &input;
+    LLVMFuzzerTestOneInput(copy.get(), input.size());
+    sCurInput = nullptr;
+}
+
+
+int main(int argc, const char *argv[]) {
+    unsigned runs = 0;
+    unsigned seed = random_device()();
+    size_t maxLen = SIZE_MAX;
+    vector<filesystem::path> paths;
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "-runs=", 6) == 0)
+            runs = unsigned(strtoul(arg + 6, nullptr, 10));
+        else if (strncmp(arg, "-seed=", 6) == 0)
+            seed = unsigned(strtoul(arg + 6, nullptr, 10));
+        else if (strncmp(arg, "-max_len=", 9) == 0)
+            maxLen = strtoul(arg + 9, nullptr, 10);
+        else if (strncmp(arg, "-artifact_prefix=", 17) == 0)
+            sCrashPath = string(arg + 17) + "crash";
+        else if (arg[0] == '-')
+            cerr << "Ignoring unknown option " << arg << "\n";   // (e.g. libFuzzer options)
+        else
+            addInputs(arg, paths);
+    }
+
+    installCrashHandlers();
+
+    if (paths.empty()) {
+        run(readInput(cin));
+        return 0;
+    }
+
+    cerr << "Running " << paths.size() << " inputs, " << runs << " mutations each, seed="
+         << seed << "\n";
+    mt19937 rng(seed);
+    for (auto &path : paths) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            cerr << "Couldn't read " << path << "\n";
+            return 1;
+        }
+        Input input = readInput(in);
+        if (input.size() > maxLen)
+            input.resize(maxLen);
+        run(input);
+        for (unsigned i = 0; i < runs; ++i) {
+            Input mutated = input;
+            mutate(mutated, maxLen, rng);
+            run(mutated);
+        }
+    }
+    cerr << "Done\n";
+    return 0;
+}
@@ -0,0 +1,47 @@
+//
+// FuzzUtils.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "smol_world.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace snej::smol::fuzz {
+
+/// Copies fuzzer input into an aligned buffer, as if it had been read from a file,
+/// and opens it as a Heap.
+class HeapImage {
+public:
+    HeapImage(const uint8_t *data, size_t size)
+    :_buffer(std::make_unique<uint64_t[]>(size / sizeof(uint64_t) + 1))
+    ,_size(size)
+    {
+        ::memcpy(_buffer.get(), data, size);
+    }
+
+    /// Returns a Heap on the image's data, with no free space. Check `invalid()` before using it.
+    Heap open() {
+        return Heap::existing(slice<byte>((byte*)_buffer.get(), _size), _size);
+    }
+
+private:
+    std::unique_ptr<uint64_t[]> _buffer;
+    size_t                      _size;
+};
+
+}
+
+
+/// Like `assert`, but enabled in release builds too, since fuzzers are usually built optimized.
+#define FUZZ_CHECK(COND) \
+    do { \
+        if (!(COND)) { \
+            fprintf(stderr, "FUZZ_CHECK failed: %s (%s:%d)\n", #COND, __FILE__, __LINE__); \
+            abort(); \
+        } \
+    } while (false)
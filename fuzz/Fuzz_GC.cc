@@ -0,0 +1,59 @@
+//
+// Fuzz_GC.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Fuzz target that garbage-collects a valid heap created from its input, in each GCOrder, and
+// checks that the result is still valid and has the same reachable blocks. Then it does the
+// same after deduplicating, which may leave fewer.
+
+#include "FuzzUtils.hh"
+
+using namespace snej::smol;
+
+
+static size_t countLiveBlocks(Heap &heap) {
+    size_t n = 0;
+    heap.visitBlocks([&](Block const&) {
+        ++n;
+        return true;
+    });
+    return n;
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzz::HeapImage image(data, size);
+    Heap heap = image.open();
+    if (heap.invalid() || !heap.validate())
+        return 0;
+    UsingHeap u(heap);
+
+    size_t nLive = countLiveBlocks(heap);
+    Heap otherHeap(heap.capacity());
+    for (GCOrder order : {GCOrder::BreadthFirst, GCOrder::DepthFirst}) {
+        GarbageCollector::run(heap, otherHeap, order);
+        FUZZ_CHECK(heap.validate());
+        FUZZ_CHECK(countLiveBlocks(heap) == nLive);
+    }
+
+    // Deduplicating can only make fewer blocks reachable:
+    size_t shared = GarbageCollector::runDeduplicating(heap);
+    FUZZ_CHECK(heap.validate());
+    FUZZ_CHECK(countLiveBlocks(heap) <= nLive);
+    FUZZ_CHECK(shared > 0 || countLiveBlocks(heap) == nLive);
+    return 0;
+}
@@ -0,0 +1,68 @@
+//
+// Fuzz_Heap.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Fuzz target that treats its input as persisted heap data, as if it came from an untrusted
+// peer: it opens it with `Heap::existing`, and if `validate` accepts it, walks all its blocks
+// and its object graph. Any crash or sanitizer error after a successful `validate` is a hole
+// in the validator.
+
+#include "FuzzUtils.hh"
+#include "HeapProfiler.hh"
+#include <sstream>
+
+using namespace snej::smol;
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    fuzz::HeapImage image(data, size);
+    Heap heap = image.open();
+    if (heap.invalid() || !heap.validate())
+        return 0;
+    UsingHeap u(heap);
+
+    size_t nBlocks = 0;
+    heap.visitAll([&](Block const& block) {
+        ++nBlocks;
+        return true;
+    });
+
+    size_t nLive = 0;
+    heap.visitBlocks([&](Block const&) {
+        ++nLive;
+        return true;
+    });
+    FUZZ_CHECK(nLive <= nBlocks);
+
+    // The census reads the contents of every block, including Strings, Vectors and Dicts:
+    HeapCensus census(heap);
+    FUZZ_CHECK(census.live.count + census.dead.count == nBlocks);
+    std::stringstream out;
+    census.write(out);
+
+    // Splicing it into another Heap must produce a valid Heap:
+    if (heap.root()) {
+        Heap dst(2 * heap.used() + 1000);
+        UsingHeap u2(dst);
+        FUZZ_CHECK(newSymbol("fuzz", dst));
+        auto spliced = dst.splice(heap);
+        FUZZ_CHECK(spliced);
+        dst.setRoot(spliced);
+        FUZZ_CHECK(dst.validate());
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+//
+// Fuzz_JSON.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Fuzz target that parses its input as JSON into a Heap. If that succeeds, the Heap must be
+// valid, must survive garbage collection, and must produce the same JSON before and after.
+// Parsing it with a JSONProjection, or as a LazyJSON, must also succeed. A second parse must be
+// deeply equal to the first. Conversely, whatever LazyJSON accepts must be buildable.
+
+#include "FuzzUtils.hh"
+#include <cstring>
+#include <string_view>
+
+using namespace snej::smol;
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    std::string error;
+    Value root = newFromJSON(std::string_view((const char*)data, size), heap, &error);
+
+    // Any JSON that LazyJSON accepts must build into values, given enough room:
+    if (!root && size < 10000) {
+        Heap lazyHeap(size * 8 + 100000);
+        UsingHeap lu(lazyHeap);
+        if (auto lazy = LazyJSON::create(std::string_view((const char*)data, size), lazyHeap))
+            FUZZ_CHECK(lazy->root().value());
+    }
+
+    if (!root.isObject())
+        return 0;
+    heap.setRoot(root.as<Object>());
+    FUZZ_CHECK(heap.validate());
+
+    // Valid JSON must also parse with a projection, into a valid Heap:
+    {
+        Heap projHeap(100000);
+        UsingHeap pu(projHeap);
+        JSONProjection projection {"0.a", "*.*.b", "a.*"};
+        Value proj = newFromJSON(std::string_view((const char*)data, size), projHeap, projection);
+        FUZZ_CHECK(proj);
+        FUZZ_CHECK(projHeap.validate());
+    }
+
+    std::string json = toJSON(root);
+
+    // LazyJSON must accept it too, and build the same values. (rapidjson stops at a NUL byte,
+    // but LazyJSON rejects one, so skip those inputs.)
+    if (!memchr(data, 0, size)) {
+        Heap lazyHeap(size * 4 + 100000);
+        UsingHeap lu(lazyHeap);
+        auto lazy = LazyJSON::create(std::string_view((const char*)data, size), lazyHeap);
+        FUZZ_CHECK(lazy);
+        FUZZ_CHECK(toJSON(lazy->root().value()) == json);
+        FUZZ_CHECK(lazyHeap.validate());
+    }
+    GarbageCollector::run(heap);
+    FUZZ_CHECK(heap.validate());
+    FUZZ_CHECK(toJSON(heap.root()) == json);
+
+    // Parsing it again (if there's room) gives a deeply equal copy:
+    if (Value copy = newFromJSON(std::string_view((const char*)data, size), heap)) {
+        root = heap.root();
+        FUZZ_CHECK(deepEquals(root, copy));
+        FUZZ_CHECK(deepCompare(root, copy) == 0 && deepCompare(copy, root) == 0);
+        FUZZ_CHECK(deepHash(root) == deepHash(copy));
+    }
+    return 0;
+}
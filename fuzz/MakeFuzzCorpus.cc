@@ -0,0 +1,83 @@
+//
+// MakeFuzzCorpus.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Creates seed corpora for the fuzz targets from JSON files: it copies each file into
+// `OUTPUT_DIR/json/`, and parses it into a Heap whose contents it writes to `OUTPUT_DIR/heap/`.
+// It also writes a small heap containing aligned blocks.
+//
+//      smol_make_fuzz_corpus OUTPUT_DIR JSON_FILE ...
+
+#include "smol_world.hh"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+using namespace std;
+using namespace snej::smol;
+
+
+static void writeHeap(Heap const& heap, filesystem::path const& path) {
+    auto contents = heap.contents();
+    ofstream out(path, ios::binary);
+    out.write((const char*)contents.begin(), contents.size());
+}
+
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " OUTPUT_DIR JSON_FILE ...\n";
+        return 1;
+    }
+    filesystem::path jsonDir = filesystem::path(argv[1]) / "json";
+    filesystem::path heapDir = filesystem::path(argv[1]) / "heap";
+    filesystem::create_directories(jsonDir);
+    filesystem::create_directories(heapDir);
+    for (int i = 2; i < argc; ++i) {
+        filesystem::path path = argv[i];
+        ifstream in(path, ios::binary);
+        string json(istreambuf_iterator<char>(in), {});
+        ofstream(jsonDir / path.filename(), ios::binary) << json;
+
+        Heap heap(json.size() * 4 + 1000);
+        UsingHeap u(heap);
+        Value root = newFromJSON(json, heap);
+        if (!root.isObject()) {
+            cerr << "Couldn't parse " << path << "\n";
+            return 1;
+        }
+        heap.setRoot(root.as<Object>());
+        GarbageCollector::run(heap);
+
+        writeHeap(heap, heapDir / path.filename().replace_extension(".heap"));
+    }
+
+    // Plus a heap with aligned blocks, so the fuzzers see Pad blocks:
+    Heap heap(10000);
+    UsingHeap u(heap);
+    Array root = newArray(3, heap).value();
+    heap.setRoot(root);
+    for (heapsize i = 0; i < 3; ++i) {
+        Block *block = heap.allocBlock(10 * (i + 1), Type::Blob, 8 << i);
+        block->fill(slice<byte>{});
+        root[i] = Value(block);
+    }
+    writeHeap(heap, heapDir / "aligned.heap");
+    return 0;
+}
@@ -40,12 +40,17 @@
     // statement to make faster.
     #define _likely(VAL)                __builtin_expect(VAL, true)
     #define _unlikely(VAL)              __builtin_expect(VAL, false)
+
+    // Hints to the CPU that the memory at ADDR will be read soon, so it can start loading it
+    // into the cache. Useful when a loop can compute several addresses before using any.
+    #define _prefetch(ADDR)             __builtin_prefetch(ADDR)
 #else
     #define RETURNS_NONNULL
     #define MUST_USE_RESULT
 
     #define _likely(VAL)                (VAL)
     #define _unlikely(VAL)              (VAL)
+    #define _prefetch(ADDR)             ((void)(ADDR))
 #endif
 
 // Declares that a parameter must not be NULL. The compiler can sometimes detect violations
@@ -73,7 +78,10 @@
 //  declared with the pure attribute can safely read any non-volatile objects, and modify the value
 //  of objects in a way that does not affect their return value or the observable state of the
 //  program." -- GCC manual
-#if (defined(__GNUC__) || __has_attribute(__pure__)) && !defined(CPPCHECK)
+//
+// Note: GCC does not accept attributes after the declarator of a function _definition_, which is
+// where this codebase puts them, so these two are only enabled with Clang.
+#if defined(__clang__) && !defined(CPPCHECK)
     #define pure                      __attribute__((__pure__))
 #else
     #define pure
@@ -95,7 +103,7 @@
 // "In general, since a function cannot distinguish data that might change from data that cannot,
 //  const functions should never take pointer or, in C++, reference arguments. Likewise, a function
 //  that calls a non-const function usually must not be const itself." -- GCC manual
-#if defined(__GNUC__) || __has_attribute(__const__)
+#if defined(__clang__) && !defined(CPPCHECK)
     #define CONST                     __attribute__((__const__))
 #else
     #define CONST
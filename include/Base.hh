@@ -7,9 +7,13 @@
 #pragma once
 #include "Base.h"
 #include <cassert>
+#include <compare>
+#include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <type_traits>
 #include <utility>
 
 namespace snej::smol {
@@ -37,29 +41,31 @@ static inline std::strong_ordering operator<=> (heappos p, intpos i) {return int
 
 
 template <typename NUM>
-    concept Numeric = requires { std::integral<NUM> || std::floating_point<NUM>; };
+    concept Numeric = std::integral<NUM> || std::floating_point<NUM>;
 
 /// Converts between two numeric types, pinning out-of-range values to the nearest limit.
 template <Numeric TO, Numeric FROM>
     constexpr TO pinning_cast(FROM n) {
-        if constexpr (std::numeric_limits<FROM>::is_signed && !std::numeric_limits<TO>::is_signed) {
-            if (n < 0)
-                return 0;
+        if constexpr (std::is_same_v<TO, FROM>) {
+            return n;
+        } else {
+            if constexpr (std::numeric_limits<FROM>::is_signed && !std::numeric_limits<TO>::is_signed) {
+                if (n < 0)
+                    return 0;
+            }
+            if (n < std::numeric_limits<TO>::lowest())
+                return std::numeric_limits<TO>::lowest();
+            else if (n > std::numeric_limits<TO>::max())
+                return std::numeric_limits<TO>::max();
+            else
+                return static_cast<TO>(n);
         }
-        if (n < std::numeric_limits<TO>::lowest())
-            return std::numeric_limits<TO>::lowest();
-        else if (n > std::numeric_limits<TO>::max())
-            return std::numeric_limits<TO>::max();
-        else
-            return static_cast<TO>(n);
     }
 
-template <Numeric FROM>
-    constexpr FROM pinning_cast(FROM n) {return n;}
-
 
 class Block;
 class Heap;
+class HeapProfiler;
 class Object;
 class SymbolTable;
 class Val;
@@ -9,6 +9,7 @@
 #include "slice.hh"
 #include "Val.hh"
 #include <algorithm>
+#include <cstring>
 #include <string_view>
 
 namespace snej::smol {
@@ -94,6 +95,24 @@ public:
         return containsVals() ? slice_cast<Val>(data()) : slice<Val>();
     }
 
+    /// The Vals that are in use: for a Vector its count and items, for a Dict its non-empty
+    /// entries, else all of them. Unused capacity may hold stale pointers, which aren't live.
+    slice<Val> usedVals() const pure {
+        slice<Val> all = vals();
+        switch (type()) {
+            case Type::Vector:
+                return all.upTo(1 + all[0].asInt());
+            case Type::Dict: {
+                uint32_t n = 0;
+                while (n < all.size() && !all[n].isNull())
+                    n += 2;
+                return all.upTo(n);
+            }
+            default:
+                return all;
+        }
+    }
+
     void fill(slice<Val> contents) {
         assert(containsVals());
         auto vals = slice_cast<Val>(data());
@@ -127,6 +146,18 @@ public:
         return true;
     }
 
+    //---- Alignment:
+
+    static constexpr heapsize kMinAlignment = 4;    ///< Smallest alignment `allocBlock` takes
+    static constexpr heapsize kMaxAlignment = 64;   ///< Largest alignment `allocBlock` takes
+
+    /// In a Pad block, the alignment of the next block's data.
+    heapsize padAlignment() const pure {
+        assert(type() == Type::Pad);
+        auto shift = uint8_t(data()[0]);                 // It stores log2 of the alignment
+        return shift < 32 ? heapsize(1) << shift : 0;
+    }
+
     //---- Data type:
 
     Type type() const pure                      {assert(!isForwarded());
@@ -170,16 +201,36 @@ public:
             case Type::Array:
                 if (size & 0x3) return "An Array has an invalid size";
                 break;
-            case Type::Vector:
+            case Type::Vector: {
                 if ((size & 0x3) || size == 0) return "A Vector has an invalid size";
+                Val const& count = vals()[0];
+                if (!count.isInt() || count.asInt() < 0 || count.asInt() >= size / sizeof(Val))
+                    return "A Vector has an invalid count";
                 break;
-            case Type::Dict:
+            }
+            case Type::Dict: {
                 if (size & 0x7) return "A Dict has an invalid size";
+                // Keys must be pointers (to Symbols), followed by null keys for unused entries:
+                bool end = false;
+                slice<Val> entries = vals();
+                for (auto key = entries.begin(); key < entries.end(); key += 2) {
+                    if (key->isNull())
+                        end = true;
+                    else if (end || !key->isObject())
+                        return "A Dict has an invalid key";
+                }
                 break;
-            case Type::String:
+            }
             case Type::Symbol:
+                if (size < 2) return "A Symbol has an invalid size";   // Must have room for ID
+                break;
+            case Type::String:
             case Type::Blob:
                 break;
+            case Type::Pad:
+                if (size < 2 || padAlignment() < kMinAlignment || padAlignment() > kMaxAlignment)
+                    return "a Pad block is invalid";
+                break;
             default:
                 if (TypeIs(t, TypeSet::Valid))
                     return "a block has a non-object type";
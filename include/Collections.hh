@@ -17,7 +17,7 @@ template <typename ITEM, Type TYPE, class Subclass>
 class Collection : public Object {
 public:
     using Item = ITEM;
-    static constexpr Type Type = TYPE;
+    static constexpr smol::Type Type = TYPE;
     static bool HasType(enum Type t) {return t == Type;}
 
     static constexpr heapsize MaxCount = (Block::MaxSize / sizeof(Item)) - 1;
@@ -159,6 +159,8 @@ public:
 
     Val* find(Symbol key);
     const Val* find(Symbol key) const           {return const_cast<Dict*>(this)->find(key);}
+    /// Looks up a key by its Symbol's ID, which is unique within a Heap.
+    Val* find(Symbol::ID);
     Value get(Symbol key) const                 {auto v = find(key); return v ? Value(*v) :nullptr;}
     bool contains(Symbol key) const             {return find(key) != nullptr;}
 
@@ -0,0 +1,39 @@
+//
+// Compare.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Value.hh"
+
+namespace snej::smol {
+
+// Deep equality, hashing and ordering of Values. Unlike `==`, which compares identity, these
+// compare Strings, Blobs and numbers by value, and containers by their contents, recursively.
+// (They don't recurse on the C++ stack, so deep documents are fine, but they won't terminate
+// on a cyclic structure.) Identical objects are never examined.
+//
+// The rules are the same as for HashMap keys:
+// - Ints and BigInts are compared by numeric value. Floats are compared by value too, with
+//   -0 equal to 0 and NaN equal to itself, but never equal an integer.
+// - Strings and Blobs are compared by contents. Symbols, Null and Bool only equal themselves.
+// - Arrays, Vectors and Dicts are equal to containers of the same type with equal items. Dict
+//   keys are Symbols, so Dicts should be in the same Heap.
+
+/// True if two Values are equal, comparing by contents.
+bool deepEquals(Value a, Value b) pure;
+
+/// A hash code of a Value's contents: if `deepEquals(a, b)`, then `deepHash(a) == deepHash(b)`.
+/// It fits in an Int, and is the same for equal Values in different Heaps (except for Dicts.)
+int32_t deepHash(Value) pure;
+
+/// A total order of Values, consistent with `deepEquals`: returns a negative number if `a`
+/// sorts before `b`, 0 if they're deeply equal, or a positive number if it sorts after.
+/// Values of different types are ordered Null < Bool < numbers < String < Symbol < Blob < Array
+/// < Vector < Dict. Numbers are ordered by value, with NaN last. Strings, Symbols and Blobs
+/// sort bytewise; containers lexicographically by their items, and Dicts by their entries in
+/// the order they're stored, i.e. by Symbol ID.
+int deepCompare(Value a, Value b) pure;
+
+}
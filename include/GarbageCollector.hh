@@ -6,33 +6,64 @@
 
 #pragma once
 #include "Heap.hh"
+#include "PerfCounters.hh"
 #include "Val.hh"
 #include "Value.hh"
+#include <unordered_map>
+#include <vector>
 
 namespace snej::smol {
 
+/// The order in which the GarbageCollector copies objects, which determines their layout
+/// afterwards, and hence the cache locality of traversing them.
+enum class GCOrder : uint8_t {
+    /// Cheney's algorithm: every object reachable in N steps from a root precedes every one
+    /// reachable in N+1. It's the fastest, but a container's descendants end up scattered.
+    BreadthFirst,
+    /// Hierarchical: a container's direct children are copied right after it, then each child's
+    /// subtree in turn. This keeps each container with its children, and each subtree together,
+    /// which speeds up recursive traversals (like writing JSON) after GC. It keeps a stack, so
+    /// it's a bit slower.
+    DepthFirst,
+};
+
+
 /// A typical copying garbage collector that copies all live objects into another Heap.
 /// At the end it swaps the memory of the two Heaps, so the original heap is now clean,
 /// and the other heap can be freed or reused for the next GC.
 class GarbageCollector {
 public:
-    static void run(Heap &heap) {
-        GarbageCollector gc(heap);
+    static void run(Heap &heap, GCOrder order = GCOrder::BreadthFirst) {
+        GarbageCollector gc(heap, order);
     }
 
-    static void run(Heap &heap, Heap &otherHeap) {
-        GarbageCollector gc(heap, otherHeap);
+    static void run(Heap &heap, Heap &otherHeap, GCOrder order = GCOrder::BreadthFirst) {
+        GarbageCollector gc(heap, otherHeap, order);
     }
 
     /// Installs a callback in the Heap that will run GC when it fills up.
     static void runOnDemand(Heap &heap);
 
+    /// Hash-conses the objects reachable from `root`: wherever several Strings, Blobs, numbers,
+    /// Arrays, Vectors or Dicts have identical contents, references to them are changed to point
+    /// to one of them, so later copies become garbage. (Symbols are already unique.) Returns the
+    /// number of bytes of duplicates; run GC afterwards to reclaim them, or call `runDeduplicating`.
+    ///
+    /// Shared objects mustn't be modified, since the change would show up in all the places the
+    /// duplicates were. So `root` should be immutable data, like a parsed JSON document, not a
+    /// HashMap or anything else whose internal Arrays get changed in place.
+    static size_t deduplicate(Heap &heap, Value root);
+
+    /// Deduplicates the objects reachable from the Heap's root, then runs GC.
+    /// The same caveats as `deduplicate` apply to everything under the root.
+    static size_t runDeduplicating(Heap &heap, GCOrder order = GCOrder::BreadthFirst);
+
     /// Constructs the GC and copies all Values reachable from the root into a temporary Heap
     /// with the same capacity as this one.
-    GarbageCollector(Heap &heap);
+    explicit GarbageCollector(Heap &heap, GCOrder = GCOrder::BreadthFirst);
 
     /// Constructs the GC and copies all Values reachable from the root into `otherHeap`.
-    GarbageCollector(Heap &heap, Heap &otherHeap);
+    GarbageCollector(Heap &heap, Heap &otherHeap, GCOrder = GCOrder::BreadthFirst);
 
     /// Updates an existing Val that came from the "from" heap,
     /// returning an equivalent Val that's been copied to the "to" heap.
@@ -53,10 +84,21 @@ public:
 
 private:
     void scanRoots();
+    Block* scanDepthFirst(Block*);
+    struct Alignment {heapsize alignment, padSize;};
+    using AlignmentMap = std::unordered_map<Block const*,Alignment>;
+
+    static AlignmentMap findAlignedBlocks(Heap const&);
+    heapsize alignmentFor(Block const*, heapsize size);
     Block* moveBlock(Block*);
 
+    PerfScope             _perf {GCPerf};   // Declared first, so it spans the whole GC
     std::unique_ptr<Heap> _tempHeap;    // Owns temporary heap, if there is one
     Heap &_fromHeap, &_toHeap;          // The source and destination heaps
+    AlignmentMap _alignments;           // Aligned blocks in _fromHeap
+    intptr_t _padBudget = 0;            // Bytes that can be spent on Pads without overflowing
+    GCOrder _order;
+    std::vector<Block*> _stack;         // Containers not yet scanned, in DepthFirst order
 };
 
 }
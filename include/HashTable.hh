@@ -9,9 +9,15 @@
 #include "Heap.hh"
 #include "SparseArray.hh"
 #include "function_ref.hh"
+#include <optional>
 
 namespace snej::smol {
 
+/// A hash set of Strings or Symbols, stored in a Heap as a SparseArray. (Used by SymbolTable.)
+///
+/// Growing is incremental, so no single insertion has to rehash the whole table: a new table
+/// twice the size is allocated, then each insertion copies a few of the old table's items into it
+/// until they've all been moved. Meanwhile lookups check both tables.
 class HashSet {
 public:
     static int32_t computeHash(std::string_view) pure;
@@ -22,25 +28,41 @@ public:
     HashSet(Heap &heap, Array array);
     HashSet(Heap &heap, unsigned capacity);
 
-    Array array() const pure                        {return _array.array();}
+    /// The HashSet's persistent form. This changes when the table grows, and again when the
+    /// resize finishes, so it needs to be saved again after every insertion.
+    Array array() const pure;
     Heap& heap() const pure                         {return *_heap;}
-    void setHeap(Heap &heap)                        {_heap = &heap; _array.setHeap(heap);}
+    void setHeap(Heap &heap);
 
 //    Array array() const pure                        {return _array;}
     uint32_t count() const pure                     {return _count;}
     uint32_t capacity() const pure                  {return _capacity;}
 
     /// Returns the existing key equal to this string, if any.
-    Value find(std::string_view str) const;
+    Value find(std::string_view str) const          {return find(str, computeHash(str));}
+
+    /// Same as `find`, but takes the string's precomputed `computeHash`.
+    Value find(std::string_view str, int32_t hashCode) const;
+
+    /// Hints to the CPU that a key with this hash code will be looked up soon. Prefetching
+    /// several keys before looking any of them up overlaps their cache misses.
+    void prefetch(int32_t hashCode) const           {_array.prefetch(uint32_t(hashCode) & (_size - 1));}
 
     /// Returns the existing key equal to this string; else calls the `creator` function,
     /// which should return `Value`, and adds the resulting value.
     /// Returns null if the creator function returned null, or if growing the table failed.
     template <typename FN>
     Value findOrInsert(std::string_view str, FN creator) {
-        int32_t hashCode = computeHash(str);
+        return findOrInsert(str, computeHash(str), creator);
+    }
+
+    /// Same as `findOrInsert`, but takes the string's precomputed `computeHash`.
+    template <typename FN>
+    Value findOrInsert(std::string_view str, int32_t hashCode, FN creator) {
         if (auto [i, found] = search(str, hashCode); found) {
             return _array[i];
+        } else if (Value old = searchOld(str, hashCode)) {
+            return old;
         } else {
             Handle symbol(creator(*_heap), *_heap);
             if (!insert(symbol, hashCode, i))
@@ -53,6 +75,15 @@ public:
     /// Returns false if it's a duplicate, or if growing the table failed.
     [[nodiscard]] bool insert(Value key)          {return insert(key, computeHash(key));}
 
+    /// Makes sure `n` more keys can be inserted without the table starting to grow.
+    /// If that needs a bigger table, it grows once, straight to the necessary size; but first, if
+    /// the table is still resizing, it finishes moving the remaining items.
+    /// Returns false if growing the table failed.
+    [[nodiscard]] bool reserve(uint32_t n);
+
+    /// True while the table is growing, i.e. items are still being moved to the bigger table.
+    bool isResizing() const pure                    {return _oldArray.has_value();}
+
     using Visitor = function_ref<bool(Value key)>;
 
     /// Calls the `visitor` callback once with each Value (and its hash code.)
@@ -61,6 +92,7 @@ public:
     void dump(std::ostream&, bool longForm = false) const;
 
 protected:
+    friend class HashMap;
     static bool keysMatch(Value key1, Value key2) pure;
     static bool keysMatch(std::string_view key1, Value key2) pure;
     static SparseArray _createArray(Heap &heap, uint32_t capacity);
@@ -68,8 +100,87 @@ protected:
     HashSet(Heap &heap, SparseArray&&, bool recount);
     template <typename KEY>
         std::pair<unsigned,bool> search(KEY key, int32_t hashCode) const pure;
+    template <typename KEY>
+        Value searchOld(KEY key, int32_t hashCode) const pure;
     [[nodiscard]] bool insert(Value key, int32_t hashCode);
     [[nodiscard]] bool insert(Value key, int32_t hashCode, unsigned i);
+    [[nodiscard]] bool grow(uint32_t newSize);
+    [[nodiscard]] bool migrate(uint32_t nSlots);
+
+    Heap*           _heap;
+    SparseArray     _array;
+    uint32_t        _size;
+    uint32_t        _count;                     // Includes items not yet moved from `_oldArray`
+    uint32_t        _capacity;
+
+    // While resizing, `_oldArray` is the previous table. Its items below index `_migrated` have
+    // been copied into `_array`; it's never modified, so its probe sequences stay intact.
+    // `_resizing` is the persistent form meanwhile: an Array of [new, old, _migrated].
+    std::optional<SparseArray> _oldArray;
+    uint32_t                _migrated = 0;
+    Handle<Maybe<Array>>    _resizing;
+};
+
+
+
+/// A hash table mapping keys to values, stored in a Heap. Unlike a Dict, its keys needn't be
+/// Symbols: they can be Null, Bool, integers (Int and BigInt, compared by numeric value), Floats,
+/// Strings and Blobs (compared by contents), or Symbols. Containers can't be keys.
+///
+/// Its persistent form is an Array (see `array`), which can be stored in other objects or as
+/// a Heap's root; construct a HashMap from that Array to use it again. Each entry is a small
+/// Array holding the key's hash code, the key and the value, so growing the table doesn't
+/// rehash the keys, nor copy the entries.
+class HashMap {
+public:
+    /// True if a Value can be used as a key.
+    static bool isValidKey(Value) pure;
+
+    /// The hash code of a valid key. Equal keys have equal hashes, even if stored in different
+    /// Heaps (or a BigInt vs. an Int.)
+    static int32_t computeHash(Value) pure;
+
+    /// True if two valid keys are equal.
+    static bool keysEqual(Value, Value) pure;
+
+    /// Creates a new empty HashMap with room for about `capacity` entries before it grows.
+    explicit HashMap(Heap &heap, unsigned capacity = 8);
+
+    /// Wraps an Array created by another HashMap.
+    HashMap(Heap &heap, Array array);
+
+    /// The HashMap's persistent form.
+    Array array() const pure                        {return _array.array();}
+    Heap& heap() const pure                         {return *_heap;}
+
+    /// The number of entries.
+    uint32_t count() const pure                     {return _count;}
+
+    bool contains(Value key) const                  {return bool(findEntry(key));}
+
+    /// Returns the value for a key, or null if there's none.
+    Value get(Value key) const;
+    Value operator[] (Value key) const              {return get(key);}
+
+    /// Adds or replaces an entry. The value may be null.
+    /// Returns false if the key isn't valid, or if allocation failed.
+    /// May trigger garbage collection (if the Heap allows it) and invalidate Object references.
+    [[nodiscard]] bool set(Value key, Value value);
+
+    /// Removes the entry for a key; returns false if there was none.
+    bool remove(Value key);
+
+    using Visitor = function_ref<bool(Value key, Value value)>;
+
+    /// Calls the `visitor` callback once with each entry, in no particular order.
+    bool visit(Visitor visitor) const;
+
+private:
+    static SparseArray createArray(Heap &heap, uint32_t capacity);
+    HashMap(Heap &heap, SparseArray&&, bool recount);
+    std::pair<unsigned,bool> search(Value key, int32_t hashCode) const pure;
+    Maybe<Array> findEntry(Value key) const;
+    unsigned home(int32_t hashCode) const pure      {return uint32_t(hashCode) & (_size - 1);}
     [[nodiscard]] bool grow();
 
     Heap*           _heap;
@@ -9,7 +9,9 @@
 #include "Collections.hh"
 #include "function_ref.hh"
 #include "slice.hh"
+#include <atomic>
 #include <compare>
+#include <thread>
 #include <vector>
 
 namespace snej::smol {
@@ -71,6 +73,27 @@ public:
     /// Returns the Heap that owns this address, or nullptr if none.
     static Heap* heapContaining(const void *);
 
+    //---- Threads:
+
+    /// The thread that owns this Heap. Only the owner may allocate in the Heap, make it current,
+    /// reset it or garbage-collect it; debug builds assert this. A Heap is owned by the thread
+    /// that created it, or the one it was last transferred to, or none after `release`.
+    std::thread::id owner() const               {return _owner.load(std::memory_order_relaxed);}
+
+    /// True if the current thread owns this Heap.
+    bool isOwnedByCurrentThread() const         {return owner() == std::this_thread::get_id();}
+
+    /// Hands this Heap to another thread. Must be called by the owner, while the Heap isn't
+    /// current. The hand-off must happen-before the new owner uses the Heap, as it will if the
+    /// Heap is passed through a mutex-protected queue, or the thread is started afterwards.
+    void transferTo(std::thread::id);
+
+    /// Gives up ownership, so that any thread can then `acquire` the Heap.
+    void release()                              {transferTo(std::thread::id());}
+
+    /// Makes the current thread the owner of a released Heap.
+    void acquire();
+
     //---- Allocation:
 
     /// Allocates space for `size` bytes.
@@ -86,6 +109,23 @@ public:
     Block* allocBlock(heapsize dataSize, Type);
     /// Allocates a Block and copies the data in `contents` into it, filling the rest with 0.
     Block* allocBlock(heapsize dataSize, Type, slice<byte> contents);
+    /// Allocates a Block whose data starts at a multiple of `alignment` bytes from the heap's
+    /// base, for SIMD loads or I/O buffers; does not initialize its contents.
+    /// `alignment` must be a power of 2 from 4 to 64. Malloced heaps have 64-byte-aligned bases,
+    /// so in them the data's address is aligned too.
+    /// A `Pad` block is placed before the Block to fill the gap, costing 4 to `alignment + 3`
+    /// bytes. The garbage collector preserves the alignment; `reallocBlock` does not.
+    Block* allocBlock(heapsize dataSize, Type, heapsize alignment);
+
+    /// Copies all of another Heap's blocks into this one's free space, with a single `memcpy`,
+    /// and returns the other Heap's root as it now appears in this one. This is the cheap way
+    /// to pass a message between threads: build it in a small Heap, hand that to the recipient
+    /// (see `transferTo`), and splice it in. It works because Vals are relative pointers.
+    /// The message's Symbols are replaced with this Heap's equivalents, and aligned blocks stay
+    /// aligned. Everything in the message comes along, even garbage; collect it first if that
+    /// matters. The message Heap is unchanged.
+    /// Returns nullvalue if the message has no root, or if there isn't room.
+    Maybe<Object> splice(Heap const& message);
 
     /// Copies a block, creating a new block with a larger size. The extra bytes are zeroed.
     /// @returns The new block; or the original if the new size is the same as the old;
@@ -138,6 +178,10 @@ public:
     SymbolTable& symbolTable();
     void dropSymbolTable();
 
+    /// The symbol table, if the Heap has one, else nullptr. Unlike `symbolTable`, this never
+    /// creates or rebuilds the table, so it doesn't allocate or trigger GC.
+    SymbolTable const* existingSymbolTable() const;
+
     using BlockVisitor = function_ref<bool(const Block&)>;
     using ObjectVisitor = function_ref<bool(const Object&)>;
 
@@ -164,7 +208,9 @@ public:
     /// This includes the heap's root, its SymbolTable's array, and any registered external roots.
     void visitRoots(BlockVisitor const&);
 
-    void dump(std::ostream&);
+    /// Writes a report of the heap's contents: the summary from a `HeapCensus`, optionally
+    /// followed by a listing of every block (which is only practical for small heaps.)
+    void dump(std::ostream&, bool listBlocks = false);
 
     void registerExternalRoot(Value*) const;
     void unregisterExternalRoot(Value*) const;
@@ -184,6 +230,7 @@ private:
     friend class GarbageCollector;
     friend class UsingHeap;
     friend class HandleBase;
+    friend class HeapProfiler;
     struct Header;
 
     Heap();
@@ -202,11 +249,14 @@ private:
     void exit() const;
     void exit(Heap const* newCurrent) const;
     const char* _validate() const;
+    void dumpBlocks(std::ostream&);
 
     // Allocates space without initializing it. Caller MUST initialize (see Block constructor)
     void* rawAlloc(heapsize size);
 
     void* rawAllocFailed(heapsize size);
+    void assertOwner() const                    {assert(isOwnedByCurrentThread());}
+    heapsize padSize(const void *addr, heapsize dataSize, heapsize alignment) const pure;
 
     Block const* firstBlock() const;
     Block const* nextBlock(Block const*) const;
@@ -224,16 +274,19 @@ private:
         _cannotGC = couldntGC;
     }
 
-    byte*   _base;
-    byte*   _end;
-    byte*   _cur;
+    byte*   _base = nullptr;
+    byte*   _end = nullptr;
+    byte*   _cur = nullptr;
     AllocFailureHandler _allocFailureHandler = nullptr;
     std::vector<Value*> mutable _externalRootVals;
     std::vector<Object*> mutable _externalRootObjs;
     std::unique_ptr<SymbolTable> _symbolTable;
+    HeapProfiler*   _profiler = nullptr;
     mutable const char* _error = nullptr;
+    std::atomic<std::thread::id> _owner = std::this_thread::get_id();
     bool    _malloced = false;
     bool    _mayHaveSymbols = false;
+    bool    _mayHavePadding = false;    // True if there may be Pad blocks (aligned allocations)
     bool    _cannotGC = false;
 };
 
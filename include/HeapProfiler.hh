@@ -0,0 +1,149 @@
+//
+// HeapProfiler.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Heap.hh"
+#include "Block.hh"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace snej::smol {
+
+/// Samples the allocations made in a Heap, recording the Type, size and allocation site of
+/// about one block per `sampleInterval` bytes allocated. Samples follow their blocks through
+/// garbage collection and are dropped when their blocks are collected, so the profile always
+/// describes what's currently live.
+///
+/// Only one profiler can be attached to a Heap at a time. When none is attached, the only
+/// overhead in `Heap::allocBlock` is a null check.
+class HeapProfiler {
+public:
+    /// Attaches a profiler to a Heap. It detaches when destructed.
+    explicit HeapProfiler(Heap&, size_t sampleInterval = 16 * 1024);
+    ~HeapProfiler();
+
+    HeapProfiler(HeapProfiler const&) = delete;
+    HeapProfiler& operator=(HeapProfiler const&) = delete;
+
+    size_t sampleInterval() const pure              {return _interval;}
+
+    /// If true, each sample also records a short backtrace, which is used to identify its
+    /// allocation site if there's no Tag in effect. This is a lot slower than using Tags.
+    void setCaptureBacktraces(bool capture)         {_captureBacktraces = capture;}
+
+    /// Labels all allocations made on the current thread while it's in scope, in any Heap.
+    /// The name must be a string literal, or otherwise outlive the profiler.
+    class Tag {
+    public:
+        explicit Tag(const char *name);
+        ~Tag();
+    private:
+        const char* _prevTag;
+    };
+
+    /// Estimated live bytes allocated at one site, of one Type.
+    struct Site {
+        std::string name;       ///< The Tag, or symbolized backtrace, or "?"
+        Type        type;
+        size_t      samples;    ///< Number of live samples
+        size_t      bytes;      ///< Estimated live bytes
+    };
+
+    /// The live samples aggregated by site and Type, ordered by decreasing `bytes`.
+    /// Blocks allocated since the last GC are included, since it's not yet known which of them
+    /// are garbage; run the GC first for an exact picture.
+    std::vector<Site> liveSites() const;
+
+    size_t sampleCount() const pure                 {return _samples.size();}
+
+    /// Estimated total of live bytes allocated since the profiler was attached.
+    size_t liveBytes() const pure;
+
+    /// Writes a human-readable table of `liveSites`.
+    void dump(std::ostream&) const;
+
+private:
+    friend class Heap;
+    friend class GarbageCollector;
+
+    static constexpr size_t kMaxFrames = 6;
+
+    struct Sample {
+        heappos     pos;                // Position of block in Heap
+        Type        type;
+        heapsize    size;               // Data size of block
+        size_t      weight;             // Number of bytes this sample stands for
+        const char* tag;
+        uint8_t     nFrames;
+        void*       frames[kMaxFrames];
+    };
+
+    /// Called by Heap::allocBlock.
+    void allocated(Block const* block) {
+        _countdown -= block->blockSize();
+        if (_unlikely(_countdown <= 0))
+            takeSample(block);
+    }
+
+    void takeSample(Block const*);
+    void collected(Heap const& fromHeap);   // Called by GarbageCollector before swapping heaps
+    void reset()                            {_samples.clear();}
+    std::string siteName(Sample const&) const;
+
+    Heap*               _heap;
+    size_t              _interval;
+    intptr_t            _countdown;
+    bool                _captureBacktraces = false;
+    std::vector<Sample> _samples;
+};
+
+
+
+/// A snapshot of statistics about a Heap's blocks, reachable and unreachable.
+/// Constructing it walks the object graph from the roots, then every block in the Heap.
+/// The numbers point at which optimizations would pay off: lots of dead bytes mean GC should run
+/// more often, duplicate strings suggest deduplication, and unused Vector/Dict capacity means
+/// collections are being over-allocated.
+struct HeapCensus {
+    explicit HeapCensus(Heap&);
+
+    struct Totals {
+        size_t count = 0;       ///< Number of blocks
+        size_t bytes = 0;       ///< Total size of blocks, including headers
+    };
+
+    struct TypeStats {
+        Totals live, dead;
+    };
+
+    static constexpr size_t kHistogramSize = 26;
+
+    Totals      live;                           ///< Blocks reachable from roots
+    Totals      dead;                           ///< Unreachable blocks (garbage)
+    TypeStats   byType[16];                     ///< Indexed by Type
+    size_t      headerBytes = 0;                ///< Header & padding bytes in live blocks
+    size_t      sizeHistogram[kHistogramSize] = {}; ///< Live blocks by size; [i] is [2^i, 2^(i+1))
+    size_t      largeHeaderCount = 0;           ///< Live blocks with a 4-byte `Large` header
+    size_t      unusedVectorBytes = 0;          ///< Capacity beyond `size` in live Vectors
+    size_t      unusedDictBytes = 0;            ///< Capacity beyond `size` in live Dicts
+    size_t      uniqueStrings = 0;              ///< Number of distinct live String values
+    Totals      duplicateStrings;               ///< Live Strings equal to an earlier one
+
+    /// The fraction of live bytes that are block headers rather than data.
+    double headerOverhead() const pure          {return live.bytes ? double(headerBytes) / live.bytes : 0.0;}
+
+    /// The fraction of live blocks that need the 4-byte `Large` header.
+    double largeHeaderFraction() const pure     {return live.count ? double(largeHeaderCount) / live.count : 0.0;}
+
+    /// Writes a human-readable report.
+    void write(std::ostream&) const;
+
+    /// Writes the census as a JSON object, for tools and dashboards.
+    void writeJSON(std::ostream&) const;
+};
+
+}
@@ -6,14 +6,54 @@
 
 #pragma once
 #include "smol_world.hh"
+#include <initializer_list>
+#include <memory>
 #include <string>
 
 namespace snej::smol {
 
+/// Selects the parts of a JSON document that `newFromJSON` should build. Everything else is
+/// still parsed, and checked for errors, but no objects are allocated for it.
+///
+/// It's a set of paths, each a list of keys separated by `.`: a `*` matches any key or any
+/// array item, and a number also matches that index of an array. Each path selects the value
+/// it leads to, including everything inside it, and the containers leading to it (only with the
+/// members on selected paths.) A container that a path passes through is kept even if nothing
+/// inside it matches the rest of the path. An empty path selects the entire document.
+///
+/// For example, `{"statuses.*.id", "statuses.*.user.name"}` would turn
+/// `{"statuses": [{"id": 1, "text": "hi", "user": {"name": "x", "lang": "en"}}], "count": 1}`
+/// into `{"statuses": [{"id": 1, "user": {"name": "x"}}]}`.
+class JSONProjection {
+public:
+    JSONProjection();
+    JSONProjection(std::initializer_list<std::string_view> paths);
+    ~JSONProjection();
+
+    /// Adds a path to the projection.
+    void add(std::string_view path);
+
+    struct Node;
+    Node const& root() const pure                   {return *_root;}
+
+private:
+    std::unique_ptr<Node> _root;
+};
+
+
+/// Parses JSON into objects in a Heap, returning the root.
+/// Returns null on a syntax error (storing a message in `*outError`) or if the Heap fills up.
 Value newFromJSON(std::string_view json, Heap&, std::string* outError = nullptr);
 
 Value newFromJSON(std::string const& json, Heap&, std::string* outError = nullptr);
 
+/// Parses JSON, but only builds the parts of it selected by a JSONProjection.
+Value newFromJSON(std::string_view json, Heap&, JSONProjection const&,
+                  std::string* outError = nullptr);
+
+Value newFromJSON(std::string const& json, Heap&, JSONProjection const&,
+                  std::string* outError = nullptr);
+
 std::string toJSON(Value);
 
 }
@@ -0,0 +1,101 @@
+//
+// LazyJSON.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Collections.hh"
+#include "Heap.hh"
+#include <optional>
+#include <string>
+
+namespace snej::smol {
+
+/// A JSON document stored in a Heap as its raw text plus a compact index of its structure,
+/// instead of as objects. "Parsing" it only validates the text and records where each value
+/// starts; a value is built into real Dicts, Vectors, Strings etc. only when you ask for it.
+/// A document that's mostly passed through untouched costs little more than a copy of its text.
+///
+/// Its persistent form is an Array (see `array`), which can be stored in other objects or as
+/// a Heap's root; call `existing` with that Array to use it again.
+class LazyJSON {
+public:
+    /// Checks and indexes JSON, storing the text and index in the Heap.
+    /// Returns nullopt on a syntax error (storing a message in `*outError`) or if the Heap fills up.
+    static std::optional<LazyJSON> create(std::string_view json, Heap&,
+                                          std::string* outError = nullptr);
+
+    /// Wraps an Array created by another LazyJSON. Returns nullopt if it's not such an Array.
+    static std::optional<LazyJSON> existing(Heap&, Value array);
+
+    /// The LazyJSON's persistent form. (It doesn't change when values are built.)
+    Array array() const pure                        {return _array;}
+    Heap& heap() const pure                         {return *_heap;}
+
+    /// The original JSON text. This points into the Heap, so it's invalidated by GC.
+    std::string_view json() const pure;
+
+    class Item;
+
+    /// The root of the document.
+    Item root() const;
+
+    /// A reference to a value in a LazyJSON document: a position in its index. Navigating with
+    /// `get` only reads the index, so it doesn't allocate anything.
+    /// An Item points to its LazyJSON, so it must not outlive it.
+    class Item {
+    public:
+        explicit operator bool() const pure         {return _doc != nullptr;}
+
+        bool isObject() const pure                  {return firstChar() == '{';}
+        bool isArray() const pure                   {return firstChar() == '[';}
+
+        /// The number of members of an object, or items of an array; otherwise 0.
+        uint32_t count() const pure;
+
+        /// The value of an object's member, or an invalid Item if there's none.
+        Item get(std::string_view key) const pure;
+
+        /// An item of an array, or an invalid Item if it's out of range.
+        Item get(uint32_t index) const pure;
+
+        Item operator[] (std::string_view key) const pure   {return get(key);}
+        Item operator[] (uint32_t index) const pure         {return get(index);}
+
+        /// The value's JSON text. This points into the Heap, so it's invalidated by GC.
+        std::string_view json() const pure;
+
+        /// Builds the value in the Heap. An object or array, and everything in it, is built the
+        /// first time it's asked for; after that the same Dict or Vector is returned, as it is
+        /// for the containers inside it. (If one of those was already built, it's reused.)
+        /// Returns null if the Heap fills up. May trigger GC.
+        Value value() const;
+
+    private:
+        friend class LazyJSON;
+        Item() = default;
+        Item(LazyJSON const* doc, uint32_t i)       :_doc(doc), _index(i) { }
+        char firstChar() const pure;
+
+        LazyJSON const* _doc = nullptr;
+        uint32_t        _index = 0;                 // Position in the doc's index
+    };
+
+private:
+    LazyJSON(Heap &heap, Array array);
+    uint32_t word(uint32_t i) const pure;
+    bool isContainer(uint32_t i) const pure;
+    uint32_t next(uint32_t i) const pure;
+    uint32_t ordinal(uint32_t i) const pure;
+    std::string_view token(uint32_t i) const pure;
+    Value build(uint32_t i) const;
+    Maybe<Array> cache() const pure;
+    bool validIndex(uint32_t nWords) const;
+    void cacheContainers(uint32_t i, Value) const;
+
+    Heap*           _heap;
+    Handle<Array>   _array;                         // [JSON Blob, index Blob, cache or null]
+};
+
+}
@@ -0,0 +1,87 @@
+//
+// Log.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Base.hh"
+#include <atomic>
+
+namespace snej::smol {
+
+/// Severity of a log message. Higher values are more verbose.
+enum class LogLevel : uint8_t {
+    None,       ///< As a domain's level, disables all messages
+    Error,
+    Warning,
+    Info,
+    Verbose,
+    Debug,
+};
+
+/// The most verbose level that will be compiled in at all. Messages above this level generate
+/// no code, not even a runtime check. Override it by defining `SMOL_LOG_LEVEL` as a number
+/// (0 for None ... 5 for Debug) when building.
+#ifndef SMOL_LOG_LEVEL
+    #ifdef NDEBUG
+        #define SMOL_LOG_LEVEL 3    // Info
+    #else
+        #define SMOL_LOG_LEVEL 5    // Debug
+    #endif
+#endif
+
+static constexpr LogLevel kMaxLogLevel = LogLevel(SMOL_LOG_LEVEL);
+
+
+/// A category of log messages, like "Heap" or "GC", with its own runtime level.
+/// Messages more verbose than the domain's `level` are skipped before any formatting happens.
+/// The level can be changed while other threads are logging.
+class LogDomain {
+public:
+    constexpr explicit LogDomain(const char *name, LogLevel level = LogLevel::Warning)
+    :_name(name), _level(level) { }
+
+    const char* name() const pure                   {return _name;}
+    LogLevel level() const pure                     {return _level.load(std::memory_order_relaxed);}
+    void setLevel(LogLevel level)                   {_level.store(level, std::memory_order_relaxed);}
+
+    /// True if a message at this level would be logged.
+    bool willLog(LogLevel level) const pure         {return level <= kMaxLogLevel && level <= this->level();}
+
+    /// Formats & logs a message, printf-style. Don't call this directly; use `SMOL_LOG`,
+    /// which checks `willLog` first and so costs nothing when the message is disabled.
+    void _log(LogLevel, const char *format, ...) const __attribute__((format(printf, 3, 4)));
+
+private:
+    const char*             _name;
+    std::atomic<LogLevel>   _level;
+};
+
+extern LogDomain HeapLog;       ///< Heap allocation & failure handling
+extern LogDomain GCLog;         ///< Garbage collection
+extern LogDomain SymbolLog;     ///< Symbol table creation and rebuilding
+
+
+/// A function that receives log messages. `message` has no trailing newline.
+/// It may be called on any thread that uses a Heap.
+using LogSink = void (*)(LogDomain const&, LogLevel, const char *message);
+
+/// Installs a function that will receive all log messages, replacing the default one which
+/// writes to stderr. Passing `nullptr` restores the default.
+void setLogSink(LogSink);
+
+/// The name of a log level, e.g. "Warning".
+const char* LogLevelName(LogLevel) CONST;
+
+}
+
+
+/// Logs a printf-style message to a LogDomain, at a level named without its prefix, e.g.
+/// `SMOL_LOG(HeapLog, Info, "Heap is %zu bytes", heap.used())`.
+/// The arguments aren't evaluated unless the message will be logged.
+#define SMOL_LOG(DOMAIN, LEVEL, FMT, ...) \
+    do { \
+        if (_unlikely((DOMAIN).willLog(snej::smol::LogLevel::LEVEL))) \
+            (DOMAIN)._log(snej::smol::LogLevel::LEVEL, FMT __VA_OPT__(,) __VA_ARGS__); \
+    } while (false)
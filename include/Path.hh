@@ -0,0 +1,84 @@
+//
+// Path.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Collections.hh"
+#include "function_ref.hh"
+#include <string>
+#include <vector>
+
+namespace snej::smol {
+class SymbolTable;
+
+/// A compiled query that finds values inside a document, like `a.b[3].c`.
+///
+/// The path string is parsed once, and its property names are resolved to Symbol IDs the first
+/// time they're needed, so evaluating it against any number of documents in the same Heap
+/// doesn't parse or hash anything; it walks the objects in place, without allocating.
+///
+/// Two syntaxes are accepted:
+/// - A subset of JSONPath: an optional `$` root, then any number of
+///   - `.name` or `['name']` : the value of a Dict key
+///   - `[3]` : an Array or Vector item; negative indexes count back from the end
+///   - `.*` or `[*]` : every item of an Array/Vector, or every value of a Dict
+///   - `..` : the current value and all its descendants, e.g. `..name` or `..*`
+///   - `[?(@.price < 10)]` : every item/value for which the filter is true. The filter's
+///     left side is a relative path starting with `@`; it can be alone, to test whether the
+///     path exists, or compared using `== != < <= > >=` with a number, `'string'`, `"string"`,
+///     `true`, `false` or `null`.
+/// - JSON Pointer (RFC 6901), if the path starts with `/`: `/a/b/3` (with `~0` and `~1`
+///   escaping `~` and `/`.) A numeric component is an index if applied to an Array/Vector.
+///
+/// The IDs are cached per symbol table, so they're looked up again if the Heap is reset, or
+/// the Path is evaluated on a value in a different Heap. (But `all` allocates its result in the
+/// Heap the Path was compiled for, so only call it with values in that Heap.) A Path isn't
+/// thread-safe.
+class Path {
+public:
+    /// Compiles a path. If it's invalid, `valid` returns false and `error` describes the
+    /// problem, and evaluation finds nothing.
+    Path(std::string_view path, Heap&);
+
+    Path(Path&&);
+    Path& operator=(Path&&);
+    ~Path();
+
+    bool valid() const pure                         {return _error.empty();}
+    std::string const& error() const pure           {return _error;}
+
+    using Visitor = function_ref<bool(Value)>;
+
+    /// Calls `visitor` with each value matching the path under `root`, in document order.
+    /// If the visitor returns false, evaluation stops and `visit` returns false.
+    /// The visitor must not allocate anything in the Heap, since GC would invalidate the walk.
+    bool visit(Value root, Visitor visitor) const;
+
+    /// The first value matching the path, or null if none.
+    Value first(Value root) const;
+
+    /// The number of values matching the path.
+    size_t count(Value root) const;
+
+    /// Returns a new Vector containing all the matching values.
+    /// Returns null if allocation failed. May trigger GC.
+    Maybe<Vector> all(Value root) const;
+
+    struct Step;
+private:
+    class Parser;
+    bool eval(std::vector<Step> const&, size_t stepNo, Value, Visitor const&) const;
+    bool matches(Step const& filter, Value) const;
+    void useSymbolsOf(Value root) const;
+    bool resolve(Step const&) const;
+
+    Heap*                       _heap;
+    std::vector<Step>           _steps;
+    std::string                 _error;
+    mutable SymbolTable const*  _symbols = nullptr;     // Table that Key steps are resolved in
+    mutable uint64_t            _symbolsSerial = 0;     // Serial of the table IDs were cached from
+};
+
+}
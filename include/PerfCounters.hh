@@ -0,0 +1,142 @@
+//
+// PerfCounters.hh
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#pragma once
+#include "Base.hh"
+#include <array>
+#include <atomic>
+#include <iosfwd>
+
+namespace snej::smol {
+
+/// Events that can be counted by hardware (or kernel) performance counters.
+enum class PerfEvent : uint8_t {
+    Cycles,
+    Instructions,
+    L1DMisses,          ///< Level-1 data cache read misses
+    LLCMisses,          ///< Last-level cache misses
+    DTLBMisses,         ///< Data TLB read misses
+    PageFaults,         ///< Page faults (a software event, so usually available even in VMs)
+};
+
+static constexpr size_t kNumPerfEvents = 6;
+
+/// The name of a PerfEvent, e.g. "LLCMisses".
+const char* PerfEventName(PerfEvent) CONST;
+
+
+/// A set of counter values, one per PerfEvent. Unavailable events are always zero.
+struct PerfCounts {
+    std::array<uint64_t, kNumPerfEvents> values {};
+
+    uint64_t operator[] (PerfEvent e) const pure        {return values[size_t(e)];}
+
+    /// Instructions per cycle, or 0 if unknown.
+    double ipc() const pure {
+        return (*this)[PerfEvent::Cycles] ? double((*this)[PerfEvent::Instructions])
+                                            / (*this)[PerfEvent::Cycles] : 0.0;
+    }
+
+    PerfCounts& operator+= (PerfCounts const&);
+    PerfCounts operator- (PerfCounts const&) const;
+
+    /// The current counter values for this thread. These are running totals, only meaningful
+    /// as the difference between two readings. Returns zeros if counters are unavailable.
+    /// The counters are opened the first time a thread calls this.
+    static PerfCounts now();
+
+    /// True if counters are available to this thread. On Linux this uses `perf_event_open`,
+    /// which the kernel may disallow (see `/proc/sys/kernel/perf_event_paranoid`);
+    /// other platforms aren't supported yet.
+    static bool available();
+
+    /// True if a specific event is available to this thread. Many VMs don't expose hardware
+    /// counters at all, and some CPUs lack some events.
+    static bool available(PerfEvent);
+};
+
+
+/// A named region of code, like "GC", whose hardware counters are totaled each time it runs.
+/// Use a `PerfScope` to mark a run of the region. The library measures `GCPerf` and
+/// `JSONParsePerf`; you can declare your own regions too.
+///
+/// Counting is off by default, since reading the counters costs a system call at the start and
+/// end of every scope. Turn it on with `PerfRegion::setEnabled`.
+class PerfRegion {
+public:
+    /// Creates and registers a region. It must be a global (or otherwise never destructed.)
+    explicit PerfRegion(const char *name);
+
+    const char* name() const pure                   {return _name;}
+
+    /// Number of times the region has run since the last reset.
+    uint64_t runs() const                           {return _runs.load(std::memory_order_relaxed);}
+
+    /// Total counts over all runs since the last reset.
+    PerfCounts totals() const;
+
+    void reset();
+
+    /// Turns counting on or off in all regions. Returns true if counting is now on, which
+    /// requires that counters be available.
+    static bool setEnabled(bool);
+    static bool enabled()                           {return sEnabled.load(std::memory_order_relaxed);}
+
+    /// Calls `reset` on every region.
+    static void resetAll();
+
+    /// Writes a human-readable table of every region that has run.
+    static void writeStats(std::ostream&);
+
+    /// Writes the totals of every region that has run, as a JSON object keyed by region name.
+    static void writeJSON(std::ostream&);
+
+private:
+    friend class PerfScope;
+
+    PerfRegion(PerfRegion const&) = delete;
+    PerfRegion& operator=(PerfRegion const&) = delete;
+
+    void add(PerfCounts const&);
+
+    static std::atomic<bool> sEnabled;
+
+    const char*                                     _name;
+    std::atomic<uint64_t>                           _runs = 0;
+    std::array<std::atomic<uint64_t>,kNumPerfEvents> _totals {};
+    PerfRegion*                                     _next;
+};
+
+extern PerfRegion GCPerf;           ///< Garbage collection
+extern PerfRegion JSONParsePerf;    ///< `newFromJSON`
+
+
+/// Counts one run of a PerfRegion: its counters are read when it's constructed and destructed,
+/// and the difference is added to the region. Does nothing unless counting is enabled.
+/// Scopes can nest; an outer scope's counts include those of inner ones.
+class PerfScope {
+public:
+    explicit PerfScope(PerfRegion &region)
+    :_region(PerfRegion::enabled() ? &region : nullptr)
+    {
+        if (_region)
+            _start = PerfCounts::now();
+    }
+
+    ~PerfScope() {
+        if (_region)
+            _region->add(PerfCounts::now() - _start);
+    }
+
+private:
+    PerfScope(PerfScope const&) = delete;
+    PerfScope& operator=(PerfScope const&) = delete;
+
+    PerfRegion* _region;
+    PerfCounts  _start;
+};
+
+}
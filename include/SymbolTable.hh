@@ -30,6 +30,10 @@ public:
     /// The number of symbols in the table
     uint32_t size() const                               {return _table.count();}
 
+    /// A number unique to this SymbolTable object. Symbol IDs looked up in a table are only
+    /// meaningful with a table of the same serial; e.g. a Heap that's reset gets a new table.
+    uint64_t serial() const                             {return _serial;}
+
     /// Returns the existing symbol with this string, or nothing.
     Maybe<Symbol> find(std::string_view s) const        {return Maybe<Symbol>(_table.find(s));}
 
@@ -39,6 +43,15 @@ public:
     /// Returns the existing symbol with this string, or creates a new one.
     Maybe<Symbol> create(std::string_view s);
 
+    /// Looks up or creates Symbols for a batch of strings, storing each string's Symbol in the
+    /// same position of `symbols`, which must be at least as long as `strs`. This is faster
+    /// than calling `create` on each string: it hashes all of them and prefetches their table
+    /// slots before looking any up, and only checks once whether the table has to grow.
+    ///
+    /// GC is disabled during the call, so that the Symbols it returns stay valid. If the heap
+    /// fills up anyway, the Symbols it couldn't create are left null and it returns false.
+    bool createBatch(slice<const std::string_view> strs, slice<Maybe<Symbol>> symbols);
+
     using Visitor = std::function<bool(Symbol)>;
     /// Calls the `visitor` callback once with each Symbol (and its hash code.)
     bool visit(Visitor visitor) const;
@@ -53,8 +66,11 @@ protected:
 
 private:
     SymbolTable(Heap *heap, Array array, bool empty);
-    HashSet     _table;
-    Symbol::ID  _nextID {0};
+    Maybe<Symbol> create(std::string_view s, int32_t hashCode);
+
+    HashSet         _table;
+    Symbol::ID      _nextID {0};
+    uint64_t const  _serial;
 };
 
 }
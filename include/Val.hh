@@ -27,7 +27,8 @@ enum class Type : uint8_t {
     Array,
     Vector,
     Dict,
-    // (8 spares)
+    Pad,        // Filler before an aligned block (see Heap::allocBlock); never referenced by a Val
+    // (7 spares)
 
     // Primitives:  (these are stored inline in a Val without any pointers)
     Null = 0x10,
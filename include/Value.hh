@@ -50,7 +50,7 @@ public:
     /// with this value cast to its runtime type.
     template <typename FN> bool visit(FN fn) const;
 
-    friend bool operator== (Value const& a, Value const& b) pure     {return a._val == b._val;}
+    friend constexpr bool operator== (Value const& a, Value const& b) pure {return a._val == b._val;}
 
     static Value fromValue(Value v) pure            {return v;}
 
@@ -70,7 +70,7 @@ std::ostream& operator<< (std::ostream&, Value);
 /// The Value subclass representing the Null type.
 class Null : public Value {
 public:
-    static constexpr Type Type = Type::Null;
+    static constexpr smol::Type Type = smol::Type::Null;
     constexpr static bool HasType(enum Type t)      {return t == Type;}
 
     constexpr Null() = default;
@@ -91,7 +91,7 @@ constexpr Null nullishvalue = Null::_nullish();
 /// The Value subclass representing the Bool type.
 class Bool : public Value {
 public:
-    static constexpr Type Type = Type::Bool;
+    static constexpr smol::Type Type = smol::Type::Bool;
     constexpr static bool HasType(enum Type t)    {return t == Type;}
 
     constexpr explicit Bool(bool b = false)       :Value(b ? TrueVal : FalseVal) { }
@@ -103,7 +103,7 @@ public:
 /// The Value subclass representing the Int type.
 class Int : public Value {
 public:
-    static constexpr Type Type = Type::Int;
+    static constexpr smol::Type Type = smol::Type::Int;
     constexpr static bool HasType(enum Type t)            {return t == Type;}
 
     static constexpr int Min = Val::MinInt;
@@ -175,7 +175,7 @@ private:
 /// The Object subclass representing the BigInt type.
 class BigInt : public Object {
 public:
-    static constexpr Type Type = Type::BigInt;
+    static constexpr smol::Type Type = smol::Type::BigInt;
     constexpr static bool HasType(enum Type t)      {return t == Type;}
 
     int64_t asInt() const {
@@ -201,7 +201,7 @@ Value newInt(int64_t i, Heap &heap);
 /// The Object subclass representing the Float type.
 class Float : public Object {
 public:
-    static constexpr Type Type = Type::Float;
+    static constexpr smol::Type Type = smol::Type::Float;
     constexpr static bool HasType(enum Type t)      {return t == Type;}
 
     bool isDouble() const                           {return rawBytes().size() == sizeof(double);}
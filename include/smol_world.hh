@@ -10,6 +10,11 @@
 #include "Val.hh"
 #include "Value.hh"
 #include "Collections.hh"
+#include "Compare.hh"
 #include "SymbolTable.hh"
 #include "GarbageCollector.hh"
 #include "JSON.hh"
+#include "LazyJSON.hh"
+#include "Path.hh"
+#include "Log.hh"
+#include "PerfCounters.hh"
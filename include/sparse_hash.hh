@@ -6,24 +6,17 @@
 
 #pragma once
 #include "Base.hh"
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <cmath>
 #include <iosfwd>
+#include <memory>
+#include <utility>
 #include <vector>
 
 namespace snej::smol {
 
-namespace {
-template <typename INT> unsigned popcount(INT);
-#if defined(__clang__) || defined(__GNUC__)
-template<> inline unsigned popcount<uint64_t>(uint64_t value)  {return __builtin_popcountll(value);}
-template<> inline unsigned popcount<uint32_t>(uint32_t value)  {return __builtin_popcount(value);}
-#else
-#   error "Haven't added popcount support for this platform yet"
-#endif
-}
-
-
 /// A fixed-size bitmap, or array of bits.
 template <size_t Size>
 class bitmap {
@@ -36,23 +29,26 @@ public:
 
     bitmap() = default;
 
-    bitmap(uint64_t const bitmaps[N])   :_bitmap(bitmaps, N) { }
+    explicit bitmap(uint64_t const bitmaps[N]) {
+        for (size_t i = 0; i < N; i++)
+            _bitmap[i] = bitmaps[i];
+    }
 
     /// The total number of '1' bits.
     /// @note  This has to be computed; it is not cached.
     size_t count() const {
         size_t c = 0;
         for (size_t i = 0; i < N; i++)
-            c += popcount(_bitmap[i]);
+            c += std::popcount(_bitmap[i]);
         return c;
     }
 
     /// The number of '1' bits before index `i`.
     size_t countUpTo(size_t i) const {
         size_t bi = bitmapIndex(i);
-        size_t itemIndex = popcount( _bitmap[bi] & (bit(i) - 1) );
+        size_t itemIndex = std::popcount( _bitmap[bi] & (bit(i) - 1) );
         while (bi > 0)
-            itemIndex += popcount(_bitmap[--bi]);
+            itemIndex += std::popcount(_bitmap[--bi]);
         return itemIndex;
     }
 
@@ -72,6 +68,7 @@ public:
 
     void insert(size_t i)                         {_bitmap[bitmapIndex(i)] |= bit(i);}
     void remove(size_t i)                         {_bitmap[bitmapIndex(i)] &= ~bit(i);}
+    void clear()                                  {_bitmap = {};}
 
     bool operator[] (size_t i) const              {return contains(i);}
 
@@ -83,10 +80,10 @@ public:
     bool visit(Visitor v) const {
         size_t start = 0;
         for (uint64_t bits : _bitmap) {
-            uint64_t mask = 1;
-            for (size_t i = 0; i < 64; ++i, mask <<= 1) {
-                if ((bits & mask) && !v(start + i))
+            while (bits) {
+                if (!v(start + std::countr_zero(bits)))
                     return false;
+                bits &= bits - 1;       // clear lowest 1 bit
             }
             start += 64;
         }
@@ -105,6 +102,7 @@ private:
 
 /// A fixed-size array, whose items can be empty, that only allocates memory for non-empty items.
 /// The array size (`Size`) must be a multiple of 64.
+/// `T` must be default-constructible and move-assignable; it need not be copyable.
 template <typename T, size_t Size_, bool Sparse = true>
 class sparse_bucket {
 public:
@@ -121,15 +119,15 @@ public:
         if (Sparse) {
             size_t count = this->count();
             _items = std::make_unique<T[]>(count);
-            T const* src = items;
             T* dst = &_items[0];
             _bitmap.visit([&](size_t i) {
-                *dst = items[i];
+                *dst++ = items[i];
+                return true;
             });
             assert(dst == &_items[count]);
         } else {
             _items = std::make_unique<T[]>(Size);
-            copyItems(_items, items, Size);
+            copyItems(&_items[0], items, Size);
         }
     }
 
@@ -150,15 +148,19 @@ public:
         return contains(i) ? &_items[_itemIndex(i)] : nullptr;
     }
 
+    T* find(size_t i) {
+        return contains(i) ? &_items[_itemIndex(i)] : nullptr;
+    }
+
     T const* operator[] (size_t i) const      {return find(i);}
 
     /// Stores a value at an index. Returns the address of the item in the bucket.
     /// @warning  Item pointers are invalidated by any modification of the bucket. (When Sparse=true)
     T* put(size_t index, T&& value) {
         if (contains(index))
-            return _replace(index, std::forward<T>(value));
+            return _replace(index, std::move(value));
         else
-            return _insert(index, std::forward<T>(value));
+            return _insert(index, std::move(value));
     }
 
     /// Stores a value at an index, but only if that index was empty; else just returns nullptr.
@@ -166,7 +168,39 @@ public:
     T* insert(size_t index, T&& value) {
         if (contains(index))
             return nullptr;
-        return _insert(index, std::forward<T>(value));
+        return _insert(index, std::move(value));
+    }
+
+    /// Removes the item at an index, returning true if there was one.
+    /// @warning  Item pointers are invalidated by any modification of the bucket. (When Sparse=true)
+    bool erase(size_t i) {
+        if (!contains(i))
+            return false;
+        if (Sparse) {
+            // Allocate a smaller items array and move the other items into it:
+            auto count = this->count();
+            size_t itemIndex = _itemIndex(i);
+            std::unique_ptr<T[]> newItems;
+            if (count > 1) {
+                newItems = std::make_unique<T[]>(count - 1);
+                moveItems(&newItems[0],         &_items[0],             itemIndex);
+                moveItems(&newItems[itemIndex], &_items[itemIndex + 1], count - itemIndex - 1);
+            }
+            _items = std::move(newItems);
+        } else {
+            _items[i] = T();
+        }
+        _bitmap.remove(i);
+        return true;
+    }
+
+    /// Removes all items.
+    void clear() {
+        if (Sparse)
+            _items.reset();
+        else
+            _items = std::make_unique<T[]>(Size);
+        _bitmap.clear();
     }
 
     /// Calls the function `v` for every item. Its signature should be `(size_t,T const&)->bool`.
@@ -177,6 +211,15 @@ public:
         });
     }
 
+    /// Calls the function `v` for every item. Its signature should be `(size_t,T&)->bool`.
+    template <typename Visitor>
+    bool visit(Visitor v) {
+        T* item = _items.get();
+        return _bitmap.visit([&](size_t i) {
+            return v(i, Sparse ? *item++ : _items[i]);
+        });
+    }
+
     bitmap<Size> const& bits() const            {return _bitmap;}
 
 private:
@@ -192,7 +235,7 @@ private:
             auto count = this->count();
             auto newItems = std::make_unique<T[]>(count + 1);
 
-            // Copy the existing items before/after the insertion:
+            // Move the existing items before/after the insertion:
             if (count > 0) {
                 itemIndex = _itemIndex(i);
                 moveItems(&newItems[0],             &_items[0],         itemIndex);
@@ -203,37 +246,29 @@ private:
             itemIndex = i;
         }
 
-        // Copy the inserted item:
+        // Move the inserted item into its (default-constructed) slot:
         auto result = &_items[itemIndex];
-        new (result) T(std::forward<T>(value));
+        *result = std::move(value);
         // Finally set the bit in the bitmap:
         _bitmap.insert(i);
         return result;
     }
 
-    T* _replace(size_t i, T value) {
+    T* _replace(size_t i, T&& value) {
         assert(contains(i));
         T* result = &_items[_itemIndex(i)];
-        *result = value;
+        *result = std::move(value);
         return result;
     }
 
     static void copyItems(T* dst, T const* src, size_t n) {
-#if 0
-        ::memcpy(dst, src, n * ItemSize);   // Optimization if `T` is trivially moveable
-#else
         while (n-- > 0)
             *dst++ = *src++;
-#endif
     }
 
-    static void moveItems(T* dst, T const* src, size_t n) {
-#if 0
-        ::memcpy(dst, src, n * ItemSize);   // Optimization if `T` is trivially moveable
-#else
+    static void moveItems(T* dst, T* src, size_t n) {
         while (n-- > 0)
             *dst++ = std::move(*src++);
-#endif
     }
 
     bitmap<Size>            _bitmap;
@@ -247,13 +282,20 @@ private:
 template <typename T, size_t BucketSize = 128, bool Sparse = true>
 class sparse_array {
 public:
-    sparse_array(size_t size = BucketSize)  :_buckets(bucketCount(size)) { }
+    using Bucket = sparse_bucket<T,BucketSize,Sparse>;
+
+    explicit sparse_array(size_t size = BucketSize)  :_buckets(bucketCount(size)) { }
 
     /// The number of items in the array
     size_t size() const                 {return _buckets.size() * BucketSize;}
 
     /// Grows/shrinks the array.
-    void resize(size_t newSize)         {_buckets.resize(bucketCount(newSize));}
+    void resize(size_t newSize) {
+        size_t n = bucketCount(newSize);
+        for (size_t i = n; i < _buckets.size(); ++i)
+            _count -= _buckets[i].count();
+        _buckets.resize(n);
+    }
 
     /// The number of non-empty items.
     size_t count() const                {return _count;}
@@ -262,10 +304,11 @@ public:
     bool empty() const                  {return _count == 0;}
 
     /// True if there is an item at the given index.
-    bool contains(size_t index)       {return bucketFor(index).contains(bucketOffset(index));}
+    bool contains(size_t index) const   {return bucketFor(index).contains(bucketOffset(index));}
 
     /// Returns the address of the item at the given index, else nullptr if it's not present.
-    T const* find(size_t index) const         {return bucketFor(index)[bucketOffset(index)];}
+    T const* find(size_t index) const         {return bucketFor(index).find(bucketOffset(index));}
+    T* find(size_t index)                     {return bucketFor(index).find(bucketOffset(index));}
     T const* operator[] (size_t i) const      {return find(i);}
 
     /// Returns a copy of the item at the given index, else a default-constructed item.
@@ -273,21 +316,46 @@ public:
 
     /// Stores a value at an index. Returns the address of the item.
     T* put(size_t index, T&& value) {
-        auto [result, isNew] = bucketFor(index).put(bucketOffset(index), std::forward<T>(value));
-        if (isNew)
+        Bucket &bucket = bucketFor(index);
+        if (!bucket.contains(bucketOffset(index)))
             ++_count;
-        return result;
+        return bucket.put(bucketOffset(index), std::move(value));
     }
 
     /// Stores a value at an index, but only if that index was empty; else just returns nullptr.
     T* insert(size_t index, T&& value) {
-        T* result = bucketFor(index).insert(bucketOffset(index), std::forward<T>(value));
+        T* result = bucketFor(index).insert(bucketOffset(index), std::move(value));
         if (result)
             ++_count;
         return result;
     }
 
-    using Bucket = sparse_bucket<T,BucketSize,Sparse>;
+    /// Removes the item at an index, returning true if there was one.
+    bool erase(size_t index) {
+        bool erased = bucketFor(index).erase(bucketOffset(index));
+        if (erased)
+            --_count;
+        return erased;
+    }
+
+    /// Removes all items, without changing the size.
+    void clear() {
+        for (auto &bucket : _buckets)
+            bucket.clear();
+        _count = 0;
+    }
+
+    /// The number of bytes of heap memory allocated for buckets and items. (Doesn't include any
+    /// memory the items themselves own, or the allocator's overhead.)
+    size_t memory_used() const {
+        size_t total = _buckets.capacity() * sizeof(Bucket);
+        if (Sparse)
+            total += _count * sizeof(T);
+        else
+            total += _buckets.size() * BucketSize * sizeof(T);
+        return total;
+    }
+
     std::vector<Bucket> const& buckets() const  {return _buckets;}
 
     /// Calls the function `v` for every item. Its signature should be `(size_t,T const&)->bool`.
@@ -304,6 +372,20 @@ public:
         return true;
     }
 
+    /// Calls the function `v` for every item. Its signature should be `(size_t,T&)->bool`.
+    template <typename Visitor>
+    bool visit(Visitor v) {
+        size_t start = 0;
+        for (auto& bucket : _buckets) {
+            bool ok = bucket.visit([&](size_t i, T& item) {
+                return v(start + i, item);
+            });
+            if (!ok) return false;
+            start += BucketSize;
+        }
+        return true;
+    }
+
 private:
     static size_t bucketOffset(size_t i)    {return i & (BucketSize - 1);}
     static size_t bucketIndex(size_t i)     {return i / BucketSize;}
@@ -331,23 +413,42 @@ static_assert((HashBucketSize & (HashBucketSize - 1)) == 0);
 
 
 /// A hash table using a sparse_array (in sparse or dense mode) as its backing store.
-/// `Key` is the key type used to look up items, e.g. `std::string_view`.
-/// `Item` is the type stored in the table. Must be constructible from `Key`. E.g. `std::string`.
-/// `Hash` is the hash function: must have an `operator()` that takes a `Key` and returns uint32_t.
+/// It lives in ordinary (malloc) memory, not in a Heap.
+///
+/// - `Key` is the key type used to look up items, e.g. `std::string_view`.
+/// - `Item` is the type stored in the table, e.g. `std::string`. It must be default-constructible,
+///   move-assignable, and comparable to a `Key` with `==`; `Key(item)` must produce its key.
+///   It needs to be copyable only to copy a table, or to call `get` on the underlying array.
+///   To use the table as a map, make `Item` a struct holding a key and a value.
+/// - `Hash` is the hash function: must have an `operator()` that takes a `Key` and returns uint32_t.
+///
+/// Lookups are heterogeneous: `get`, `contains` and `erase` accept any type `K` that `Hash`
+/// accepts and that `Item` compares equal to, so a table of `std::string` can be searched
+/// with a `std::string_view` or a C string without allocating.
+///
+/// The table uses linear probing with a maximum load factor of 0.5. Erasing uses backward-shift
+/// deletion, so there are no tombstones and lookups never slow down after many removals.
+/// In the sparse variant each occupied slot costs `sizeof(Item)` plus about 3 bits of bitmap and
+/// bucket overhead; the dense variant costs `2 * sizeof(Item)` per item at maximum load.
+///
+/// @warning  Pointers to Items are invalidated by any modification of the table.
 template <typename Key, typename Item, typename Hash, bool Sparse = true>
 class hash_table {
 public:
-    hash_table(size_t capacity)
+    using ArrayClass = sparse_array<Item,HashBucketSize,Sparse>;
+
+    explicit hash_table(size_t capacity = 0)
     :_array(arraySizeForCapacity(capacity))
-    ,_capacity(size_t(floor(_array.size() * kMaxLoad)))
+    ,_capacity(capacityForArraySize(_array.size()))
     { }
 
+    /// Constructs a table by copying all the Items of another one.
     template <bool S>
     hash_table(size_t capacity, hash_table<Key,Item,Hash,S> const& other)
-    :hash_table(capacity)
+    :hash_table(std::max(capacity, other.count()))
     {
         other.visit([&](size_t, Item const& item) {
-            insert(Key(item));
+            insert_item(Item(item));
             return true;
         });
     }
@@ -357,25 +458,44 @@ public:
     :hash_table(other.capacity(), other)
     { }
 
+    hash_table(hash_table&&) = default;
+    hash_table& operator=(hash_table&&) = default;
+
     size_t table_size() const pure              {return _array.size();}
 
-    /// The maximum number of items the hash table can store.
+    /// The maximum number of items the hash table can store before it has to grow.
     size_t capacity() const pure                {return _capacity;}
 
     /// The current number of items.
     size_t count() const pure                   {return _array.count();}
 
+    bool empty() const pure                     {return _array.empty();}
+
+    /// The number of bytes of heap memory the table has allocated. (Doesn't include any memory
+    /// the Items themselves own, or the allocator's overhead.)
+    size_t memory_used() const pure             {return _array.memory_used();}
+
+    /// Grows the table, if necessary, so it can hold `capacity` items without growing again.
+    void reserve(size_t capacity) {
+        if (capacity > _capacity)
+            rehash(arraySizeForCapacity(capacity));
+    }
+
     /// Looks up an Item by its Key; returns a pointer to it if found, else nullptr.
     /// (The item cannot be modified: that might alter its hash.)
-    Item const* get(Key const& key) const       {return search(key, Hash{}(key)).first;}
-    Item const* operator[] (Key const& key) const {return get(key);}
+    template <typename K = Key>
+    Item const* get(K const& key) const         {return search(key, Hash{}(key)).first;}
+
+    template <typename K = Key>
+    Item const* operator[] (K const& key) const {return get(key);}
+
+    template <typename K = Key>
+    bool contains(K const& key) const           {return get(key) != nullptr;}
 
     /// Adds a new item with the given key and returns a pointer;
     /// if one already exists, returns nullptr.
     Item* insert(Key const& key) {
-        if (count() >= capacity())
-            grow();
-        auto [item, i] = search(key, Hash{}(key));
+        auto [item, i] = prepareInsert(key);
         if (item)
             return nullptr;
         return _array.insert(i, Item(key));
@@ -383,35 +503,69 @@ public:
 
     /// Returns the existing item with the given key; if there is none, it inserts a new one.
     Item* put(Key const& key) {
-        if (count() >= capacity())
-            grow();
-        auto [item, i] = search(key, Hash{}(key));
+        auto [item, i] = prepareInsert(key);
         if (item)
             return const_cast<Item*>(item);
         return _array.insert(i, Item(key));
     }
 
-    void grow() {
-        hash_table bigger(capacity() * 2, *this);
-        std::swap(*this, bigger);
+    /// Moves an Item into the table, unless one with the same key already exists.
+    /// Returns a pointer to the Item in the table, and true if it was inserted.
+    std::pair<Item*,bool> insert_item(Item&& newItem) {
+        // (Find the slot before moving `newItem`, since the key may point into it.)
+        auto [item, i] = prepareInsert(Key(newItem));
+        if (item)
+            return {const_cast<Item*>(item), false};
+        return {_array.insert(i, std::move(newItem)), true};
+    }
+
+    /// Removes the item with the given key, returning true if it existed.
+    template <typename K = Key>
+    bool erase(K const& key) {
+        auto [item, hole] = search(key, Hash{}(key));
+        if (!item)
+            return false;
+        // Backward-shift deletion: move later items of the probe sequence back into the hole,
+        // as long as that doesn't put them before their home slot. The hole's slot stays
+        // occupied until the end, so each shift is just a move-assignment.
+        size_t mask = _array.size() - 1;
+        for (size_t i = (hole + 1) & mask; ; i = (i + 1) & mask) {
+            Item* next = _array.find(i);
+            if (!next)
+                break;
+            size_t home = Hash{}(Key(*next)) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                *_array.find(hole) = std::move(*next);
+                hole = i;
+            }
+        }
+        _array.erase(hole);
+        return true;
     }
 
-    /// Calls the function `v` for every item. Its signature should be `(unsigned,T const*)->bool`.
+    /// Removes all items, but keeps the current capacity.
+    void clear()                                {_array.clear();}
+
+    /// Doubles the table size.
+    void grow()                                 {rehash(2 * _array.size());}
+
+    /// Calls the function `v` for every item. Its signature should be `(size_t,Item const&)->bool`.
     template <typename Visitor>
     bool visit(Visitor &&v) const               {return _array.visit(std::forward<Visitor>(v));}
 
-    using ArrayClass = sparse_array<Item,HashBucketSize,Sparse>;
     std::vector<typename ArrayClass::Bucket> const& buckets() const  {return _array.buckets();}
 
     // just for inspecting/tuning
-    size_t probe_count(Key const& key) const {
+    template <typename K = Key>
+    size_t probe_count(K const& key) const {
         size_t mask = _array.size() - 1;
         size_t i = Hash{}(key) & mask;
         size_t probe = 0;
         while (true) {
             if (auto item = _array[i]; !item || *item == key)
                 break;
-            i = (i + (++probe)) & mask;     // quadratic (triangle-number) probing
+            i = (i + 1) & mask;
+            ++probe;
             assert(probe < mask);
         }
         return probe + 1;
@@ -420,7 +574,7 @@ public:
 private:
     static constexpr float kMaxLoad = 0.5;
 
-    size_t arraySizeForCapacity(size_t capacity) {
+    static size_t arraySizeForCapacity(size_t capacity) {
         auto targetSize = size_t(ceil(capacity / kMaxLoad));
         size_t size = HashBucketSize;
         while (size < targetSize)
@@ -428,20 +582,41 @@ private:
         return size;
     }
 
-    std::pair<Item const*,size_t> search(Key const& key, uint32_t hashCode) const {
+    static size_t capacityForArraySize(size_t size) {return size_t(floor(size * kMaxLoad));}
+
+    template <typename K>
+    std::pair<Item const*,size_t> search(K const& key, uint32_t hashCode) const {
         size_t mask = _array.size() - 1;
         size_t i = hashCode & mask;
-        size_t probe = 0;
         while (true) {
             if (auto item = _array[i]; !item || *item == key)
                 return {item, i};
-            i = (i + (++probe)) & mask;     // quadratic (triangle-number) probing
-            assert(probe < mask);
+            i = (i + 1) & mask;             // linear probing
         }
     }
 
+    std::pair<Item const*,size_t> prepareInsert(Key const& key) {
+        if (count() >= capacity())
+            grow();
+        return search(key, Hash{}(key));
+    }
+
+    // Moves all the items into a new array of size `size`.
+    void rehash(size_t size) {
+        ArrayClass newArray(size);
+        size_t mask = size - 1;
+        _array.visit([&](size_t, Item &item) {
+            size_t i = Hash{}(Key(item)) & mask;
+            while (newArray.contains(i))
+                i = (i + 1) & mask;
+            newArray.insert(i, std::move(item));
+            return true;
+        });
+        _array = std::move(newArray);
+        _capacity = capacityForArraySize(size);
+    }
+
     ArrayClass  _array;
-    size_t      _count;
     size_t      _capacity;
 };
 
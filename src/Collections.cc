@@ -31,9 +31,9 @@ Value Symbol::create(ID id, std::string_view str, Heap &heap) {
     Block *block = heap.allocBlock(heapsize(sizeof(ID) + str.size()), Type::Symbol);
     if (!block)
         return nullptr;
-    auto dst = block->data();
-    memcpy(&dst[0], &id, sizeof(ID));
-    memcpy(&dst[sizeof(ID)], str.data(), str.size());
+    byte *dst = block->data().begin();
+    memcpy(dst, &id, sizeof(ID));
+    memcpy(dst + sizeof(ID), str.data(), str.size());   // (`str` may be empty)
     return Value(block);
 }
 
@@ -142,6 +142,16 @@ Val* Dict::find(Symbol key) {
 }
 
 
+Val* Dict::find(Symbol::ID id) {
+    assert(id != Symbol::ID::None);
+    slice<DictEntry> all = _items();
+    if (DictEntry *ep = _findEntry(all, id); ep != all.end() && ep->id() == id)
+        return &ep->value;
+    else
+        return nullptr;
+}
+
+
 bool Dict::set(Symbol key, Value value, bool insertOnly) {
     slice<DictEntry> all = _items();
     if (DictEntry *ep = _findEntry(all, key.id()); ep == all.end()) {
@@ -151,7 +161,8 @@ bool Dict::set(Symbol key, Value value, bool insertOnly) {
         ep->value = value;
         return true;
     } else if (all.back().key == nullval) {
-        for (auto p = all.end()-1; p > ep; --p) // can't use memmove bc of damned relative ptrs
+        // Shift the following entries up by one, stopping at the first empty one:
+        for (auto p = items().end(); p > ep; --p) // can't use memmove bc of damned relative ptrs
             p[0] = std::move(p[-1]);
         (Val&)ep->key = key;
         ep->value = value;
@@ -228,7 +239,7 @@ static std::ostream& operator<<(std::ostream& out, Blob const& blob) {
     }
     if (blob.size() > 32)
         out << " …";
-    out << std::dec << ">";
+    out << std::dec << std::setfill(' ') << ">";
     return out;
 }
 
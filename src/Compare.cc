@@ -0,0 +1,357 @@
+//
+// Compare.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Compare.hh"
+#include "Collections.hh"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace snej::smol {
+
+namespace wy {
+#include "wyhash32.h"
+}
+
+using namespace std;
+
+
+#pragma mark - SCALARS:
+
+
+static bool isInteger(Type t)   {return t == Type::Int || t == Type::BigInt;}
+
+static int64_t integerValue(Value v) {
+    return v.isInt() ? v.asInt() : v.as<BigInt>().asInt();
+}
+
+static bool isContainer(Type t) {return TypeIs(t, TypeSet::Container);}
+
+static string_view stringOf(Value v) {
+    return v.type() == Type::Symbol ? v.as<Symbol>().str() : v.as<String>().str();
+}
+
+static slice<byte> bytesOf(Value v) {
+    return v.as<Blob>().bytes();
+}
+
+// Compares byte ranges lexicographically. (`memcmp` is vectorized, so this is fast on long
+// strings and blobs.)
+static int compareBytes(const void *a, size_t aSize, const void *b, size_t bSize) {
+    if (int cmp = ::memcmp(a, b, std::min(aSize, bSize)); cmp != 0)
+        return cmp;
+    return (aSize < bSize) ? -1 : (aSize > bSize);
+}
+
+template <typename T>
+static int compareScalars(T a, T b)     {return (a < b) ? -1 : (a > b);}
+
+
+// Equality of two non-container Values, or of a container with a non-container.
+static bool scalarEquals(Value a, Value b) {
+    if (a == b)
+        return true;
+    Type type = a.type();
+    if (type != b.type())
+        return isInteger(type) && isInteger(b.type()) && integerValue(a) == integerValue(b);
+    switch (type) {
+        case Type::BigInt:
+            return integerValue(a) == integerValue(b);
+        case Type::Float: {
+            double x = a.as<Float>().asDouble(), y = b.as<Float>().asDouble();
+            return x == y || (std::isnan(x) && std::isnan(y));
+        }
+        case Type::String:
+            return stringOf(a) == stringOf(b);
+        case Type::Blob: {
+            slice<byte> x = bytesOf(a), y = bytesOf(b);
+            return x.size() == y.size() && ::memcmp(x.begin(), y.begin(), x.size()) == 0;
+        }
+        default:
+            return false;   // Null, Bool, Int and Symbol are equal only if identical
+    }
+}
+
+
+static constexpr unsigned kHashSeed = 0xFE152280;   // (Same as HashTable.cc; hashes are persistent)
+
+// Hashes some bytes, seeded with a Type so that e.g. a String and Symbol with the same
+// characters, or the Int 0 and False, have different hashes.
+// `Val` can only store 31-bit signed ints, so reinterpret hash as int32, then shift right 1 bit.
+static int32_t hashBytes(const void *bytes, size_t size, Type type) {
+    return int32_t(wy::wyhash32(bytes, size, kHashSeed ^ unsigned(type))) >> 1;
+}
+
+static int32_t scalarHash(Value v) {
+    switch (Type type = v.type()) {
+        case Type::Null:
+        case Type::Bool: {
+            bool b = v.asBool();
+            return hashBytes(&b, sizeof(b), type);
+        }
+        case Type::Int:
+        case Type::BigInt: {
+            int64_t i = integerValue(v);
+            return hashBytes(&i, sizeof(i), Type::Int);
+        }
+        case Type::Float: {
+            double d = v.as<Float>().asDouble();
+            if (d == 0.0)
+                d = 0.0;                                    // -0 == 0
+            else if (std::isnan(d))
+                d = std::numeric_limits<double>::quiet_NaN();
+            return hashBytes(&d, sizeof(d), type);
+        }
+        case Type::String:
+        case Type::Symbol: {
+            string_view str = stringOf(v);
+            return hashBytes(str.data(), str.size(), type);
+        }
+        case Type::Blob: {
+            slice<byte> bytes = bytesOf(v);
+            return hashBytes(bytes.begin(), bytes.size(), type);
+        }
+        default:
+            assert(false);
+            return 0;
+    }
+}
+
+
+// Compares an integer with a Float exactly, even where the integer can't be represented
+// as a double. NaN sorts after every number.
+static int compareIntegerWithFloat(int64_t i, double d) {
+    if (std::isnan(d) || d >= 0x1p63)
+        return -1;
+    else if (d < -0x1p63)
+        return 1;
+    double whole = std::floor(d);
+    if (int cmp = compareScalars(i, int64_t(whole)); cmp != 0)
+        return cmp;
+    return (d > whole) ? -1 : 0;
+}
+
+static int compareNumbers(Value a, Value b) {
+    bool aInt = isInteger(a.type()), bInt = isInteger(b.type());
+    if (aInt && bInt)
+        return compareScalars(integerValue(a), integerValue(b));
+    else if (aInt || bInt) {
+        // An integer and a Float: compare by value; if they're equal the integer goes first.
+        int cmp = aInt ? compareIntegerWithFloat(integerValue(a), b.as<Float>().asDouble())
+                       : -compareIntegerWithFloat(integerValue(b), a.as<Float>().asDouble());
+        return cmp ? cmp : (aInt ? -1 : 1);
+    } else {
+        double x = a.as<Float>().asDouble(), y = b.as<Float>().asDouble();
+        if (std::isnan(x) || std::isnan(y))
+            return compareScalars(std::isnan(x), std::isnan(y));
+        return compareScalars(x, y);                    // (-0 == 0)
+    }
+}
+
+// The order of types in `deepCompare`; the numeric types share a rank.
+static int typeRank(Type t) {
+    switch (t) {
+        case Type::Null:    return 0;
+        case Type::Bool:    return 1;
+        case Type::Int:
+        case Type::BigInt:
+        case Type::Float:   return 2;
+        case Type::String:  return 3;
+        case Type::Symbol:  return 4;
+        case Type::Blob:    return 5;
+        case Type::Array:   return 6;
+        case Type::Vector:  return 7;
+        case Type::Dict:    return 8;
+        default:            return 9;
+    }
+}
+
+static int scalarCompare(Value a, Value b) {
+    if (a == b)
+        return 0;
+    Type type = a.type();
+    if (int cmp = compareScalars(typeRank(type), typeRank(b.type())); cmp != 0)
+        return cmp;
+    switch (type) {
+        case Type::Null:
+            return compareScalars(a.isNullish(), b.isNullish());
+        case Type::Bool:
+            return compareScalars(a.asBool(), b.asBool());
+        case Type::Int:
+        case Type::BigInt:
+        case Type::Float:
+            return compareNumbers(a, b);
+        case Type::String:
+        case Type::Symbol: {
+            string_view x = stringOf(a), y = stringOf(b);
+            if (int cmp = compareBytes(x.data(), x.size(), y.data(), y.size()); cmp != 0)
+                return cmp;
+            if (type == Type::String)
+                return 0;
+            // Distinct Symbols with the same name (in different Heaps) aren't equal:
+            return compareScalars(a.block(), b.block());
+        }
+        case Type::Blob: {
+            slice<byte> x = bytesOf(a), y = bytesOf(b);
+            return compareBytes(x.begin(), x.size(), y.begin(), y.size());
+        }
+        default:
+            assert(false);
+            return 0;
+    }
+}
+
+
+#pragma mark - CONTAINERS:
+
+
+static slice<Val> itemsOf(Value v) {
+    return v.type() == Type::Array ? v.as<Array>().items() : v.as<Vector>().items();
+}
+
+
+bool deepEquals(Value a, Value b) {
+    if (a == b)
+        return true;
+    else if (!isContainer(a.type()) || !isContainer(b.type()))
+        return scalarEquals(a, b);
+
+    // Compare pairs of Values from a stack. Scalar items are compared immediately; pairs of
+    // containers are pushed, so the order of traversal doesn't matter.
+    vector<pair<Value,Value>> stack {{a, b}};
+    auto itemEquals = [&](Value x, Value y) {
+        if (x == y)
+            return true;
+        else if (!isContainer(x.type()) || x.type() != y.type())
+            return scalarEquals(x, y);
+        stack.emplace_back(x, y);
+        return true;
+    };
+    while (!stack.empty()) {
+        auto [x, y] = stack.back();
+        stack.pop_back();
+        if (x == y)
+            continue;
+        Type type = x.type();
+        if (!isContainer(type) || type != y.type()) {
+            if (!scalarEquals(x, y))
+                return false;
+        } else if (type == Type::Dict) {
+            auto xs = x.as<Dict>().items(), ys = y.as<Dict>().items();
+            if (xs.size() != ys.size())
+                return false;
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (Value(xs[i].key) != Value(ys[i].key) || !itemEquals(xs[i].value, ys[i].value))
+                    return false;
+            }
+        } else {
+            auto xs = itemsOf(x), ys = itemsOf(y);
+            if (xs.size() != ys.size())
+                return false;
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (!itemEquals(xs[i], ys[i]))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+int32_t deepHash(Value v) {
+    if (!isContainer(v.type()))
+        return scalarHash(v);
+
+    // Mix the hashes of the scalars, and the types and sizes of the containers, in the order
+    // they're found by a depth-first walk:
+    uint64_t h = kHashSeed;
+    auto mix = [&](uint64_t x) {
+        h = (h ^ x) * 0x9E3779B97F4A7C15;
+        h ^= h >> 32;
+    };
+    vector<Value> stack {v};
+    while (!stack.empty()) {
+        Value x = stack.back();
+        stack.pop_back();
+        Type type = x.type();
+        if (!isContainer(type)) {
+            mix(uint32_t(scalarHash(x)));
+        } else if (type == Type::Dict) {
+            auto entries = x.as<Dict>().items();
+            mix((uint64_t(type) << 32) | entries.size());
+            for (size_t i = entries.size(); i-- > 0; ) {
+                mix(uint32_t(scalarHash(entries[i].key)));
+                stack.push_back(entries[i].value);
+            }
+        } else {
+            auto items = itemsOf(x);
+            mix((uint64_t(type) << 32) | items.size());
+            for (size_t i = items.size(); i-- > 0; )
+                stack.push_back(items[i]);
+        }
+    }
+    return int32_t(uint32_t(h)) >> 1;
+}
+
+
+int deepCompare(Value a, Value b) {
+    if (a == b)
+        return 0;
+    Type aType = a.type(), bType = b.type();
+    if (!isContainer(aType) || aType != bType)
+        return scalarCompare(a, b);
+
+    // A stack of pairs to compare. Each container pushes its items' pairs, in reverse order so
+    // they're compared first to last; below them it pushes a pair of its sizes, which decides
+    // the order if one is a prefix of the other.
+    struct Pair {Value a, b; int64_t aSize = -1, bSize = -1;};
+    vector<Pair> stack {{a, b}};
+    while (!stack.empty()) {
+        Pair pair = stack.back();
+        stack.pop_back();
+        if (pair.aSize >= 0) {
+            if (int cmp = compareScalars(pair.aSize, pair.bSize); cmp != 0)
+                return cmp;
+            continue;
+        }
+        Value x = pair.a, y = pair.b;
+        if (x == y)
+            continue;
+        Type type = x.type();
+        if (!isContainer(type) || type != y.type()) {
+            if (int cmp = scalarCompare(x, y); cmp != 0)
+                return cmp;
+        } else if (type == Type::Dict) {
+            auto xs = x.as<Dict>().items(), ys = y.as<Dict>().items();
+            stack.push_back({nullvalue, nullvalue, xs.size(), ys.size()});
+            for (size_t i = std::min(xs.size(), ys.size()); i-- > 0; ) {
+                stack.push_back({xs[i].value, ys[i].value});
+                stack.push_back({xs[i].key, ys[i].key});
+            }
+        } else {
+            auto xs = itemsOf(x), ys = itemsOf(y);
+            stack.push_back({nullvalue, nullvalue, xs.size(), ys.size()});
+            for (size_t i = std::min(xs.size(), ys.size()); i-- > 0; )
+                stack.push_back({xs[i], ys[i]});
+        }
+    }
+    return 0;
+}
+
+}
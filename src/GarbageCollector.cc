@@ -19,7 +19,11 @@
 #include "GarbageCollector.hh"
 #include "smol_world.hh"
 #include "Value.hh"
-#include <iostream>
+#include "HeapProfiler.hh"
+#include "Log.hh"
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
 
 namespace snej::smol {
 
@@ -31,17 +35,18 @@ void GarbageCollector::runOnDemand(Heap &heap) {
     });
 }
 
-GarbageCollector::GarbageCollector(Heap &heap)
+GarbageCollector::GarbageCollector(Heap &heap, GCOrder order)
 :_tempHeap(std::make_unique<Heap>(heap.capacity()))
 ,_fromHeap(heap)
 ,_toHeap(*_tempHeap)
+,_order(order)
 {
     scanRoots();
 }
 
 
-GarbageCollector::GarbageCollector(Heap &fromHeap, Heap &toHeap)
-:_fromHeap(fromHeap), _toHeap(toHeap)
+GarbageCollector::GarbageCollector(Heap &fromHeap, Heap &toHeap, GCOrder order)
+:_fromHeap(fromHeap), _toHeap(toHeap), _order(order)
 {
     scanRoots();
 }
@@ -49,6 +54,10 @@ GarbageCollector::GarbageCollector(Heap &fromHeap, Heap &toHeap)
 
 // The destructor swaps the two heaps, so _fromHeap is now the live one.
 GarbageCollector::~GarbageCollector() {
+    SMOL_LOG(GCLog, Info, "Collected heap %p: %zu bytes used before, %zu after",
+             (void*)&_fromHeap, _fromHeap.used(), _toHeap.used());
+    if (_fromHeap._profiler)
+        _fromHeap._profiler->collected(_fromHeap);
     _fromHeap.swapMemoryWith(_toHeap);
 }
 
@@ -56,11 +65,23 @@ GarbageCollector::~GarbageCollector() {
 
 void GarbageCollector::scanRoots() {
     assert(!_fromHeap._cannotGC);
+    _fromHeap.assertOwner();
+    _toHeap.assertOwner();
 
 #ifndef NDEBUG
     for (auto obj = _fromHeap.firstBlock(); obj; obj = _fromHeap.nextBlock(obj))
         assert(!obj->isForwarded());
 #endif
+    if (_fromHeap._mayHavePadding) {
+        _alignments = findAlignedBlocks(_fromHeap);
+        // A copy may need a bigger Pad than the original had, so the copies could overflow
+        // _toHeap. To prevent that, Pads are paid for out of a budget: _toHeap's spare capacity,
+        // plus the sizes of the original Pads of the blocks copied so far. So alignment is only
+        // lost if _toHeap is nearly full.
+        _padBudget = intptr_t(_toHeap.capacity()) - intptr_t(_fromHeap.used());
+        SMOL_LOG(GCLog, Verbose, "Heap %p has %zu aligned blocks",
+                 (void*)&_fromHeap, _alignments.size());
+    }
     _toHeap.reset();
     _toHeap.setRoot(scan(_fromHeap.root()).maybeAs<Object>());
     for (Object *refp : _fromHeap._externalRootObjs)
@@ -71,6 +92,20 @@ void GarbageCollector::scanRoots() {
 }
 
 
+// Finds the blocks allocated with an alignment, i.e. the ones following Pad blocks, so that
+// moveBlock can align their copies. The Pads themselves are garbage and won't be copied.
+GarbageCollector::AlignmentMap GarbageCollector::findAlignedBlocks(Heap const& heap) {
+    AlignmentMap alignments;
+    for (auto obj = heap.firstBlock(); obj; obj = heap.nextBlock(obj)) {
+        if (obj->type() == Type::Pad) {
+            if (auto next = heap.nextBlock(obj); next && next->type() != Type::Pad)
+                alignments[next] = {obj->padAlignment(), obj->blockSize()};
+        }
+    }
+    return alignments;
+}
+
+
 Value GarbageCollector::scan(Value val) {
     update(val);
     return val;
@@ -84,7 +119,8 @@ void GarbageCollector::update(Value& val) {
 
 
 void GarbageCollector::update(Object& obj) {
-    obj.relocate(scan(obj.block()));
+    if (Block *block = obj.block())         // (a `Handle<Maybe<>>` may be empty)
+        obj.relocate(scan(block));
 }
 
 
@@ -94,11 +130,13 @@ void GarbageCollector::update(Object& obj) {
 // This scan proceeds through any subsequent Blocks in toHeap that are appended to it by the moves.
 // On completion, the `src` block and any blocks it transitively references are fully moved.
 Block* GarbageCollector::scan(Block *src) {
+    if (_order == GCOrder::DepthFirst)
+        return scanDepthFirst(src);
     Block *toScan = (Block*)_toHeap._cur;
     Block *dst = moveBlock(src);
     while (toScan < (Block*)_toHeap._cur) {
         // Scan & update the contents of the Object in `toScan`:
-        //std::cerr << "**** Scanning block " << (void*)toScan << "\n";
+        SMOL_LOG(GCLog, Debug, "Scanning block %p", (void*)toScan);
         for (Val &v : toScan->vals()) {
             if (v.isObject()) {
                 // Note: v is in toHeap, but was memcpy'd from fromHeap,
@@ -115,6 +153,58 @@ Block* GarbageCollector::scan(Block *src) {
 }
 
 
+// The DepthFirst version of scan(). Instead of scanning the blocks in _toHeap in order, it
+// keeps a stack of the containers that haven't been scanned yet. Scanning a container moves all
+// its children (so they're adjacent to it), then pushes the ones that are containers, so that
+// the first child's subtree is copied next.
+Block* GarbageCollector::scanDepthFirst(Block *src) {
+    bool moved = !src->isForwarded();
+    Block *dst = moveBlock(src);
+    if (moved && dst->containsVals())
+        _stack.push_back(dst);
+    while (!_stack.empty()) {
+        Block *toScan = _stack.back();
+        _stack.pop_back();
+        SMOL_LOG(GCLog, Debug, "Scanning block %p", (void*)toScan);
+        size_t firstChild = _stack.size();
+        for (Val &v : toScan->vals()) {
+            if (v.isObject()) {
+                // (See the comment in scan() about the value of `v`.)
+                auto block = (Block*)_fromHeap.at(heappos((uintpos&)v >> 1));
+                bool childMoved = !block->isForwarded();
+                Block *child = moveBlock(block);
+                v = child;
+                if (childMoved && child->containsVals())
+                    _stack.push_back(child);
+            }
+        }
+        // Reverse the children just pushed, so the first one will be popped first:
+        std::reverse(_stack.begin() + firstChild, _stack.end());
+    }
+    return dst;
+}
+
+
+// If `src` was allocated with an alignment, and the budget allows, returns the alignment its copy
+// of size `size` should have; else 0.
+heapsize GarbageCollector::alignmentFor(Block const* src, heapsize size) {
+    if (_alignments.empty())
+        return 0;
+    auto i = _alignments.find(src);
+    if (i == _alignments.end())
+        return 0;
+    _padBudget += i->second.padSize;
+    heapsize pad = _toHeap.padSize(_toHeap._cur, size, i->second.alignment);
+    if (pad > _padBudget) {
+        SMOL_LOG(GCLog, Info, "Heap %p is too full to keep block %p aligned",
+                 (void*)&_fromHeap, (void*)src);
+        return 0;
+    }
+    _padBudget -= pad;
+    return i->second.alignment;
+}
+
+
 // Moves a Block from _fromHeap to _toHeap, without altering its contents.
 // - If the Block has already been moved, just returns the new location.
 // - Otherwise copies (appends) it to _toHeap, then overwrites it with the forwarding address.
@@ -124,12 +214,7 @@ Block* GarbageCollector::moveBlock(Block* src) {
     } else {
         Block *dst;
         if (src->containsVals()) {
-            slice<Val> vals = src->vals();
-            if_let(dict, Value(src).maybeAs<Dict>()) {
-                vals = vals(0, 2 * dict.size());        // only write the used portion of a Dict
-            } else if_let(vector, Value(src).maybeAs<Vector>()) {
-                vals = vals(0, vector.size() + 1);      // only write the used portion of a Vector
-            }
+            slice<Val> vals = src->usedVals();      // only write the used portion of a Dict/Vector
             // Ugh. We have to move a bunch of relative-pointers, which still need to resolve to
             // their original addresses until they get processed during the loop in scan().
             // But there's no guarantee toHeap is within 2GB of fromHeap, so they're not capable
@@ -137,8 +222,11 @@ Block* GarbageCollector::moveBlock(Block* src) {
             // The workaround is to transform each pointer-based value into a pointer to the
             // equivalent heap offset. So if the original Val pointed to fromHeap+3F8, the copied
             // Val points to toHeap+3F8. This isn't a useable Val, but scan() can undo this.
-            dst = _toHeap.allocBlock(vals.size() * sizeof(Val), src->type());
-            //std::cerr << "**** Move block " << (void*)src << " to " << (void*)dst << " -- " << _toHeap._cur << "\n";
+            heapsize size = vals.size() * sizeof(Val);
+            heapsize alignment = alignmentFor(src, size);
+            dst = alignment ? _toHeap.allocBlock(size, src->type(), alignment)
+                            : _toHeap.allocBlock(size, src->type());
+            SMOL_LOG(GCLog, Debug, "Move block %p to %p", (void*)src, (void*)dst);
             auto dstItem = (uintpos*)dst->dataPtr();
             for (Val const& srcVal : vals) {
                 if (srcVal.isObject())
@@ -150,8 +238,10 @@ Block* GarbageCollector::moveBlock(Block* src) {
         } else {
             // Moving a block of non-Vals is easy:
             auto size = src->blockSize();
-            dst = (Block*)_toHeap.rawAlloc(size);
-            //std::cerr << "---- Move block " << (void*)src << " to " << (void*)dst << " -- " << _toHeap._cur << "\n";
+            heapsize alignment = alignmentFor(src, src->dataSize());
+            dst = alignment ? _toHeap.allocBlock(src->dataSize(), src->type(), alignment)
+                            : (Block*)_toHeap.rawAlloc(size);
+            SMOL_LOG(GCLog, Debug, "Move block %p to %p", (void*)src, (void*)dst);
             ::memcpy(dst, src, size);
         }
         src->setForwardingAddress(_toHeap.pos(dst));
@@ -160,6 +250,141 @@ Block* GarbageCollector::moveBlock(Block* src) {
 }
 
 
+#pragma mark - DEDUPLICATION:
+
+
+/// Finds and shares identical objects, for `GarbageCollector::deduplicate`. It walks the graph
+/// depth-first, finishing an object only after all its children, so by then each reference to a
+/// child has been changed to point to the child's canonical copy. That makes two containers
+/// identical just when their Vals are bitwise equal, or point to the same Blocks.
+/// A block allocated with an alignment is only replaced by a copy that's at least as aligned,
+/// so that the GC keeps it aligned.
+class Deduplicator {
+public:
+    explicit Deduplicator(std::unordered_map<Block const*,heapsize> alignments)
+    :_alignments(std::move(alignments))
+    { }
+
+    size_t run(Block *root) {
+        _stack.push_back({root, false});
+        while (!_stack.empty()) {
+            auto [block, childrenDone] = _stack.back();
+            _stack.pop_back();
+            if (childrenDone) {
+                finish(block);
+            } else if (!_canonical.contains(block) && !_visiting.contains(block)) {
+                if (block->type() == Type::Symbol) {
+                    _canonical.emplace(block, block);
+                    continue;
+                }
+                _visiting.insert(block);
+                _stack.push_back({block, true});
+                for (Val &v : block->usedVals()) {
+                    if (Block *child = v.block(); child && !_canonical.contains(child))
+                        _stack.push_back({child, false});
+                }
+            }
+        }
+        return _bytesShared;
+    }
+
+private:
+    void finish(Block *block) {
+        _visiting.erase(block);
+        // Point to the children's canonical copies. (A child that's still being visited is an
+        // ancestor, i.e. there's a cycle; it stays as it is.)
+        for (Val &v : block->usedVals()) {
+            if (Block *child = v.block()) {
+                if (auto i = _canonical.find(child); i != _canonical.end() && i->second != child)
+                    v = i->second;
+            }
+        }
+
+        size_t hash = contentHash(block);
+        heapsize alignment = alignmentOf(block);
+        for (auto [i, end] = _byHash.equal_range(hash); i != end; ++i) {
+            if (alignmentOf(i->second) >= alignment && sameContents(block, i->second)) {
+                _canonical.emplace(block, i->second);
+                _bytesShared += block->blockSize();
+                return;
+            }
+        }
+        _byHash.emplace(hash, block);
+        _canonical.emplace(block, block);
+    }
+
+    heapsize alignmentOf(Block const* block) const {
+        if (_alignments.empty())
+            return 0;
+        auto i = _alignments.find(block);
+        return i != _alignments.end() ? i->second : 0;
+    }
+
+    static size_t contentHash(Block const* block) {
+        size_t h = size_t(block->type());
+        if (block->containsVals()) {
+            for (Val const& v : block->usedVals()) {
+                // Hash an object by its address; it's already canonical.
+                size_t item = v.isObject() ? size_t(v._block()) : size_t((uintpos const&)v);
+                h = h * 31 + std::hash<size_t>{}(item);
+            }
+        } else {
+            auto data = block->data();
+            h ^= std::hash<std::string_view>{}({(const char*)data.begin(), data.size()});
+        }
+        return h;
+    }
+
+    static bool sameContents(Block const* a, Block const* b) {
+        if (a->type() != b->type())
+            return false;
+        if (!a->containsVals()) {
+            auto da = a->data(), db = b->data();
+            return da.size() == db.size() && memcmp(da.begin(), db.begin(), da.size()) == 0;
+        }
+        auto va = a->usedVals(), vb = b->usedVals();
+        if (va.size() != vb.size())
+            return false;
+        for (size_t i = 0; i < va.size(); ++i) {
+            if (va[i].isObject() ? (va[i].block() != vb[i].block()) : !(va[i] == vb[i]))
+                return false;
+        }
+        return true;
+    }
+
+    std::unordered_map<Block const*,heapsize> _alignments;  // Blocks allocated with an alignment
+    std::vector<std::pair<Block*,bool>>     _stack;         // Blocks to visit, or to finish
+    std::unordered_set<Block*>              _visiting;      // Blocks whose children are pending
+    std::unordered_map<Block*,Block*>       _canonical;     // Finished block -> its canonical copy
+    std::unordered_multimap<size_t,Block*>  _byHash;        // Canonical blocks by content hash
+    size_t                                  _bytesShared = 0;
+};
+
+
+size_t GarbageCollector::deduplicate(Heap &heap, Value root) {
+    Block *block = root.block();
+    if (!block)
+        return 0;
+    UsingHeap u(heap);
+    std::unordered_map<Block const*,heapsize> alignments;
+    if (heap._mayHavePadding) {
+        for (auto &[aligned, a] : findAlignedBlocks(heap))
+            alignments.emplace(aligned, a.alignment);
+    }
+    size_t shared = Deduplicator(std::move(alignments)).run(block);
+    SMOL_LOG(GCLog, Info, "Deduplicated heap %p: %zu bytes of duplicate objects",
+             (void*)&heap, shared);
+    return shared;
+}
+
+
+size_t GarbageCollector::runDeduplicating(Heap &heap, GCOrder order) {
+    size_t shared = deduplicate(heap, heap.root());
+    run(heap, order);
+    return shared;
+}
+
+
 void Heap::garbageCollectTo(Heap &dstHeap) {
     GarbageCollector gc(*this, dstHeap);
 }
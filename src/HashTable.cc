@@ -17,8 +17,10 @@
 //
 
 #include "HashTable.hh"
+#include "Compare.hh"
 #include "Heap.hh"
 #include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 
@@ -82,20 +84,52 @@ Array HashSet::createArray(Heap &heap, uint32_t capacity) {
 }
 
 
+// Number of the old table's slots that each insertion copies into the new one, while resizing.
+// The new table has room for as many insertions as the old one's size/2, so this must be at
+// least 2 for the resize to finish before the new table fills up.
+static constexpr uint32_t kMigrationStep = 16;
+
+// Indexes of the items in the persistent form of a HashSet that's resizing:
+enum {kNewTableIndex, kOldTableIndex, kMigratedIndex, kResizingSize};
+
+
 HashSet::HashSet(Heap &heap, SparseArray &&array, bool recount)
 :_heap(&heap)
 ,_array(std::move(array))
 ,_size(uint32_t(_array.size()))
 ,_count(recount ? _array.nonNullCount() : 0)
 ,_capacity(uint32_t(round(_size * kMaxLoad)))
+,_resizing(heap)
 {
     assert((_size & (_size - 1)) == 0);                 // size must be a power of 2
 }
 
 
+// If `array` is the persistent form of a HashSet in mid-resize, returns the new table.
+static Array currentTable(Array array) {
+    if (array.size() == kResizingSize) {
+        if_let(table, array[kNewTableIndex].maybeAs<Array>())
+            return table;
+    }
+    return array;
+}
+
+
 HashSet::HashSet(Heap &heap, Array array)
-:HashSet(heap, SparseArray(array, heap), true)
-{ }
+:HashSet(heap, SparseArray(currentTable(array), heap), true)
+{
+    if (array != _array.array()) {
+        // Resume the resize:
+        _oldArray.emplace(array[kOldTableIndex].as<Array>(), heap);
+        _migrated = uint32_t(array[kMigratedIndex].asInt());
+        _resizing = array;
+        _oldArray->visit([&](unsigned i, Value) {
+            if (i >= _migrated)
+                ++_count;
+            return true;
+        });
+    }
+}
 
 HashSet::HashSet(Heap &heap, unsigned capacity)
 :HashSet(heap, _createArray(heap, capacity), false)
@@ -105,37 +139,68 @@ HashSet::HashSet(Heap &heap, unsigned capacity)
 template <typename KEY>
 std::pair<unsigned,bool>
 HashSet::search(KEY key, int32_t hashCode) const {
-    auto i = uint32_t(hashCode) & (_size - 1);
-    while (true) {
-        if (Value val = _array[i]) {
-            if (keysMatch(key, val))
-                return {i, true};
-        } else {
-            return {i, false};
-        }
-        i = (i + 1) & (_size - 1);
-    }
+    // (The table is never full, so the probe always ends at a null.)
+    return _array.probe(uint32_t(hashCode) & (_size - 1), [&](Value val) {
+        return keysMatch(key, val);
+    });
+}
+
+// Looks up a key in the old table, while resizing. (Items it shares with the new table are
+// found there first, so any match here is one that hasn't been moved yet.)
+template <typename KEY>
+Value HashSet::searchOld(KEY key, int32_t hashCode) const {
+    if (!_oldArray)
+        return nullvalue;
+    auto [i, found] = _oldArray->probe(uint32_t(hashCode) & (_oldArray->size() - 1), [&](Value val) {
+        return keysMatch(key, val);
+    });
+    return found ? _oldArray->get(i) : Value();
+}
+
+// `findOrInsert` (inline in the header) calls these, so make sure they get instantiated:
+template std::pair<unsigned,bool> HashSet::search(string_view, int32_t) const;
+template Value HashSet::searchOld(string_view, int32_t) const;
+
+
+Array HashSet::array() const {
+    if (_oldArray)
+        return _resizing.value();
+    return _array.array();
 }
 
 
-Value HashSet::find(string_view str) const {
-    if (auto [i, found] = search(str, computeHash(str)); found)
+void HashSet::setHeap(Heap &heap) {
+    _heap = &heap;
+    _array.setHeap(heap);
+    if (_oldArray)
+        _oldArray->setHeap(heap);
+    _resizing.setHeap(heap);
+}
+
+
+Value HashSet::find(string_view str, int32_t hashCode) const {
+    if (auto [i, found] = search(str, hashCode); found)
         return _array[i];
     else
-        return nullvalue;
+        return searchOld(str, hashCode);
 }
 
 
 bool HashSet::insert(Value key, int32_t hashCode) {
     auto [i, found] = search(key, hashCode);
-    return !found && insert(key, hashCode, i);
+    return !found && !searchOld(key, hashCode) && insert(key, hashCode, i);
 }
 
 
 bool HashSet::insert(Value key, int32_t hashCode, unsigned i) {
-    if (_count >= _capacity) {
+    if (_oldArray || _count >= _capacity) {
         Handle hKey(&key, *_heap);
-        if (!grow())
+        if (_oldArray) {
+            // Do some of the resizing work; it may use the slot `i`:
+            if (!migrate(kMigrationStep))
+                return false;
+        }
+        if (_count >= _capacity && !grow(2 * _size))
             return false;
         i = search(key, hashCode).first;
     }
@@ -147,25 +212,84 @@ bool HashSet::insert(Value key, int32_t hashCode, unsigned i) {
 }
 
 
-bool HashSet::grow() {
-//    std::cout << "=== Growing HashSet to " << 2*_size << " buckets ===\n";
-    HashSet newTable(*_heap, SparseArray(2 * _size, *_heap), false);
-    // Scan the old table, inserting each entry into the new table:
-    bool ok = _array.visit([&](unsigned, Value val) {
-        return newTable.insert(val);
-    });
-    if (!ok)
-        return false;
-    // Switch to the new table:
-    swap(*this, newTable);
+bool HashSet::reserve(uint32_t n) {
+    uint32_t needed = _count + n;
+    if (needed <= _capacity)
+        return true;
+    // A new resize can't start until the current one is done; finish it in the usual steps:
+    while (_oldArray) {
+        if (!migrate(kMigrationStep))
+            return false;
+    }
+    // Then grow straight to a size with room for everything:
+    uint32_t newSize = 2 * _size;
+    while (uint32_t(round(newSize * kMaxLoad)) < needed)
+        newSize *= 2;
+    return grow(newSize);
+}
+
+
+// Starts a resize: switches to a new table of size `newSize` (a larger power of 2), keeping the
+// current one as `_oldArray` until `migrate` has copied all its items. Must not be called while
+// already resizing; `kMigrationStep` ensures that a resize finishes before the table fills.
+bool HashSet::grow(uint32_t newSize) {
+    assert(!_oldArray);
+    assert(newSize > _size && (newSize & (newSize - 1)) == 0);
+    SparseArray bigger(newSize, *_heap);
+    unless(resizing, newArray(kResizingSize, *_heap)) {return false;}
+    resizing[kNewTableIndex] = bigger.array();
+    resizing[kOldTableIndex] = _array.array();
+    resizing[kMigratedIndex] = 0;
+    _resizing = resizing;
+    _oldArray.emplace(std::move(_array));
+    _array = std::move(bigger);
+    _migrated = 0;
+    _size = uint32_t(_array.size());
+    _capacity = uint32_t(round(_size * kMaxLoad));
+    return true;
+}
+
+
+// Copies the items in the next `nSlots` slots of the old table into the new one. When the
+// old table is done, its buckets are recycled and it's discarded.
+bool HashSet::migrate(uint32_t nSlots) {
+    assert(_oldArray);
+    uint32_t end = _oldArray->size();
+    if (nSlots < end - _migrated)
+        end = _migrated + nSlots;
+    for (; _migrated < end; ++_migrated) {
+        if (_oldArray->contains(_migrated)) {
+            Value val = _oldArray->get(_migrated);
+            unsigned i = _array.probe(uint32_t(computeHash(val)) & (_size - 1),
+                                      [](Value) {return false;}).first;
+            if (!_array.put(i, val)) {
+                _resizing.value()[kMigratedIndex] = int(_migrated);
+                return false;
+            }
+        }
+    }
+    if (_migrated < _oldArray->size()) {
+        _resizing.value()[kMigratedIndex] = int(_migrated);
+    } else {
+        // Done! The old buckets can be reused as the new table's buckets fill up:
+        _array.recycleBucketsFrom(*_oldArray);
+        _oldArray.reset();
+        _resizing = nullvalue;
+    }
     return true;
 }
 
 
 bool HashSet::visit(Visitor visitor) const {
-    return _array.visit([&](unsigned, Value val) {
+    bool ok = _array.visit([&](unsigned, Value val) {
         return visitor(val);
     });
+    if (ok && _oldArray) {
+        ok = _oldArray->visit([&](unsigned i, Value val) {
+            return i < _migrated || visitor(val);
+        });
+    }
+    return ok;
 }
 
 
@@ -201,4 +325,157 @@ void HashSet::dump(std::ostream &out, bool longForm) const {
 }
 
 
+
+#pragma mark - HASHMAP:
+
+
+// An entry is an Array of [hash code, key, value]:
+enum {kHashIndex, kKeyIndex, kValueIndex, kEntrySize};
+
+
+bool HashMap::isValidKey(Value key) {
+    return !TypeIs(key.type(), TypeSet::Container);
+}
+
+
+// Key hashing and equality are the same as deep hashing and equality, restricted to scalars.
+int32_t HashMap::computeHash(Value key) {
+    return deepHash(key);
+}
+
+
+bool HashMap::keysEqual(Value a, Value b) {
+    return deepEquals(a, b);
+}
+
+
+SparseArray HashMap::createArray(Heap &heap, uint32_t capacity) {
+    return HashSet::_createArray(heap, capacity);
+}
+
+
+HashMap::HashMap(Heap &heap, SparseArray &&array, bool recount)
+:_heap(&heap)
+,_array(std::move(array))
+,_size(uint32_t(_array.size()))
+,_count(recount ? _array.nonNullCount() : 0)
+,_capacity(uint32_t(round(_size * kMaxLoad)))
+{
+    assert((_size & (_size - 1)) == 0);                 // size must be a power of 2
+}
+
+HashMap::HashMap(Heap &heap, Array array)
+:HashMap(heap, SparseArray(array, heap), true)
+{ }
+
+HashMap::HashMap(Heap &heap, unsigned capacity)
+:HashMap(heap, createArray(heap, capacity), false)
+{ }
+
+
+std::pair<unsigned,bool> HashMap::search(Value key, int32_t hashCode) const {
+    return _array.probe(home(hashCode), [&](Value entryVal) {
+        Array entry = entryVal.as<Array>();
+        return entry[kHashIndex].asInt() == hashCode && keysEqual(entry[kKeyIndex], key);
+    });
+}
+
+
+Maybe<Array> HashMap::findEntry(Value key) const {
+    if (!isValidKey(key))
+        return nullvalue;
+    if (auto [i, found] = search(key, computeHash(key)); found)
+        return _array[i].as<Array>();
+    return nullvalue;
+}
+
+
+Value HashMap::get(Value key) const {
+    if_let(entry, findEntry(key)) {
+        return entry[kValueIndex];
+    }
+    return nullvalue;
+}
+
+
+bool HashMap::set(Value key, Value value) {
+    if (!isValidKey(key))
+        return false;
+    int32_t hashCode = computeHash(key);
+    auto [i, found] = search(key, hashCode);
+    if (found) {
+        _array[i].as<Array>()[kValueIndex] = value;
+        return true;
+    }
+
+    // Allocating may trigger GC, so protect the key and value:
+    Handle hKey(&key, *_heap);
+    Handle hValue(&value, *_heap);
+    if (_count >= _capacity) {
+        if (!grow())
+            return false;
+        i = search(key, hashCode).first;
+    }
+    unless(entry, newArray(kEntrySize, *_heap)) {return false;}
+    entry[kHashIndex] = Value(hashCode);
+    entry[kKeyIndex] = key;
+    entry[kValueIndex] = value;
+    if (!_array.put(i, entry))
+        return false;
+    ++_count;
+    return true;
+}
+
+
+bool HashMap::remove(Value key) {
+    if (!isValidKey(key))
+        return false;
+    auto [i, found] = search(key, computeHash(key));
+    if (!found)
+        return false;
+    // Don't leave a null in the middle of a run of entries, or lookups would stop there: move
+    // each later entry in the run back into the hole, unless that would put it before its home.
+    const unsigned mask = _size - 1;
+    unsigned hole = i;
+    for (unsigned j = (i + 1) & mask; ; j = (j + 1) & mask) {
+        Value entry = _array[j];
+        if (!entry)
+            break;
+        unsigned h = home(entry.as<Array>()[kHashIndex].asInt());
+        if (((j - h) & mask) >= ((j - hole) & mask)) {
+            (void)_array.put(hole, entry);      // (replacing an item never allocates)
+            hole = j;
+        }
+    }
+    (void)_array.put(hole, nullvalue);
+    --_count;
+    return true;
+}
+
+
+bool HashMap::grow() {
+    HashMap newMap(*_heap, SparseArray(2 * _size, *_heap), false);
+    // Move the entries to the new table; their stored hash codes say where they go:
+    bool ok = _array.visit([&](unsigned, Value entry) {
+        int32_t hashCode = entry.as<Array>()[kHashIndex].asInt();
+        unsigned i = newMap._array.probe(newMap.home(hashCode), [](Value) {return false;}).first;
+        if (!newMap._array.put(i, entry))
+            return false;
+        ++newMap._count;
+        return true;
+    });
+    if (!ok)
+        return false;
+    swap(*this, newMap);
+    return true;
+}
+
+
+bool HashMap::visit(Visitor visitor) const {
+    return _array.visit([&](unsigned, Value entryVal) {
+        Array entry = entryVal.as<Array>();
+        return visitor(entry[kKeyIndex], entry[kValueIndex]);
+    });
+}
+
 }
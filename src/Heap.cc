@@ -6,12 +6,20 @@
 
 #include "Heap.hh"
 #include "smol_world.hh"
+#include "HeapProfiler.hh"
+#include "Log.hh"
+#include <algorithm>
+#include <bit>
 #include <deque>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <set>
-#include <unordered_set>
+#include <shared_mutex>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace snej::smol {
 
@@ -27,7 +35,91 @@ const size_t Heap::Overhead = sizeof(Header);
 
 static thread_local Heap const* sCurHeap;
 
-static std::vector<Heap*> sKnownHeaps;
+// Index of all Heaps that have memory, by base address, so `heapContaining` can binary-search
+// it. (Heaps use caller-supplied memory, so they can't be found by masking the address. Two Heaps
+// can even share memory, e.g. one opened with `existing` on another's contents.)
+// Nested Heaps are handled by giving each entry a link to the innermost Heap whose range encloses
+// it; a lookup that misses the nearest Heap below the address follows those links, so it takes
+// time proportional to the nesting depth, not to the number of Heaps. (This assumes Heaps' ranges
+// are either disjoint or nested, as real memory allocations are.)
+// Lookups take a shared lock. On top of that, each thread caches the last Heap it found, since
+// consecutive lookups usually hit the same Heap; the cache is invalidated by bumping
+// `sRegistryGeneration` whenever a Heap is added, removed, resized, reset, or has its memory
+// swapped.
+struct RegistryEntry {
+    Heap*        heap;
+    byte const*  end;       // The Heap's `_end`
+    Heap*        parent;    // The innermost other Heap whose range encloses this one's, if any
+};
+using HeapRegistry = std::multimap<byte const*,RegistryEntry>;
+static std::shared_mutex            sRegistryMutex;
+static auto&                        sKnownHeaps = *new HeapRegistry; // (leaked)
+static std::atomic<uint64_t>        sRegistryGeneration = 1;
+
+// The last result of `heapContaining`: the Heap contains every address in [start, end). This is
+// checked without touching the Heap itself, which another thread might be destroying.
+struct RegistryCache {
+    uint64_t     generation = 0;
+    Heap*        heap = nullptr;
+    byte const*  start = nullptr;
+    byte const*  end = nullptr;
+};
+static thread_local RegistryCache sRegistryCache;
+
+// Finds a Heap's entry in sKnownHeaps. Caller must hold the lock.
+static auto findRegistryEntry(Heap const* heap) {
+    auto [i, end] = sKnownHeaps.equal_range((byte const*)heap->base());
+    while (i != end && i->second.heap != heap)
+        ++i;
+    assert(i != end);
+    return i;
+}
+
+// The innermost Heap, starting with entry `i` and following its `parent` links, whose range
+// contains [start, end). Caller must hold the lock.
+static Heap* enclosingHeap(HeapRegistry::iterator i, byte const* start, byte const* end) {
+    while (true) {
+        if (i->first <= start && end <= i->second.end)
+            return i->second.heap;
+        else if (!i->second.parent)
+            return nullptr;
+        i = findRegistryEntry(i->second.parent);
+    }
+}
+
+// Adds a Heap to sKnownHeaps. Caller must hold the exclusive lock.
+static void addRegistryEntry(Heap *heap, byte const* base, byte const* end) {
+    // Find the enclosing Heap, starting from the last one whose base is <= ours:
+    Heap *parent = nullptr;
+    if (auto next = sKnownHeaps.upper_bound(base); next != sKnownHeaps.begin())
+        parent = enclosingHeap(std::prev(next), base, end);
+    // Heaps with the same base are ordered outermost first, so a lookup finds the innermost:
+    auto [pos, last] = sKnownHeaps.equal_range(base);
+    while (pos != last && pos->second.end >= end)
+        ++pos;
+    auto entry = sKnownHeaps.emplace_hint(pos, base, RegistryEntry{heap, end, parent});
+    // Heaps already in our range, whose parent was ours, are now nested in this one:
+    for (auto i = std::next(entry); i != sKnownHeaps.end() && i->first < end; ++i) {
+        if (i->second.parent == parent && i->second.end <= end)
+            i->second.parent = heap;
+    }
+}
+
+// Removes a Heap from sKnownHeaps. Caller must hold the exclusive lock.
+static void removeRegistryEntry(Heap const* heap) {
+    auto entry = findRegistryEntry(heap);
+    for (auto i = std::next(entry); i != sKnownHeaps.end() && i->first < entry->second.end; ++i) {
+        if (i->second.parent == heap)
+            i->second.parent = entry->second.parent;
+    }
+    sKnownHeaps.erase(entry);
+}
+
+// Allocates heap memory aligned to Block::kMaxAlignment, so aligned blocks have aligned addresses.
+static void* alignedMalloc(size_t capacity) {
+    constexpr size_t kAlign = Block::kMaxAlignment;
+    return ::aligned_alloc(kAlign, (capacity + kAlign - 1) & ~(kAlign - 1));
+}
 
 Heap::Heap(void *base, size_t capacity, bool malloced)
 :_base((byte*)base)
@@ -41,6 +133,7 @@ Heap::Heap(void *base, size_t capacity, bool malloced)
 
 Heap::~Heap() {
     assert(this != maybeCurrent());
+    if (_profiler) _profiler->_heap = nullptr;
     if (_malloced) free(_base);
     unregistr();
 }
@@ -48,7 +141,7 @@ Heap::~Heap() {
 
 Heap::Heap()                                    :_base(nullptr), _end(nullptr), _cur(nullptr) { }
 Heap::Heap(void *base, size_t cap) noexcept     :Heap(base, cap, false) {reset();}
-Heap::Heap(size_t cap)                          :Heap(::malloc(cap), cap, true) {reset();}
+Heap::Heap(size_t cap)                          :Heap(alignedMalloc(cap), cap, true) {reset();}
 Heap::Heap(const char *error)                   {_error = error;}
 
 Heap::Heap(Heap&& h) noexcept {
@@ -62,48 +155,100 @@ Heap& Heap::operator=(Heap&& h) noexcept {
     _cur = h._cur;
     _malloced = h._malloced;
     h._malloced = false;
-    registr();
+    _mayHaveSymbols = h._mayHaveSymbols;
+    _mayHavePadding = h._mayHavePadding;
+    _owner = h.owner();
     h.unregistr();
+    registr();
     _allocFailureHandler = h._allocFailureHandler;
     _symbolTable = std::move(h._symbolTable);
     if (_symbolTable) _symbolTable->setHeap(*this);    // <- this is the only non-default bit
+    _profiler = h._profiler;
+    h._profiler = nullptr;
+    if (_profiler) _profiler->_heap = this;
     _externalRootObjs = std::move(h._externalRootObjs);
     _externalRootVals = std::move(h._externalRootVals);
     return *this;
 }
 
 void Heap::swapMemoryWith(Heap &h) {
-    std::swap(_base, h._base);
-    std::swap(_end, h._end);
+    {
+        // Both heaps must already be in the registry; re-add them with their new ranges, which
+        // also updates the links of any heaps nested in them:
+        std::unique_lock lock(sRegistryMutex);
+        removeRegistryEntry(this);
+        removeRegistryEntry(&h);
+        std::swap(_base, h._base);
+        std::swap(_end, h._end);
+        addRegistryEntry(this, _base, _end);
+        addRegistryEntry(&h, h._base, h._end);
+        ++sRegistryGeneration;
+    }
     std::swap(_cur, h._cur);
     std::swap(_malloced, h._malloced);
+    std::swap(_mayHavePadding, h._mayHavePadding);
     // The symbolTable and root stay with the heap.
     // _allocFailureHandle and _externalRoots are not swapped, they belong to the Heap itself.
 }
 
-Heap const* Heap::enter() const         {auto prev = sCurHeap; sCurHeap = this; return prev;}
+Heap const* Heap::enter() const         {assertOwner(); auto prev = sCurHeap; sCurHeap = this; return prev;}
 void Heap::exit(Heap const* next) const {assert(sCurHeap == this); sCurHeap = (Heap*)next;}
 Heap* Heap::maybeCurrent()              {return (Heap*)sCurHeap;}
 Heap* Heap::current()                   {assert(sCurHeap); return (Heap*)sCurHeap;}
 
 
 void Heap::registr() {
-    if (_base)
-        sKnownHeaps.push_back(this);
+    if (_base) {
+        std::unique_lock lock(sRegistryMutex);
+        addRegistryEntry(this, _base, _end);
+        ++sRegistryGeneration;
+    }
 }
 
 void Heap::unregistr() {
     if (_base) {
-        sKnownHeaps.erase(std::find(sKnownHeaps.begin(), sKnownHeaps.end(), this));
+        std::unique_lock lock(sRegistryMutex);
+        removeRegistryEntry(this);
+        ++sRegistryGeneration;
         _base = nullptr;
     }
 }
 
 Heap* Heap::heapContaining(const void *ptr) {
-    for (Heap* h : sKnownHeaps)
-        if (h->contains(ptr))
-            return h;
-    return nullptr;
+    RegistryCache &cache = sRegistryCache;
+    if (cache.generation == sRegistryGeneration.load(std::memory_order_acquire)
+            && ptr >= cache.start && ptr < cache.end)
+        return cache.heap;
+
+    std::shared_lock lock(sRegistryMutex);
+    // Start at the last Heap whose base is <= ptr. If it doesn't contain ptr, ptr may be in the
+    // memory of a Heap it's nested in (e.g. `Heap::existing` on a Blob), so follow its parents:
+    auto next = sKnownHeaps.upper_bound((byte const*)ptr);
+    if (next == sKnownHeaps.begin())
+        return nullptr;
+    byte const* start = nullptr;
+    bool cacheable = true;
+    for (auto i = std::prev(next); ; i = findRegistryEntry(i->second.parent)) {
+        Heap *heap = i->second.heap;
+        if (heap->contains(ptr)) {
+            // The answer holds from past any nested Heaps below ptr, up to the next one above
+            // it or the end of the space allocated so far:
+            if (cacheable) {
+                start = std::max(start, i->first);
+                byte const* end = heap->_cur;
+                if (next != sKnownHeaps.end())
+                    end = std::min(end, next->first);
+                cache = {sRegistryGeneration.load(std::memory_order_relaxed), heap, start, end};
+            }
+            return heap;
+        }
+        if (ptr < i->second.end)
+            cacheable = false;      // ptr is in this Heap's free space, which it may yet allocate
+        else
+            start = std::max(start, i->second.end);
+        if (!i->second.parent)
+            return nullptr;
+    }
 }
 
 
@@ -112,16 +257,28 @@ bool Heap::resize(size_t newSize) {
         return false;
     if (_malloced && newSize > capacity())
         return false;
-    _end = _base + newSize;
+    if (_base) {
+        std::unique_lock lock(sRegistryMutex);
+        removeRegistryEntry(this);
+        _end = _base + newSize;
+        addRegistryEntry(this, _base, _end);
+        ++sRegistryGeneration;
+    } else {
+        _end = _base + newSize;
+    }
     return true;
 }
 
 
 void Heap::reset() {
+    assertOwner();
     _cur = _base;
+    ++sRegistryGeneration;      // (cached lookups may cover space that's no longer allocated)
     auto header = (Header*)rawAlloc(sizeof(Header));
     *header = {kMagic, nullpos, nullpos};
     _symbolTable.reset();
+    _mayHavePadding = false;
+    if (_profiler) _profiler->reset();
 }
 
 
@@ -131,6 +288,7 @@ Heap Heap::existing(slice<byte> contents, size_t capacity) {
     Heap heap(contents.begin(), capacity, false);
     heap._cur = contents.end();
     heap._mayHaveSymbols = true;
+    heap._mayHavePadding = true;
 
     auto header = heap.header();
     if (header.magic != kMagic)
@@ -159,11 +317,27 @@ heappos Heap::valueToPos(Value obj) const {
 }
 
 
+#pragma mark - THREADS:
+
+
+void Heap::transferTo(std::thread::id newOwner) {
+    assertOwner();
+    assert(sCurHeap != this);
+    _owner.store(newOwner, std::memory_order_release);
+}
+
+
+void Heap::acquire() {
+    __unused auto prevOwner = _owner.exchange(std::this_thread::get_id(), std::memory_order_acquire);
+    assert(prevOwner == std::thread::id());     // Heap must have been released
+}
+
+
 #pragma mark - ROOTS & SYMBOL TABLE:
 
 
 Maybe<Object> Heap::root() const                {return posToValue(header().root).maybeAs<Object>();}
-void Heap::setRoot(Maybe<Object> root)          {header().root = valueToPos(root);}
+void Heap::setRoot(Maybe<Object> root)          {assertOwner(); header().root = valueToPos(root);}
 Value Heap::symbolTableArray() const            {return posToValue(header().symbols);}
 void Heap::setSymbolTableArray(Value v)         {header().symbols = valueToPos(v);}
 
@@ -200,6 +374,18 @@ SymbolTable& Heap::symbolTable() {
 }
 
 
+SymbolTable const* Heap::existingSymbolTable() const {
+    if (!_symbolTable) {
+        // Loading the table from its Array doesn't allocate:
+        if_let(symbols, symbolTableArray().maybeAs<Array>()) {
+            Heap *self = const_cast<Heap*>(this);
+            self->_symbolTable = std::make_unique<SymbolTable>(self, symbols);
+        }
+    }
+    return _symbolTable.get();
+}
+
+
 void Heap::dropSymbolTable() {
     _symbolTable.reset();
     header().symbols = nullpos;
@@ -210,6 +396,7 @@ void Heap::dropSymbolTable() {
 
 
 void* Heap::rawAlloc(heapsize size) {
+    assertOwner();
     byte *result = _cur;
     byte *newCur = result + size;
     if (_likely(newCur <= _end)) {
@@ -225,20 +412,20 @@ void* Heap::rawAllocFailed(heapsize size) {
     auto avail = available();
     if (_allocFailureHandler) {
         while(true) {
-            std::cerr << "** Heap full: " << size << " bytes requested, only "
-                      << avail << " available";
-            if (_cannotGC)
-                std::cerr << ", CANNOT GC!";
-            std::cerr << " -- invoking failure handler **\n";
+            SMOL_LOG(HeapLog, Verbose, "Heap %p full: %u bytes requested, only %zu available%s"
+                     " -- invoking failure handler",
+                     (void*)this, size, avail, (_cannotGC ? " (cannot GC)" : ""));
             if (!_allocFailureHandler(this, size, !_cannotGC))
                 break;
             auto oldAvail = avail;
             avail = available();
             if (avail <= oldAvail) {
-                std::cerr << "** Failure handler was unable to increase free space!\n";
+                SMOL_LOG(HeapLog, Info, "Heap %p failure handler was unable to increase free space",
+                         (void*)this);
                 break;
             }
-            std::cerr << "** Heap failure handler freed up " << (avail-oldAvail) << " bytes.\n";
+            SMOL_LOG(HeapLog, Verbose, "Heap %p failure handler freed up %zu bytes",
+                     (void*)this, avail - oldAvail);
 
             // retry the alloc:
             byte *result = _cur;
@@ -249,8 +436,8 @@ void* Heap::rawAllocFailed(heapsize size) {
             }
         }
     }
-    std::cerr << "** Heap allocation failed: " << size << " bytes requested, only "
-              << avail << " available **\n";
+    SMOL_LOG(HeapLog, Info, "Heap %p allocation failed: %u bytes requested, only %zu available",
+             (void*)this, size, avail);
     return nullptr;
 }
 
@@ -264,10 +451,51 @@ void* Heap::alloc(heapsize size) {
 
 
 Block* Heap::allocBlock(heapsize size, Type type) {
-    if (void* addr = rawAlloc(Block::sizeForData(size)))
-        return new (addr) Block(size, type);
-    else
+    if (void* addr = rawAlloc(Block::sizeForData(size))) {
+        auto block = new (addr) Block(size, type);
+        if (_unlikely(_profiler != nullptr))
+            _profiler->allocated(block);
+        return block;
+    } else {
         return nullptr;
+    }
+}
+
+
+// The size of the Pad block needed before a block of `size` placed at `addr`, to align its data.
+heapsize Heap::padSize(const void *addr, heapsize size, heapsize alignment) const {
+    // The Pad must be at least kMinBlockSize, so find the first aligned data position past that:
+    heapsize headerSize = (size >= Block::LargeSize) ? 4 : 2;
+    uintpos dataPos = uintpos(_pos(addr)) + Block::kMinBlockSize + headerSize;
+    dataPos = (dataPos + alignment - 1) & ~uintpos(alignment - 1);
+    return heapsize(dataPos - headerSize - uintpos(_pos(addr)));
+}
+
+
+Block* Heap::allocBlock(heapsize size, Type type, heapsize alignment) {
+    assert(alignment >= Block::kMinAlignment && alignment <= Block::kMaxAlignment);
+    assert(std::has_single_bit(alignment));
+    heapsize blockSize = Block::sizeForData(size);
+    byte* start = _cur;
+    if (_unlikely(available() < padSize(start, size, alignment) + blockSize)) {
+        // Let rawAlloc invoke the failure handler. That may GC and move `_cur`, so ask for the
+        // worst case, a Pad of `alignment + 3` bytes, then give back what isn't needed.
+        start = (byte*)rawAlloc(Block::kMinBlockSize + alignment - 1 + blockSize);
+        if (!start)
+            return nullptr;
+    }
+    heapsize pad = padSize(start, size, alignment);
+    auto padBlock = new (start) Block(pad - 2, Type::Pad);
+    padBlock->fill(slice<byte>{});
+    padBlock->data()[0] = byte(std::countr_zero(alignment));
+    _mayHavePadding = true;
+
+    auto addr = start + pad;
+    _cur = addr + blockSize;
+    auto block = new (addr) Block(size, type);
+    if (_unlikely(_profiler != nullptr))
+        _profiler->allocated(block);
+    return block;
 }
 
 
@@ -305,6 +533,111 @@ Block* Heap::reallocBlock(Block* block, heapsize newDataSize) {
 }
 
 
+#pragma mark - SPLICING:
+
+
+// Re-sorts a Dict's entries by their keys' Symbol IDs. (This can't use `std::sort` on the entries
+// themselves, because it would move some into temporaries on the stack, out of reach of a Val.)
+static void resortDict(Block *dictBlock) {
+    slice<Val> vals = dictBlock->usedVals();
+    std::vector<std::tuple<Symbol::ID,Value,Value>> entries;
+    entries.reserve(vals.size() / 2);
+    for (size_t i = 0; i < vals.size(); i += 2) {
+        Value key = vals[i];
+        entries.emplace_back(key.as<Symbol>().id(), key, vals[i + 1]);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](auto &a, auto &b) {return std::get<0>(a) < std::get<0>(b);});
+    for (size_t i = 0; i < vals.size(); i += 2) {
+        vals[i]     = std::get<1>(entries[i / 2]);
+        vals[i + 1] = std::get<2>(entries[i / 2]);
+    }
+}
+
+
+Maybe<Object> Heap::splice(Heap const& message) {
+    assert(&message != this);
+    heappos srcRoot = message.header().root;
+    if (srcRoot == nullpos)
+        return nullvalue;
+    auto src = (byte const*)message.firstBlock();
+    heapsize size = heapsize(message._cur - src);
+
+    // If the message has aligned blocks, its blocks have to stay at the same offsets modulo
+    // kMaxAlignment, so put a filler block before them; it's garbage. (Ask rawAlloc for the
+    // worst case, since its failure handler may GC and move `_cur`; then give back the rest.)
+    byte *dst;
+    if (message._mayHavePadding) {
+        dst = (byte*)rawAlloc(size + Block::kMaxAlignment + Block::kMinBlockSize - 1);
+        if (!dst)
+            return nullvalue;
+        auto gap = heapsize(uintpos(message._pos(src)) - uintpos(_pos(dst))) % Block::kMaxAlignment;
+        if (gap > 0 && gap < Block::kMinBlockSize)
+            gap += Block::kMaxAlignment;
+        if (gap > 0) {
+            new (dst) Block(gap - 2, Type::Blob);
+            dst += gap;
+        }
+        _cur = dst + size;
+        _mayHavePadding = true;
+    } else {
+        dst = (byte*)rawAlloc(size);
+        if (!dst)
+            return nullvalue;
+    }
+
+    // Vals are relative, so the copied blocks point to each other just as the originals did:
+    ::memcpy(dst, src, size);
+    auto relocate = [&](heappos pos) {return (Block*)(dst + (uintpos(pos) - sizeof(Header)));};
+    auto root = relocate(srcRoot);
+
+    if (message._mayHaveSymbols) {
+        // The copied Symbols have the message's IDs and aren't in my SymbolTable. Turn them
+        // into garbage Blobs, and point references to them at my own equivalent Symbols:
+        bool ok = true;
+        preventGCDuring([&]{
+            std::unordered_map<Block const*, Block const*> symbols;
+            byte *end = dst + size;
+            for (auto b = (Block*)dst; (byte*)b < end; b = b->nextBlock()) {
+                if (b->type() == Type::Symbol) {
+                    auto name = Value(b).as<Symbol>().str();
+                    Maybe<Symbol> sym = symbolTable().create(name);
+                    if (!sym) {
+                        ok = false;
+                        return;
+                    }
+                    symbols.emplace(b, sym.value().block());
+                    new (b) Block(b->dataSize(), Type::Blob);
+                }
+            }
+            if (symbols.empty())
+                return;
+            for (auto b = (Block*)dst; (byte*)b < end; b = b->nextBlock()) {
+                if (b->type() == Type::Blob || !b->containsVals())
+                    continue;
+                for (Val &val : b->usedVals()) {
+                    if (auto i = symbols.find(val.block()); i != symbols.end())
+                        val = i->second;
+                }
+                if (b->type() == Type::Dict)
+                    resortDict(b);      // Its keys' new IDs may be in a different order
+            }
+            if (auto i = symbols.find(root); i != symbols.end())
+                root = (Block*)i->second;
+        });
+        if (!ok) {
+            // Finish disabling the remaining copied Symbols, so they can't be mistaken for mine:
+            for (auto b = (Block*)dst; (byte*)b < dst + size; b = b->nextBlock()) {
+                if (b->type() == Type::Symbol)
+                    new (b) Block(b->dataSize(), Type::Blob);
+            }
+            return nullvalue;
+        }
+    }
+    return Value(root).as<Object>();
+}
+
+
 #pragma mark - ITERATION / VISITING:
 
 
@@ -366,7 +699,7 @@ void Heap::visitBlocks(BlockVisitor visitor) {
         while (!stack.empty()) {
             Block *b = stack.front();
             stack.pop_front();
-            for (Val const& val : b->vals()) {
+            for (Val const& val : b->usedVals()) {
                 if (Block *block = val.block(); block && !processBlock(block))
                     return;
             }
@@ -408,13 +741,17 @@ const char* Heap::_validate() const {
         // Examine each block:
         Block const* next;
         for (auto block = first; block < (void*)_cur; block = next) {
-            // Validate block header:
-            if (const char* error = block->validate(); error)
-                return error;
-            // Validate size:
+            // Validate size, before looking at the contents:
+            if ((byte*)block + Block::kMinBlockSize > _cur)
+                return "block overflows end of heap";
+            if (block->isForwarded())
+                return "a block is forwarded";
             next = block->nextBlock();
             if (next > (void*)_cur)
                 return "block overflows end of heap";
+            // Validate block header:
+            if (const char* error = block->validate(); error)
+                return error;
 
             // See if this block resolves a forward ref:
             if (auto blockPos = _pos(block); blockPos >= nextFwdRef) {
@@ -469,6 +806,36 @@ const char* Heap::_validate() const {
     }
 
     if (!forwardRefs.empty()) return "there are bad (forward) pointers within the heap";
+
+    // Now that all pointers are known to be good, check that none point to Pad blocks,
+    // and that Dict keys are Symbols, sorted by ID:
+    if (_mayHavePadding) {
+        for (heappos pos : {hdr.root, hdr.symbols}) {
+            if (pos != nullpos && ((Block const*)at(pos))->type() == Type::Pad)
+                return "a root points to a Pad block";
+        }
+    }
+    for (auto block = first; block && block < (void*)_cur; block = block->nextBlock()) {
+        if (_mayHavePadding) {
+            for (Val const& val : block->vals()) {
+                if (auto ptr = val.block(); ptr && ptr->type() == Type::Pad)
+                    return "a pointer points to a Pad block";
+            }
+        }
+        if (block->type() != Type::Dict)
+            continue;
+        int prevID = -1;
+        slice<Val> entries = block->vals();
+        for (auto key = entries.begin(); key < entries.end() && !key->isNull(); key += 2) {
+            Block const* keyBlock = key->block();
+            if (keyBlock->type() != Type::Symbol)
+                return "a Dict key is not a Symbol";
+            int id = int(Value(keyBlock).as<Symbol>().id());
+            if (id <= prevID || id == int(Symbol::ID::None))
+                return "a Dict's keys are out of order";
+            prevID = id;
+        }
+    }
     //std::cout << "Validation complete. There were max " << maxForwards << " forward refs being tracked.\n";
     return nullptr;
 }
@@ -476,14 +843,21 @@ const char* Heap::_validate() const {
 bool Heap::validate() const {
     if (const char* error = _validate()) {
         _error = error;
-        std::cerr << "INVALID HEAP: " << error << std::endl;
+        SMOL_LOG(HeapLog, Error, "Invalid heap %p: %s", (void*)this, error);
         return false;
     }
     return true;
 }
 
 
-void Heap::dump(std::ostream &out) {
+void Heap::dump(std::ostream &out, bool listBlocks) {
+    HeapCensus(*this).write(out);
+    if (listBlocks)
+        dumpBlocks(out);
+}
+
+
+void Heap::dumpBlocks(std::ostream &out) {
     auto writeAddr = [&](const void *addr) -> std::ostream& {
         return out << addr << std::showpos << std::setw(8) << intpos(pos(addr))
         << std::noshowpos << " | ";
@@ -505,15 +879,10 @@ void Heap::dump(std::ostream &out) {
         return true;
     });
 
-    unsigned blocks = 0;
-    unsigned byType[16] = {};
-    unsigned sizeByType[16] = {};
     unsigned fwdLinks = 0, backLinks = 0;
     intpos biggestPtr = 0;
     heappos biggestPtrAt = nullpos;
 
-    std::unordered_map<std::string_view,unsigned> strings;
-
     writeAddr(_base) << "--- HEAP BASE ---\n";
     bool ok = visitAll([&](Block const& block) {
         writeAddr(&block);
@@ -528,8 +897,6 @@ void Heap::dump(std::ostream &out) {
                 std::string_view str = val.as<String>().str();
                 out << "“" << str.substr(0, std::min(str.size(),size_t(50)))
                     << (str.size() <= 50 ? "”" : "……");
-                auto [i, isNew] = strings.insert({str, 0});
-                i->second++;
                 break;
             }
             case Type::Array:   out << "Array[" << val.as<Array>().size() << "]"; break;
@@ -537,13 +904,10 @@ void Heap::dump(std::ostream &out) {
                                     << " / " << val.as<Vector>().capacity() << "]"; break;
             case Type::Dict:    out << "Dict[" << val.as<Dict>().size() << " / "
                                     << val.as<Dict>().capacity() << "]"; break;
+            case Type::Pad:     out << "(pad to " << block.padAlignment() << ")"; break;
             default:            out << val; break;
         }
 
-        ++blocks;
-        ++byType[int(val.type())];
-        sizeByType[int(val.type())] += block.blockSize();
-
         for (auto& val : block.vals()) {
             if (auto dstBlock = val.block(); dstBlock) {
                 if (dstBlock < &block)
@@ -573,22 +937,7 @@ void Heap::dump(std::ostream &out) {
     if (!ok)
         return; // bad heap
     writeAddr(_cur) << "--- cur ---\n";
-    writeAddr(_end) << "--- HEAP END ---\n" << blocks << " blocks:";
-
-    for (int t = 0; t < 16; t++) {
-        if (byType[t])
-            out << "  " << byType[t] << " " << TypeName(Type(t)) << "s (" << sizeByType[t] << " b)";
-    }
-    out << "\n";
-
-    size_t stringSize = 0, wasted = 0;
-    for (auto [str,count] : strings) {
-        if (count > 1 ) out << "\t'" << str << "' x " << count << std::endl;
-        stringSize += str.size() + 2;
-        wasted += (count - 1) * str.size();
-    }
-    out << strings.size() << " unique strings, " << stringSize << " bytes; dups waste " << wasted << " bytes\n";
-
+    writeAddr(_end) << "--- HEAP END ---\n";
     out << fwdLinks << " forward pointers, " << backLinks << " backward pointers.\n";
     out << "Farthest pointer is " << biggestPtr << " bytes, at " << uintpos(biggestPtrAt) << ".\n";
 }
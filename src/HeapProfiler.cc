@@ -0,0 +1,277 @@
+//
+// HeapProfiler.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "HeapProfiler.hh"
+#include "Collections.hh"
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string_view>
+#include <unordered_set>
+
+#if __has_include(<execinfo.h>) && __has_include(<dlfcn.h>)
+    #include <execinfo.h>
+    #include <dlfcn.h>
+    #include <cxxabi.h>
+    #define HAVE_BACKTRACE 1
+#endif
+
+namespace snej::smol {
+
+using namespace std;
+
+
+#pragma mark - PROFILER:
+
+
+static thread_local const char* sCurTag;
+
+
+HeapProfiler::Tag::Tag(const char *name)    :_prevTag(sCurTag) {sCurTag = name;}
+HeapProfiler::Tag::~Tag()                   {sCurTag = _prevTag;}
+
+
+HeapProfiler::HeapProfiler(Heap &heap, size_t sampleInterval)
+:_heap(&heap)
+,_interval(std::max(sampleInterval, size_t(1)))
+,_countdown(intptr_t(_interval))
+{
+    assert(!heap._profiler);
+    heap._profiler = this;
+}
+
+
+HeapProfiler::~HeapProfiler() {
+    if (_heap)
+        _heap->_profiler = nullptr;
+}
+
+
+void HeapProfiler::takeSample(Block const* block) {
+    // A big allocation may span several intervals; weight the sample accordingly:
+    size_t n = 1 + size_t(-_countdown) / _interval;
+    _countdown += intptr_t(n * _interval);
+
+    Sample sample {_heap->pos(block), block->type(), block->dataSize(), n * _interval, sCurTag};
+#if HAVE_BACKTRACE
+    if (_captureBacktraces && !sample.tag) {
+        // Skip this function and Heap::allocBlock:
+        void* frames[kMaxFrames + 2];
+        int nFrames = ::backtrace(frames, kMaxFrames + 2) - 2;
+        if (nFrames > 0) {
+            std::copy(&frames[2], &frames[2 + nFrames], sample.frames);
+            sample.nFrames = uint8_t(nFrames);
+        }
+    }
+#endif
+    _samples.push_back(sample);
+}
+
+
+// Called by the GarbageCollector just before it swaps the heaps' memory. Surviving blocks have
+// been replaced by forwarding addresses, which are their positions after the swap.
+void HeapProfiler::collected(Heap const& fromHeap) {
+    std::erase_if(_samples, [&](Sample &sample) {
+        auto block = (Block const*)((byte const*)fromHeap.base() + uintpos(sample.pos));
+        if (!block->isForwarded())
+            return true;
+        sample.pos = block->forwardingAddress();
+        return false;
+    });
+}
+
+
+size_t HeapProfiler::liveBytes() const {
+    size_t total = 0;
+    for (auto &sample : _samples)
+        total += sample.weight;
+    return total;
+}
+
+
+string HeapProfiler::siteName(Sample const& sample) const {
+    if (sample.tag)
+        return sample.tag;
+    if (sample.nFrames == 0)
+        return "?";
+    stringstream out;
+#if HAVE_BACKTRACE
+    for (unsigned i = 0; i < sample.nFrames && i < 3; ++i) {
+        if (i > 0)
+            out << " < ";
+        Dl_info info;
+        if (::dladdr(sample.frames[i], &info) && info.dli_sname) {
+            int status;
+            char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            out << (demangled ? demangled : info.dli_sname);
+            free(demangled);
+        } else {
+            out << sample.frames[i];
+        }
+    }
+#endif
+    return out.str();
+}
+
+
+vector<HeapProfiler::Site> HeapProfiler::liveSites() const {
+    map<pair<string,Type>, Site> sites;
+    for (auto &sample : _samples) {
+        string name = siteName(sample);
+        auto [i, _] = sites.try_emplace({name, sample.type}, Site{name, sample.type, 0, 0});
+        i->second.samples++;
+        i->second.bytes += sample.weight;
+    }
+    vector<Site> result;
+    result.reserve(sites.size());
+    for (auto &[key, site] : sites)
+        result.push_back(std::move(site));
+    std::sort(result.begin(), result.end(), [](Site const& a, Site const& b) {
+        return a.bytes > b.bytes;
+    });
+    return result;
+}
+
+
+void HeapProfiler::dump(std::ostream &out) const {
+    out << "Heap profile: ~" << liveBytes() << " live bytes in " << _samples.size()
+        << " samples (1 per " << _interval << " bytes)\n";
+    out << "     bytes  samples  type    site\n" << setfill(' ');
+    for (auto &site : liveSites()) {
+        out << setw(10) << site.bytes << ' ' << setw(8) << site.samples << "  "
+            << left << setw(7) << TypeName(site.type) << right << ' ' << site.name << '\n';
+    }
+}
+
+
+#pragma mark - CENSUS:
+
+
+HeapCensus::HeapCensus(Heap &heap) {
+    // First walk the object graph to set the "visited" flag on live objects:
+    heap.visitBlocks([](Block const&) {return true;});
+
+    unordered_set<string_view> strings;
+    heap.visitAll([&](Block const& block) {
+        size_t size = block.blockSize();
+        TypeStats &stats = byType[int(block.type())];
+        if (block.isVisited()) {
+            live.count++;
+            live.bytes += size;
+            stats.live.count++;
+            stats.live.bytes += size;
+            headerBytes += size - block.dataSize();
+            sizeHistogram[std::bit_width(size) - 1]++;
+            if (block.dataSize() >= Block::LargeSize)
+                largeHeaderCount++;
+
+            switch (Value val(&block); val.type()) {
+                case Type::String:
+                    if (!strings.insert(val.as<String>().str()).second) {
+                        duplicateStrings.count++;
+                        duplicateStrings.bytes += size;
+                    }
+                    break;
+                case Type::Vector: {
+                    Vector vec = val.as<Vector>();
+                    unusedVectorBytes += (vec.capacity() - vec.size()) * sizeof(Val);
+                    break;
+                }
+                case Type::Dict: {
+                    Dict dict = val.as<Dict>();
+                    unusedDictBytes += (dict.capacity() - dict.size()) * sizeof(DictEntry);
+                    break;
+                }
+                default:
+                    break;
+            }
+        } else {
+            dead.count++;
+            dead.bytes += size;
+            stats.dead.count++;
+            stats.dead.bytes += size;
+        }
+        return true;
+    });
+    uniqueStrings = strings.size();
+}
+
+
+void HeapCensus::write(std::ostream &out) const {
+    out << "Live: " << live.count << " blocks, " << live.bytes << " bytes;  "
+        << "Dead: " << dead.count << " blocks, " << dead.bytes << " bytes\n";
+    out << "type       live#    live bytes    dead#    dead bytes\n" << setfill(' ');
+    for (int t = 0; t < 16; ++t) {
+        auto &stats = byType[t];
+        if (stats.live.count == 0 && stats.dead.count == 0)
+            continue;
+        out << left << setw(7) << TypeName(Type(t)) << right
+            << setw(9) << stats.live.count << setw(14) << stats.live.bytes
+            << setw(9) << stats.dead.count << setw(14) << stats.dead.bytes << '\n';
+    }
+    out << "Header overhead: " << headerBytes << " bytes, " << fixed << setprecision(1)
+        << 100.0 * headerOverhead() << defaultfloat << "% of live bytes\n";
+    out << "Large headers: " << largeHeaderCount << " blocks, " << fixed << setprecision(1)
+        << 100.0 * largeHeaderFraction() << defaultfloat << "% of live blocks\n";
+    out << "Live block sizes:";
+    for (size_t i = 0; i < kHistogramSize; ++i) {
+        if (sizeHistogram[i])
+            out << "  " << (size_t(1) << i) << "+: " << sizeHistogram[i];
+    }
+    out << '\n';
+    out << "Unused capacity: " << unusedVectorBytes << " bytes in Vectors, "
+        << unusedDictBytes << " bytes in Dicts\n";
+    out << uniqueStrings << " unique strings; " << duplicateStrings.count << " duplicates use "
+        << duplicateStrings.bytes << " bytes\n";
+}
+
+
+void HeapCensus::writeJSON(std::ostream &out) const {
+    auto totals = [&](Totals const& t) -> std::ostream& {
+        return out << "{\"count\":" << t.count << ",\"bytes\":" << t.bytes << "}";
+    };
+    out << "{\"live\":";          totals(live);
+    out << ",\"dead\":";          totals(dead);
+    out << ",\"types\":{";
+    bool first = true;
+    for (int t = 0; t < 16; ++t) {
+        auto &stats = byType[t];
+        if (stats.live.count == 0 && stats.dead.count == 0)
+            continue;
+        if (!first) out << ',';
+        first = false;
+        out << '"' << TypeName(Type(t)) << "\":{\"live\":";
+        totals(stats.live) << ",\"dead\":";
+        totals(stats.dead) << '}';
+    }
+    out << "},\"headerBytes\":" << headerBytes
+        << ",\"largeHeaders\":" << largeHeaderCount
+        << ",\"sizeHistogram\":[";
+    for (size_t i = 0; i < kHistogramSize; ++i)
+        out << (i ? "," : "") << sizeHistogram[i];
+    out << "],\"unusedVectorBytes\":" << unusedVectorBytes
+        << ",\"unusedDictBytes\":" << unusedDictBytes
+        << ",\"uniqueStrings\":" << uniqueStrings
+        << ",\"duplicateStrings\":";
+    totals(duplicateStrings) << "}";
+}
+
+}
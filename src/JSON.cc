@@ -18,8 +18,10 @@
 
 #include "JSON.hh"
 #include "HashTable.hh"
+#include "PerfCounters.hh"
 #include <deque>
 #include <iostream>
+#include <map>
 #include "rapidjson/error/en.h"
 #include "rapidjson/reader.h"
 #include "rapidjson/writer.h"
@@ -29,6 +31,65 @@ namespace snej::smol {
 using namespace std;
 
 
+#pragma mark - PROJECTION:
+
+
+/// A node in a JSONProjection's tree of paths, denoting a selected value.
+struct JSONProjection::Node {
+    map<string, unique_ptr<Node>, less<>> children;   // Keys (or indexes) selected under it
+    unique_ptr<Node>    any;                            // `*`
+    bool                all = false;                    // Everything under it is selected
+    bool                hasIndexes = false;             // Some `children` keys are numbers
+
+    /// The node for a member of an object, or null if it's not selected.
+    Node const* child(string_view key) const {
+        if (all)
+            return this;
+        if (auto i = children.find(key); i != children.end())
+            return i->second.get();
+        return any.get();
+    }
+
+    /// The node for an item of an array, or null if it's not selected.
+    Node const* childAt(uint32_t index) const {
+        if (all)
+            return this;
+        if (hasIndexes) {
+            if (auto i = children.find(to_string(index)); i != children.end())
+                return i->second.get();
+        }
+        return any.get();
+    }
+};
+
+
+JSONProjection::JSONProjection()    :_root(make_unique<Node>()) { }
+JSONProjection::~JSONProjection()   = default;
+
+JSONProjection::JSONProjection(initializer_list<string_view> paths)
+:JSONProjection()
+{
+    for (string_view path : paths)
+        add(path);
+}
+
+void JSONProjection::add(string_view path) {
+    Node *node = _root.get();
+    while (!path.empty()) {
+        auto dot = path.find('.');
+        string_view key = path.substr(0, dot);
+        path = (dot == string_view::npos) ? string_view() : path.substr(dot + 1);
+        unique_ptr<Node> &child = (key == "*") ? node->any : node->children[string(key)];
+        if (!child)
+            child = make_unique<Node>();
+        if (!key.empty() && key.find_first_not_of("0123456789") == string_view::npos)
+            node->hasIndexes = true;
+        node = child.get();
+    }
+    node->all = true;
+}
+
+
 #pragma mark - PARSING JSON:
 
 
@@ -41,9 +102,10 @@ class JSONParseHandler {
 public:
     static constexpr size_t kMaxStringDedupSize = 0;//TEMP 16;
 
-    JSONParseHandler(Heap &h)
+    JSONParseHandler(Heap &h, JSONProjection const* projection = nullptr)
     :_heap(h)
     ,_root(h)
+    ,_projection(projection)
     ,_emptyArray(h)
     ,_strings(h, 100)
     { }
@@ -54,17 +116,19 @@ public:
 
     Value root()            {return _root;}
 
-    bool Null()             { return addValue(nullishvalue); }
-    bool Bool(bool b)       { return addValue(smol::Bool(b)); }
-    bool Int(int i)         { return addNumber(i); }
-    bool Uint(unsigned u)   { return addNumber(u); }
-    bool Int64(int64_t i)   { return addNumber(i); }
-    bool Uint64(uint64_t u) { return addNumber(u); }
-    bool Double(double d)   { return addNumber(d); }
+    bool Null()             { return skipScalar() || addValue(nullishvalue); }
+    bool Bool(bool b)       { return skipScalar() || addValue(smol::Bool(b)); }
+    bool Int(int i)         { return skipScalar() || addNumber(i); }
+    bool Uint(unsigned u)   { return skipScalar() || addNumber(u); }
+    bool Int64(int64_t i)   { return skipScalar() || addNumber(i); }
+    bool Uint64(uint64_t u) { return skipScalar() || addNumber(u); }
+    bool Double(double d)   { return skipScalar() || addNumber(d); }
 
     bool RawNumber(const char*, rapidjson::SizeType, bool /*copy*/) {return false;}
 
     bool String(const char* str, rapidjson::SizeType length, bool /*copy*/) {
+        if (skipScalar())
+            return true;
         ++_numStrings;
         Value string;
         if (length <= kMaxStringDedupSize) {
@@ -79,12 +143,24 @@ public:
     }
 
     bool StartArray() {
+        if (skip()) {
+            ++_skipDepth;
+            return true;
+        }
         unless(vec, newVector(4, _heap)) {return false;}
-        _stack.emplace_back(vec);
+        _stack.emplace_back(vec, _heap);
+        if (_projection)
+            _frames.push_back({_node, 0});
         return true;
     }
     bool EndArray(rapidjson::SizeType /*elementCount*/) {
-        Handle<Vector> vec = _stack.back().as<Vector>();
+        if (_skipDepth > 0) {
+            --_skipDepth;
+            return true;
+        }
+        if (_projection)
+            _frames.pop_back();
+        Handle<Vector> vec = _stack.back().value();
         _stack.pop_back();
         if (vec.empty()) {
             // Empty arrays are common in JS; use a singleton to save room.
@@ -99,41 +175,132 @@ public:
         }
     }
 
+    // An object's keys and values are saved up until its end, when its Dict can be allocated
+    // at the right size and its keys interned as a batch, which is faster for wide objects.
     bool StartObject() {
-        unless(dict, newDict(4, _heap)) {return false;}
-        _stack.emplace_back(dict);
+        if (skip()) {
+            ++_skipDepth;
+            return true;
+        }
+        _stack.emplace_back(_heap);                     // a null entry denotes an object
+        if (_projection)
+            _frames.push_back({_node, 0});
         return true;
     }
 
     bool Key(const char* str, rapidjson::SizeType length, bool /*copy*/) {
-        unless(key, newSymbol({str, length}, _heap)) {return false;}
-        _keys.push_back(key);
+        if (_projection) {
+            if (_skipDepth > 0)
+                return true;
+            // Look up the member's node; if it's not selected, its value will be skipped:
+            _keyNode = _frames.back().node->child({str, length});
+            if (!_keyNode)
+                return true;
+        }
+        _keyChars.append(str, length);
+        _keyEnds.push_back(uint32_t(_keyChars.size()));
         return true;
     }
 
-    bool EndObject(rapidjson::SizeType /*memberCount*/) {
-        Handle<Dict> dict = _stack.back().as<Dict>();
+    bool EndObject(rapidjson::SizeType memberCount) {
+        if (_projection) {
+            if (_skipDepth > 0) {
+                --_skipDepth;
+                return true;
+            }
+            memberCount = _frames.back().count;        // only the selected members
+            _frames.pop_back();
+        }
+        assert(!_stack.back() && _keyEnds.size() >= memberCount && _members.size() >= memberCount);
         _stack.pop_back();
+        unless(newdict, newDict(memberCount, _heap)) {return false;}
+        Handle<Dict> dict(newdict, _heap);
+
+        size_t firstKey = _keyEnds.size() - memberCount;
+        size_t firstMember = _members.size() - memberCount;
+        uint32_t keysStart = firstKey ? _keyEnds[firstKey - 1] : 0;
+        _keyStrs.clear();
+        uint32_t start = keysStart;
+        for (size_t k = firstKey; k < _keyEnds.size(); ++k) {
+            _keyStrs.emplace_back(&_keyChars[start], _keyEnds[k] - start);
+            start = _keyEnds[k];
+        }
+        _keySymbols.assign(memberCount, Maybe<Symbol>());
+
+        if (_heap.symbolTable().createBatch({_keyStrs.data(), _keyStrs.size()},
+                                            {_keySymbols.data(), _keySymbols.size()})) {
+            // There's been no GC since the Symbols were created, and inserting into a Dict
+            // with room doesn't allocate, so the Symbols are still valid:
+            for (size_t i = 0; i < memberCount; ++i) {
+                if (!dict.insert(_keySymbols[i].value(), _members[firstMember + i]))
+                    return false;       // duplicate key
+            }
+        } else {
+            // The heap filled up without GC; create the Symbols one at a time, allowing GC:
+            for (size_t i = 0; i < memberCount; ++i) {
+                unless(key, newSymbol(_keyStrs[i], _heap)) {return false;}
+                if (!dict.insert(key, _members[firstMember + i]))
+                    return false;
+            }
+        }
+
+        _keyEnds.resize(firstKey);
+        _keyChars.resize(keysStart);
+        while (_members.size() > firstMember)
+            _members.pop_back();
         return addValue(dict);
     }
 
 private:
+    // Called at the start of every value. Returns true if it's not selected by the projection,
+    // so no objects should be created for it; else sets `_node` to its projection node.
+    bool skip() {
+        return _projection && skipProjected();
+    }
+
+    // A scalar is only selected if a path ends at it (or above it); except the root, so that
+    // the result isn't null.
+    bool skipScalar() {
+        if (!_projection)
+            return false;
+        else if (skipProjected())
+            return true;
+        else if (_node->all || _frames.empty())
+            return false;
+        if (!_stack.back()) {
+            // It's an object member, so forget its key:
+            _keyEnds.pop_back();
+            _keyChars.resize(_keyEnds.empty() ? 0 : _keyEnds.back());
+        }
+        return true;
+    }
+
+    bool skipProjected() {
+        if (_skipDepth > 0) {
+            return true;
+        } else if (_frames.empty()) {
+            _node = &_projection->root();
+        } else if (_stack.back()) {
+            ProjectionFrame &frame = _frames.back();    // in an array
+            _node = frame.node->childAt(frame.count++);
+        } else {
+            _node = _keyNode;                           // in an object; see `Key`
+        }
+        return _node == nullptr;
+    }
+
     bool addValue(Value val) {
         if (!val) {
             return false;
         } else if (_stack.empty()) {
             assert(!_root);
             _root = val;
+        } else if_let (vec, _stack.back()) {
+            return append(vec, val);
         } else {
-            Object obj = _stack.back();
-            if_let (vec, obj.maybeAs<Vector>()) {
-                return append(vec, val);
-            } else {
-                assert(!_keys.empty());
-                auto key = _keys.back();
-                _keys.pop_back();
-                return insert(obj.as<Dict>(), key, val);
-            }
+            _members.emplace_back(val, _heap);
+            if (_projection)
+                ++_frames.back().count;                 // count the object's selected members
         }
         return true;
     }
@@ -154,33 +321,35 @@ private:
         return true;
     }
 
-    bool insert(Dict dict, Symbol key, Value val) {
-        Handle dictHandle(&dict);   // in case grow() triggers GC
-        Handle keyHandle(&key);   // in case grow() triggers GC
-        Handle valHandle(&val);
-        if (!dict.insert(key, val)) {
-            unless(newDict, _heap.grow(dict, grow(dict.capacity()))) {return false;}
-            if (!newDict.insert(key, val))
-                return false;
-            _stack.back() = newDict;
-        }
-        return true;
-    }
-
     Heap& _heap;
     Handle<Value> _root;
-    deque<Handle<Object>> _stack;
-    deque<Handle<Symbol>> _keys;
+    deque<Handle<Maybe<Vector>>> _stack;    // Open arrays; null for an open object
+    deque<Handle<Value>> _members;          // Values of open objects' members
+    string _keyChars;                       // Keys of open objects' members, concatenated
+    vector<uint32_t> _keyEnds;              // End of each key in `_keyChars`
+    vector<string_view> _keyStrs;           // Scratch space for EndObject
+    vector<Maybe<Symbol>> _keySymbols;      // Scratch space for EndObject
+
+    // Projection state: each open container's node, and its number of items or selected keys.
+    struct ProjectionFrame {JSONProjection::Node const* node; uint32_t count;};
+    JSONProjection const*       _projection;
+    vector<ProjectionFrame>     _frames;
+    JSONProjection::Node const* _node = nullptr;    // Node of the current value
+    JSONProjection::Node const* _keyNode = nullptr; // Node of the current object member
+    unsigned                    _skipDepth = 0;     // Nesting depth inside a skipped value
     Handle<Maybe<Array>> _emptyArray;
     HashSet _strings;
     unsigned _numStrings = 0, _numShortStrings = 0;
 };
 
-Value newFromJSON(string const& json, Heap &heap, string* outError) {
+static Value parseJSON(string const& json, Heap &heap, JSONProjection const* projection,
+                       string* outError)
+{
+    PerfScope perf(JSONParsePerf);
     UsingHeap u(heap);
     rapidjson::StringStream in(json.c_str());
     rapidjson::Reader reader;
-    JSONParseHandler handler(heap);
+    JSONParseHandler handler(heap, projection);
     auto result = reader.Parse(in, handler);
     if (result.IsError()) {
         if (outError)
@@ -191,8 +360,22 @@ Value newFromJSON(string const& json, Heap &heap, string* outError) {
     }
 }
 
+Value newFromJSON(string const& json, Heap &heap, string* outError) {
+    return parseJSON(json, heap, nullptr, outError);
+}
+
 Value newFromJSON(string_view json, Heap &heap, string* outError) {
-    return newFromJSON(string(json), heap, outError);
+    return parseJSON(string(json), heap, nullptr, outError);
+}
+
+Value newFromJSON(string const& json, Heap &heap, JSONProjection const& projection,
+                  string* outError) {
+    return parseJSON(json, heap, &projection, outError);
+}
+
+Value newFromJSON(string_view json, Heap &heap, JSONProjection const& projection,
+                  string* outError) {
+    return parseJSON(string(json), heap, &projection, outError);
 }
 
 
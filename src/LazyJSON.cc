@@ -0,0 +1,686 @@
+//
+// LazyJSON.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "LazyJSON.hh"
+#include "JSON.hh"
+#include "SymbolTable.hh"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include "rapidjson/error/en.h"
+#include "rapidjson/reader.h"
+
+namespace snej::smol {
+using namespace std;
+
+namespace wy {
+#include "wyhash32.h"
+}
+
+
+// Indexes of the items in the persistent Array:
+enum {kJSONIndex, kIndexIndex, kCacheIndex, kArraySize};
+
+
+// The index is a Blob of 32-bit words: one per scalar or key, holding its offset in the JSON.
+// An object or array has two words for its opening bracket -- its offset, then the index of its
+// closing bracket -- then its contents, then two for its closing bracket: its offset, then the
+// container's ordinal, its slot in the cache. (Scalars' lengths aren't stored; they're cheap to
+// find from the text.)
+
+
+#pragma mark - INDEXING:
+
+
+// Decodes a quoted JSON string that contains escapes.
+static string decodeString(string_view quoted) {
+    string escaped(quoted), decoded;
+    rapidjson::StringStream in(escaped.c_str());
+    struct StringHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, StringHandler> {
+        string *str;
+        bool String(const char* s, rapidjson::SizeType len, bool) {
+            str->assign(s, len); return true;
+        }
+    } handler;
+    handler.str = &decoded;
+    rapidjson::Reader().Parse(in, handler);
+    return decoded;
+}
+
+
+/// Checks JSON syntax and builds the index. This is a lot faster than a rapidjson SAX parse,
+/// since it doesn't decode strings or convert numbers. It's at least as strict as rapidjson,
+/// and like `newFromJSON` it rejects objects with duplicate keys, so whatever it accepts can be
+/// built into values later.
+class JSONIndexer {
+public:
+    explicit JSONIndexer(string_view json)      :_json(json) { }
+
+    bool run();
+
+    vector<uint32_t> const& index() const pure  {return _index;}
+    const char* errorMessage() const;
+
+private:
+    bool fail(rapidjson::ParseErrorCode code)   {_error = code; return false;}
+    char peek() const pure                      {return _pos < _json.size() ? _json[_pos] : 0;}
+
+    void skipWhitespace() {
+        while (_pos < _json.size() && (_json[_pos] == ' ' || _json[_pos] == '\n'
+                                        || _json[_pos] == '\r' || _json[_pos] == '\t'))
+            ++_pos;
+    }
+
+    void open() {
+        if (peek() == '{')
+            _keysStart.push_back(uint32_t(_keys.size()));
+        _open.push_back(uint32_t(_index.size()));
+        _index.push_back(uint32_t(_pos++));
+        _index.push_back(0);                            // (filled in by `close`)
+    }
+
+    bool close() {
+        if (peek() == '}' && !uniqueKeys())
+            return false;
+        _index[_open.back() + 1] = uint32_t(_index.size());
+        _open.pop_back();
+        _index.push_back(uint32_t(_pos++));
+        _index.push_back(_containerCount++);
+        return true;
+    }
+
+    bool uniqueKeys();
+
+    bool scalar();
+    bool string();
+    bool number();
+    bool literal(string_view);
+    int hexEscape();
+
+    string_view                 _json;
+    size_t                      _pos = 0;
+    vector<uint32_t>            _index;
+    vector<uint32_t>            _open;                  // Indexes of unclosed brackets
+    vector<string_view>         _keys;                  // Keys of unclosed objects
+    vector<uint32_t>            _keysStart;             // Each unclosed object's first key
+    std::deque<std::string>     _decodedKeys;           // Decoded escaped keys, for `_keys`
+    vector<uint32_t>            _keySlots;              // Hash table used by `uniqueKeys`
+    uint32_t                    _containerCount = 0;    // Number of containers closed
+    rapidjson::ParseErrorCode   _error = rapidjson::kParseErrorNone;
+    bool                        _escaped = false;       // Did the last string have escapes?
+    bool                        _duplicateKey = false;
+};
+
+
+const char* JSONIndexer::errorMessage() const {
+    if (_duplicateKey)
+        return "Duplicate key in object";
+    else if (_error == rapidjson::kParseErrorTermination)
+        return "JSON is too large to index";
+    else
+        return rapidjson::GetParseError_En(_error);
+}
+
+
+// Checks the keys of the object being closed, then forgets them.
+bool JSONIndexer::uniqueKeys() {
+    auto first = _keys.begin() + _keysStart.back(), last = _keys.end();
+    _keysStart.pop_back();
+    bool unique = true;
+    if (last - first > 1) {
+        if (last - first <= 16) {
+            // Most objects are small enough that comparing every pair is fastest:
+            for (auto key = first; key != last && unique; ++key)
+                unique = (std::find(key + 1, last, *key) == last);
+        } else {
+            // Otherwise add the keys to a hash table, of indexes into `_keys`:
+            size_t size = std::bit_ceil(size_t(last - first) * 2), mask = size - 1;
+            _keySlots.assign(size, UINT32_MAX);
+            for (auto key = first; key != last && unique; ++key) {
+                size_t i = wy::wyhash32(key->data(), key->size(), 0) & mask;
+                for (; _keySlots[i] != UINT32_MAX; i = (i + 1) & mask) {
+                    if (_keys[_keySlots[i]] == *key) {
+                        unique = false;
+                        break;
+                    }
+                }
+                _keySlots[i] = uint32_t(key - _keys.begin());
+            }
+        }
+    }
+    _keys.erase(first, last);
+    if (!unique) {
+        _duplicateKey = true;
+        return fail(rapidjson::kParseErrorTermination);
+    }
+    return true;
+}
+
+
+bool JSONIndexer::run() {
+    using namespace rapidjson;
+    if (_json.size() >= UINT32_MAX)
+        return fail(kParseErrorTermination);            // Offsets are 32-bit
+    skipWhitespace();
+    if (_pos == _json.size())
+        return fail(kParseErrorDocumentEmpty);
+    while (true) {
+        // Read a value:
+        skipWhitespace();
+        if (char c = peek(); c == '{' || c == '[') {
+            open();
+            skipWhitespace();
+            if (peek() == (c == '{' ? '}' : ']')) {
+                if (!close())
+                    return false;
+            } else if (c == '[')
+                continue;
+            else if (peek() != '"')
+                return fail(kParseErrorObjectMissName);
+            else
+                goto key;
+        } else if (!scalar()) {
+            return false;
+        }
+
+        // After a value, close any containers it ends, then go on to the next item or member:
+        while (true) {
+            skipWhitespace();
+            if (_open.empty()) {
+                return _pos == _json.size() || fail(kParseErrorDocumentRootNotSingular);
+            }
+            bool inObject = _json[_index[_open.back()]] == '{';
+            char c = peek();
+            if (c == ',') {
+                ++_pos;
+                if (!inObject)
+                    break;
+                skipWhitespace();
+                if (peek() != '"')
+                    return fail(kParseErrorObjectMissName);
+                goto key;
+            } else if (c == (inObject ? '}' : ']')) {
+                if (!close())
+                    return false;
+            } else {
+                return fail(inObject ? kParseErrorObjectMissCommaOrCurlyBracket
+                                     : kParseErrorArrayMissCommaOrSquareBracket);
+            }
+        }
+        continue;
+
+    key:
+        if (!string())
+            return false;
+        if (string_view quoted = _json.substr(_index.back(), _pos - _index.back()); !_escaped) {
+            _keys.push_back(quoted.substr(1, quoted.size() - 2));
+        } else {
+            // Escaped keys have to be compared decoded:
+            _decodedKeys.push_back(decodeString(quoted));
+            _keys.push_back(_decodedKeys.back());
+        }
+        skipWhitespace();
+        if (peek() != ':')
+            return fail(kParseErrorObjectMissColon);
+        ++_pos;
+    }
+}
+
+
+bool JSONIndexer::scalar() {
+    switch (peek()) {
+        case '"':   return string();
+        case 't':   return literal("true");
+        case 'f':   return literal("false");
+        case 'n':   return literal("null");
+        case '-':   return number();
+        default:
+            if (peek() >= '0' && peek() <= '9')
+                return number();
+            return fail(rapidjson::kParseErrorValueInvalid);
+    }
+}
+
+
+bool JSONIndexer::literal(string_view lit) {
+    if (_json.substr(_pos, lit.size()) != lit)
+        return fail(rapidjson::kParseErrorValueInvalid);
+    _index.push_back(uint32_t(_pos));
+    _pos += lit.size();
+    return true;
+}
+
+
+bool JSONIndexer::number() {
+    using namespace rapidjson;
+    size_t start = _pos;
+    auto digits = [&] {
+        size_t n = 0;
+        for (; peek() >= '0' && peek() <= '9'; ++n)
+            ++_pos;
+        return n;
+    };
+    if (peek() == '-')
+        ++_pos;
+    if (peek() == '0')
+        ++_pos;
+    else if (digits() == 0)
+        return fail(kParseErrorValueInvalid);
+    if (peek() == '.') {
+        ++_pos;
+        if (digits() == 0)
+            return fail(kParseErrorNumberMissFraction);
+    }
+    bool exponent = (peek() == 'e' || peek() == 'E');
+    if (exponent) {
+        ++_pos;
+        if (peek() == '+' || peek() == '-')
+            ++_pos;
+        if (digits() == 0)
+            return fail(kParseErrorNumberMissExponent);
+    }
+    if (exponent || _pos - start > 300) {
+        // rapidjson rejects numbers that overflow a double:
+        if (!isfinite(strtod(std::string(_json.substr(start, _pos - start)).c_str(), nullptr)))
+            return fail(kParseErrorNumberTooBig);
+    }
+    _index.push_back(uint32_t(start));
+    return true;
+}
+
+
+// Reads the 4 hex digits of a `\u` escape.
+int JSONIndexer::hexEscape() {
+    int code = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = peek();
+        int digit = (c >= '0' && c <= '9') ? c - '0'
+                  : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0)
+            return -1;
+        code = (code << 4) | digit;
+        ++_pos;
+    }
+    return code;
+}
+
+
+bool JSONIndexer::string() {
+    using namespace rapidjson;
+    _index.push_back(uint32_t(_pos++));
+    _escaped = false;
+    while (true) {
+        if (_pos >= _json.size())
+            return fail(kParseErrorStringMissQuotationMark);
+        char c = _json[_pos++];
+        if (c == '"') {
+            return true;
+        } else if (uint8_t(c) < 0x20) {
+            return fail(c ? kParseErrorStringInvalidEncoding : kParseErrorStringMissQuotationMark);
+        } else if (c == '\\') {
+            _escaped = true;
+            switch (peek()) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    ++_pos;
+                    break;
+                case 'u': {
+                    ++_pos;
+                    int code = hexEscape();
+                    if (code < 0)
+                        return fail(kParseErrorStringUnicodeEscapeInvalidHex);
+                    if (code >= 0xDC00 && code <= 0xDFFF)
+                        return fail(kParseErrorStringUnicodeSurrogateInvalid);
+                    if (code >= 0xD800 && code <= 0xDBFF) {
+                        // A high surrogate must be followed by an escaped low surrogate:
+                        if (_json.substr(_pos, 2) != "\\u")
+                            return fail(kParseErrorStringUnicodeSurrogateInvalid);
+                        _pos += 2;
+                        code = hexEscape();
+                        if (code < 0)
+                            return fail(kParseErrorStringUnicodeEscapeInvalidHex);
+                        if (code < 0xDC00 || code > 0xDFFF)
+                            return fail(kParseErrorStringUnicodeSurrogateInvalid);
+                    }
+                    break;
+                }
+                default:
+                    return fail(kParseErrorStringEscapeInvalid);
+            }
+        }
+    }
+}
+
+
+optional<LazyJSON> LazyJSON::create(string_view json, Heap &heap, string* outError) {
+    UsingHeap u(heap);
+    JSONIndexer indexer(json);
+    if (!indexer.run()) {
+        if (outError)
+            *outError = indexer.errorMessage();
+        return nullopt;
+    }
+
+    auto &words = indexer.index();
+    unless(array, newArray(kArraySize, heap)) {return nullopt;}
+    Handle harray(&array, heap);
+    unless(text, newBlob(json.data(), json.size(), heap)) {return nullopt;}
+    array[kJSONIndex] = text;
+    unless(index, newBlob(words.data(), words.size() * sizeof(uint32_t), heap)) {return nullopt;}
+    array[kIndexIndex] = index;
+    return LazyJSON(heap, array);
+}
+
+
+#pragma mark - LAZYJSON:
+
+
+LazyJSON::LazyJSON(Heap &heap, Array array)
+:_heap(&heap)
+,_array(array, heap)
+{
+    assert(array.size() == kArraySize);
+}
+
+
+optional<LazyJSON> LazyJSON::existing(Heap &heap, Value value) {
+    // Check the shape of the Array, then the whole index, so that navigating it is safe:
+    unless(array, value.maybeAs<Array>())                       {return nullopt;}
+    if (array.size() != kArraySize)                             {return nullopt;}
+    if (!Value(array[kJSONIndex]).is<Blob>())                   {return nullopt;}
+    unless(index, array[kIndexIndex].maybeAs<Blob>())           {return nullopt;}
+    Value cache = array[kCacheIndex];
+    if (cache && !cache.is<Array>())                            {return nullopt;}
+    size_t nWords = index.size() / sizeof(uint32_t);
+    if (nWords == 0 || index.size() % sizeof(uint32_t) != 0)    {return nullopt;}
+
+    LazyJSON doc(heap, array);
+    if (!doc.validIndex(uint32_t(nWords)))                      {return nullopt;}
+    if_let(cached, cache.maybeAs<Array>()) {
+        // The root closes last, so its ordinal is the highest:
+        uint32_t nContainers = doc.isContainer(0) ? doc.ordinal(0) + 1 : 0;
+        if (cached.size() != nContainers)                       {return nullopt;}
+        for (Val const& item : cached) {
+            if (Value v = item; v && !v.is<Dict>() && !v.is<Vector>() && !v.is<Array>())
+                return nullopt;
+        }
+    }
+    return doc;
+}
+
+
+// Checks that an index read from a Heap is consistent with itself and the text, so navigating
+// it stays in bounds: offsets are within the text and increasing, brackets pair up and are
+// numbered in the order they close, object keys are strings, and there's a single root value.
+bool LazyJSON::validIndex(uint32_t nWords) const {
+    string_view text = json();
+    struct Open {uint32_t close; bool object; uint32_t count;};
+    vector<Open> open;
+    uint32_t rootCount = 0, nClosed = 0, prevOffset = 0;
+    for (uint32_t i = 0; i < nWords; ) {
+        uint32_t offset = word(i);
+        if (offset >= text.size() || (i > 0 && offset <= prevOffset))
+            return false;
+        prevOffset = offset;
+        char c = text[offset];
+        if (c == '}' || c == ']') {
+            if (open.empty() || open.back().close != i || c != (open.back().object ? '}' : ']')
+                    || (open.back().object && open.back().count % 2 != 0)
+                    || word(i + 1) != nClosed++)
+                return false;
+            open.pop_back();
+            i += 2;
+            continue;
+        }
+        uint32_t &count = open.empty() ? rootCount : open.back().count;
+        if (!open.empty() && open.back().object && count % 2 == 0 && c != '"')
+            return false;
+        ++count;
+        if (c == '{' || c == '[') {
+            // (Checking that the closing bracket's words exist makes reading them safe.)
+            if (i + 1 >= nWords)
+                return false;
+            uint32_t close = word(i + 1);
+            if (close < i + 2 || close + 1 >= nWords)
+                return false;
+            open.push_back({close, c == '{', 0});
+            i += 2;
+        } else {
+            ++i;
+        }
+    }
+    return open.empty() && rootCount == 1;
+}
+
+
+string_view LazyJSON::json() const {
+    auto bytes = _array[kJSONIndex].as<Blob>().bytes();
+    return {(const char*)bytes.begin(), bytes.size()};
+}
+
+
+uint32_t LazyJSON::word(uint32_t i) const {
+    // (The Blob isn't aligned, so read with memcpy.)
+    auto bytes = _array[kIndexIndex].as<Blob>().bytes();
+    assert((i + 1) * sizeof(uint32_t) <= bytes.size());
+    uint32_t w;
+    memcpy(&w, &bytes[i * sizeof(uint32_t)], sizeof(w));
+    return w;
+}
+
+
+bool LazyJSON::isContainer(uint32_t i) const {
+    char c = json()[word(i)];
+    return c == '{' || c == '[';
+}
+
+
+// The index of the next value after the one at `i`, skipping its contents if it's a container.
+uint32_t LazyJSON::next(uint32_t i) const {
+    return isContainer(i) ? word(i + 1) + 2 : i + 1;
+}
+
+
+// The ordinal of the container at `i`: its slot in the cache.
+uint32_t LazyJSON::ordinal(uint32_t i) const {
+    return word(word(i + 1) + 1);
+}
+
+
+// The JSON text of the value at `i`.
+string_view LazyJSON::token(uint32_t i) const {
+    string_view text = json();
+    size_t pos = word(i), end;
+    if (isContainer(i)) {
+        end = word(word(i + 1)) + 1;
+    } else if (text[pos] == '"') {
+        end = pos + 1;
+        while (end < text.size() && text[end] != '"')
+            end += (text[end] == '\\') ? 2 : 1;
+        end = std::min(end + 1, text.size());
+    } else {
+        end = text.find_first_of(",]} \t\n\r", pos);
+        if (end == string::npos)
+            end = text.size();
+    }
+    return text.substr(pos, end - pos);
+}
+
+
+Maybe<Array> LazyJSON::cache() const {
+    return _array[kCacheIndex].maybeAs<Array>();
+}
+
+
+LazyJSON::Item LazyJSON::root() const {
+    return Item(this, 0);
+}
+
+
+// Builds the value at index `i`, without caching it.
+Value LazyJSON::build(uint32_t i) const {
+    string_view tok = token(i);
+    switch (tok[0]) {
+        case 't':   return smol::Bool(true);
+        case 'f':   return smol::Bool(false);
+        case 'n':   return nullishvalue;
+        case '"': {
+            // A string without escapes can be copied as-is. (It has to be copied out of the
+            // Heap first, since allocating the String could trigger GC.)
+            string_view str = tok.substr(1, tok.size() - 2);
+            if (str.find('\\') == string::npos)
+                return newString(string(str), *_heap);
+            break;
+        }
+    }
+    // Otherwise let the real parser handle it:
+    return newFromJSON(string(tok), *_heap);
+}
+
+
+#pragma mark - ITEM:
+
+
+char LazyJSON::Item::firstChar() const {
+    return _doc ? _doc->json()[_doc->word(_index)] : 0;
+}
+
+
+string_view LazyJSON::Item::json() const {
+    return _doc ? _doc->token(_index) : string_view();
+}
+
+
+uint32_t LazyJSON::Item::count() const {
+    if (!isObject() && !isArray())
+        return 0;
+    uint32_t n = 0, end = _doc->word(_index + 1);
+    for (uint32_t i = _index + 2; i < end; i = _doc->next(i))
+        ++n;
+    return isObject() ? n / 2 : n;
+}
+
+
+LazyJSON::Item LazyJSON::Item::get(string_view key) const {
+    if (!isObject())
+        return {};
+    uint32_t end = _doc->word(_index + 1);
+    for (uint32_t i = _index + 2; i < end; i = _doc->next(i + 1)) {
+        string_view quotedKey = _doc->token(i);
+        string_view rawKey = quotedKey.substr(1, quotedKey.size() - 2);
+        if (rawKey == key)
+            return Item(_doc, i + 1);
+        else if (rawKey.find('\\') != string::npos && decodeString(quotedKey) == key)
+            return Item(_doc, i + 1);   // (an escaped key has to be decoded to compare it)
+    }
+    return {};
+}
+
+
+LazyJSON::Item LazyJSON::Item::get(uint32_t index) const {
+    if (!isArray())
+        return {};
+    uint32_t end = _doc->word(_index + 1);
+    for (uint32_t i = _index + 2; i < end; i = _doc->next(i)) {
+        if (index-- == 0)
+            return Item(_doc, i);
+    }
+    return {};
+}
+
+
+Value LazyJSON::Item::value() const {
+    if (!_doc)
+        return nullvalue;
+    if (!isObject() && !isArray())
+        return _doc->build(_index);
+
+    // Containers are cached in an Array with a slot for each, indexed by its ordinal:
+    Heap &heap = *_doc->_heap;
+    if_let(cache, _doc->cache()) {
+        if (Value cached = cache[_doc->ordinal(_index)])
+            return cached;
+    }
+
+    Handle<Value> result(_doc->build(_index), heap);
+    if (!result)
+        return nullvalue;
+    if (!_doc->cache()) {
+        // The root is the last container to close, so its ordinal is the highest:
+        unless(cache, newArray(_doc->ordinal(0) + 1, heap)) {return result;}
+        Array array = _doc->_array;
+        array[kCacheIndex] = cache;
+    }
+    _doc->cacheContainers(_index, result);
+    return result;
+}
+
+
+// Stores a newly built container, and all the containers inside it, in the cache. A nested
+// container that was already built is put in place of the new copy, so that there's only one
+// instance of each. (This doesn't allocate, so the Values stay valid.)
+void LazyJSON::cacheContainers(uint32_t i, Value built) const {
+    Array cache = this->cache().value();
+    SymbolTable const* symbols = _heap->existingSymbolTable();
+    cache[ordinal(i)] = built;
+    vector<pair<uint32_t,Value>> stack {{i, built}};
+    while (!stack.empty()) {
+        auto [at, container] = stack.back();
+        stack.pop_back();
+        auto visitChild = [&](uint32_t child, Val &slot) {
+            Val &cached = cache[ordinal(child)];
+            if (cached) {
+                slot = Value(cached);
+            } else {
+                cached = Value(slot);
+                stack.emplace_back(child, Value(slot));
+            }
+        };
+        uint32_t end = word(at + 1);
+        if_let(dict, container.maybeAs<Dict>()) {
+            // Dict entries are ordered by Symbol, so look up each member's key:
+            for (uint32_t k = at + 2; k < end; k = next(k + 1)) {
+                if (!isContainer(k + 1) || !symbols)
+                    continue;
+                string_view quotedKey = token(k);
+                string_view key = quotedKey.substr(1, quotedKey.size() - 2);
+                string decoded;
+                if (key.find('\\') != string::npos)
+                    key = decoded = decodeString(quotedKey);
+                if_let(sym, symbols->find(key)) {
+                    if (Val *slot = dict.find(sym))
+                        visitChild(k + 1, *slot);
+                }
+            }
+        } else if_let(vec, container.maybeAs<Vector>()) {
+            // (An empty JSON array is built as an empty Array, which has nothing to visit.)
+            slice<Val> items = vec.items();
+            uint32_t n = 0;
+            for (uint32_t k = at + 2; k < end; k = next(k), ++n) {
+                if (isContainer(k))
+                    visitChild(k, items[n]);
+            }
+        }
+    }
+}
+
+}
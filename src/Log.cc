@@ -0,0 +1,73 @@
+//
+// Log.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Log.hh"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+
+namespace snej::smol {
+
+LogDomain HeapLog("Heap");
+LogDomain GCLog("GC");
+LogDomain SymbolLog("Symbols");
+
+
+const char* LogLevelName(LogLevel level) {
+    static constexpr const char* kNames[] = {"None", "Error", "Warning", "Info", "Verbose", "Debug"};
+    return (size_t(level) < std::size(kNames)) ? kNames[size_t(level)] : "?";
+}
+
+
+static void defaultLogSink(LogDomain const& domain, LogLevel level, const char *message) {
+    // A single fprintf, so concurrent messages from different threads don't get interleaved.
+    fprintf(stderr, "smol %s %s: %s\n", domain.name(), LogLevelName(level), message);
+}
+
+static std::atomic<LogSink> sLogSink = &defaultLogSink;
+
+
+void setLogSink(LogSink sink) {
+    sLogSink = sink ? sink : &defaultLogSink;
+}
+
+
+void LogDomain::_log(LogLevel level, const char *format, ...) const {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0)
+        return;
+    const char *message = buf;
+    std::unique_ptr<char[]> bigBuf;
+    if (size_t(len) >= sizeof(buf)) {
+        // Message didn't fit; format it again into a big-enough heap buffer:
+        bigBuf.reset(new char[len + 1]);
+        va_start(args, format);
+        vsnprintf(bigBuf.get(), len + 1, format, args);
+        va_end(args);
+        message = bigBuf.get();
+    }
+    sLogSink.load(std::memory_order_relaxed)(*this, level, message);
+}
+
+}
@@ -0,0 +1,472 @@
+//
+// Path.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Path.hh"
+#include "Heap.hh"
+#include "SymbolTable.hh"
+#include <cstdlib>
+#include <cstring>
+
+namespace snej::smol {
+
+using namespace std;
+
+
+/// One component of a compiled Path.
+struct Path::Step {
+    enum Kind : uint8_t {Key, Index, Wildcard, Descendants, Filter};
+    enum Op : uint8_t {Exists, EQ, NE, LT, LE, GT, GE};
+    enum LiteralType : uint8_t {NullLiteral, BoolLiteral, NumberLiteral, StringLiteral};
+
+    Kind                kind;
+    bool                isIndex = false;        // Key: it's also a valid Index (JSON Pointer)
+    mutable Symbol::ID  id = Symbol::ID::None;  // Key: the Symbol's ID, once it exists
+    int32_t             index = 0;              // Index, or Key with `isIndex`
+    string              name;                   // Key: the name; Filter: a string literal
+
+    // Filter: the relative path, and what to compare its value with:
+    vector<Step>        filter;
+    Op                  op = Exists;
+    LiteralType         literalType = NullLiteral;
+    double              number = 0;             // number literal, or 1/0 for a bool literal
+};
+
+
+#pragma mark - PARSER:
+
+
+class Path::Parser {
+public:
+    explicit Parser(string_view str)        :_str(str) { }
+
+    bool parse(vector<Step> &steps) {
+        if (!_str.empty() && _str[0] == '/')
+            return parsePointer(steps);
+        if (peek() == '$')
+            ++_pos;
+        return parseSteps(steps) && (atEnd() || fail("unexpected character"));
+    }
+
+    string error;
+
+private:
+    bool atEnd() const                      {return _pos >= _str.size();}
+    char peek() const                       {return atEnd() ? 0 : _str[_pos];}
+
+    bool fail(const char *message) {
+        error = string(message) + " at offset " + to_string(_pos) + " of path";
+        return false;
+    }
+
+    bool expect(char c) {
+        if (peek() != c)
+            return fail((string("expected '") + c + "'").c_str());
+        ++_pos;
+        return true;
+    }
+
+    void skipSpaces() {
+        while (peek() == ' ' || peek() == '\t')
+            ++_pos;
+    }
+
+    // Parses JSON Pointer syntax.
+    bool parsePointer(vector<Step> &steps) {
+        while (!atEnd()) {
+            ++_pos;                                 // skip '/'
+            Step step {Step::Key};
+            while (!atEnd() && peek() != '/') {
+                char c = _str[_pos++];
+                if (c == '~') {
+                    if (peek() == '0')       c = '~';
+                    else if (peek() == '1')  c = '/';
+                    else                     return fail("invalid '~' escape");
+                    ++_pos;
+                }
+                step.name += c;
+            }
+            // A numeric component without leading zeroes can also be an array index:
+            if (!step.name.empty() && step.name.size() <= 9
+                    && step.name.find_first_not_of("0123456789") == string::npos
+                    && (step.name[0] != '0' || step.name.size() == 1)) {
+                step.isIndex = true;
+                step.index = int32_t(atoi(step.name.c_str()));
+            }
+            steps.push_back(std::move(step));
+        }
+        return true;
+    }
+
+    // Parses JSONPath steps following the root `$` or `@`.
+    bool parseSteps(vector<Step> &steps) {
+        while (true) {
+            if (peek() == '.') {
+                ++_pos;
+                if (peek() == '.') {
+                    ++_pos;
+                    steps.push_back(Step{Step::Descendants});
+                    if (peek() == '[')
+                        continue;
+                }
+                if (peek() == '*') {
+                    ++_pos;
+                    steps.push_back(Step{Step::Wildcard});
+                } else {
+                    size_t start = _pos;
+                    while (!atEnd() && !strchr(".[]()=!<> \t'\"", peek()))
+                        ++_pos;
+                    if (_pos == start)
+                        return fail("expected a property name");
+                    Step step {Step::Key};
+                    step.name = _str.substr(start, _pos - start);
+                    steps.push_back(std::move(step));
+                }
+            } else if (peek() == '[') {
+                ++_pos;
+                if (!parseBracket(steps) || !expect(']'))
+                    return false;
+            } else {
+                return true;
+            }
+        }
+    }
+
+    // Parses the contents of a `[...]` step.
+    bool parseBracket(vector<Step> &steps) {
+        char c = peek();
+        if (c == '*') {
+            ++_pos;
+            steps.push_back(Step{Step::Wildcard});
+        } else if (c == '\'' || c == '"') {
+            Step step {Step::Key};
+            if (!parseString(step.name))
+                return false;
+            steps.push_back(std::move(step));
+        } else if (c == '?') {
+            ++_pos;
+            Step step {Step::Filter};
+            if (!expect('(') || !parseFilter(step) || !expect(')'))
+                return false;
+            steps.push_back(std::move(step));
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            Step step {Step::Index};
+            size_t start = _pos++;
+            while (peek() >= '0' && peek() <= '9')
+                ++_pos;
+            string digits(_str.substr(start, _pos - start));
+            if (digits == "-" || digits.size() > 10)
+                return fail("invalid array index");
+            step.index = int32_t(atol(digits.c_str()));
+            steps.push_back(std::move(step));
+        } else {
+            return fail("invalid '[' step");
+        }
+        return true;
+    }
+
+    // Parses a filter expression, i.e. what's between `[?(` and `)]`.
+    bool parseFilter(Step &step) {
+        skipSpaces();
+        if (!expect('@') || !parseSteps(step.filter))
+            return false;
+        skipSpaces();
+        static constexpr struct {const char *str; Step::Op op;} kOps[] = {
+            {"==", Step::EQ}, {"!=", Step::NE}, {"<=", Step::LE},
+            {">=", Step::GE}, {"<", Step::LT},  {">", Step::GT}
+        };
+        for (auto &[str, op] : kOps) {
+            if (_str.substr(_pos).starts_with(str)) {
+                _pos += strlen(str);
+                step.op = op;
+                skipSpaces();
+                if (!parseLiteral(step))
+                    return false;
+                skipSpaces();
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool parseLiteral(Step &step) {
+        string_view rest = _str.substr(_pos);
+        if (char c = peek(); c == '\'' || c == '"') {
+            step.literalType = Step::StringLiteral;
+            return parseString(step.name);
+        } else if (rest.starts_with("null")) {
+            _pos += 4;
+            step.literalType = Step::NullLiteral;
+        } else if (rest.starts_with("true") || rest.starts_with("false")) {
+            step.literalType = Step::BoolLiteral;
+            step.number = (c == 't');
+            _pos += (c == 't') ? 4 : 5;
+        } else {
+            string token(rest.substr(0, rest.find_first_of(" \t)")));
+            char *end;
+            step.number = strtod(token.c_str(), &end);
+            if (token.empty() || end != token.c_str() + token.size())
+                return fail("invalid literal in filter");
+            _pos += token.size();
+            step.literalType = Step::NumberLiteral;
+        }
+        return true;
+    }
+
+    // Parses a quoted string; a backslash escapes the next character.
+    bool parseString(string &str) {
+        char quote = _str[_pos++];
+        while (!atEnd() && peek() != quote) {
+            if (peek() == '\\')
+                ++_pos;
+            if (!atEnd())
+                str += _str[_pos++];
+        }
+        return expect(quote);
+    }
+
+    string_view _str;
+    size_t      _pos = 0;
+};
+
+
+Path::Path(string_view str, Heap &heap)
+:_heap(&heap)
+{
+    Parser parser(str);
+    if (!parser.parse(_steps)) {
+        _error = std::move(parser.error);
+        _steps.clear();
+    }
+}
+
+Path::Path(Path&&) = default;
+Path& Path::operator=(Path&&) = default;
+Path::~Path() = default;
+
+
+#pragma mark - EVALUATION:
+
+
+// Calls `fn` with each non-null item of an Array or Vector, or value of a Dict.
+template <typename FN>
+static bool visitChildren(Value val, FN fn) {
+    switch (val.type()) {
+        case Type::Array:
+            for (Val const& item : val.as<Array>())
+                if (item && !fn(Value(item))) return false;
+            break;
+        case Type::Vector:
+            for (Val const& item : val.as<Vector>())
+                if (item && !fn(Value(item))) return false;
+            break;
+        case Type::Dict:
+            for (DictEntry const& entry : val.as<Dict>().items())
+                if (entry.value && !fn(Value(entry.value))) return false;
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+
+// Returns an Array or Vector item; negative indexes count back from the end.
+static Value itemAt(Value val, int32_t index) {
+    slice<Val> items;
+    switch (val.type()) {
+        case Type::Array:   items = val.as<Array>().items(); break;
+        case Type::Vector:  items = val.as<Vector>().items(); break;
+        default:            return nullvalue;
+    }
+    if (index < 0)
+        index += items.size();
+    if (index < 0 || index >= int32_t(items.size()))
+        return nullvalue;
+    return items[index];
+}
+
+
+// Forgets the Symbol IDs cached in Key steps, including those in filters.
+static void clearIDs(vector<Path::Step> const& steps) {
+    for (Path::Step const& step : steps) {
+        step.id = Symbol::ID::None;
+        clearIDs(step.filter);
+    }
+}
+
+
+// Chooses the SymbolTable that Key steps are resolved with: that of the Heap containing `root`.
+// This doesn't create a table, so it doesn't allocate. If it's not the table the cached IDs
+// came from (the Heap was reset, or this is a different Heap), they're cleared.
+void Path::useSymbolsOf(Value root) const {
+    Heap const* heap = nullptr;
+    if (root.isObject())
+        heap = Heap::heapContaining(root.block());
+    _symbols = (heap ? heap : _heap)->existingSymbolTable();
+    uint64_t serial = _symbols ? _symbols->serial() : 0;
+    if (serial != _symbolsSerial) {
+        clearIDs(_steps);
+        _symbolsSerial = serial;
+    }
+}
+
+
+// Looks up a Key step's Symbol ID, if it wasn't known yet.
+bool Path::resolve(Step const& step) const {
+    if (step.id == Symbol::ID::None && _symbols) {
+        if_let(sym, _symbols->find(step.name))
+            step.id = sym.id();
+    }
+    return step.id != Symbol::ID::None;
+}
+
+
+// Finds a Dict key by name, when there's no symbol table to look up its ID with.
+static Val const* findByName(Dict dict, string_view name) {
+    for (DictEntry const& entry : dict.items()) {
+        if (Value(entry.key).as<Symbol>().str() == name)
+            return &entry.value;
+    }
+    return nullptr;
+}
+
+
+bool Path::eval(vector<Step> const& steps, size_t n, Value val, Visitor const& visitor) const {
+    if (n == steps.size())
+        return visitor(val);
+    Step const& step = steps[n];
+    switch (step.kind) {
+        case Step::Key:
+            if_let(dict, val.maybeAs<Dict>()) {
+                Val const* item = nullptr;
+                if (resolve(step))
+                    item = dict.find(step.id);
+                else if (!_symbols)
+                    item = findByName(dict, step.name);
+                if (item && *item)
+                    return eval(steps, n + 1, *item, visitor);
+                return true;
+            }
+            [[fallthrough]];
+        case Step::Index:
+            if (step.kind == Step::Index || step.isIndex) {
+                if (Value item = itemAt(val, step.index))
+                    return eval(steps, n + 1, item, visitor);
+            }
+            return true;
+        case Step::Wildcard:
+            return visitChildren(val, [&](Value child) {
+                return eval(steps, n + 1, child, visitor);
+            });
+        case Step::Descendants:
+            return eval(steps, n + 1, val, visitor) && visitChildren(val, [&](Value child) {
+                return eval(steps, n, child, visitor);
+            });
+        case Step::Filter:
+            return visitChildren(val, [&](Value child) {
+                return !matches(step, child) || eval(steps, n + 1, child, visitor);
+            });
+    }
+    return true;
+}
+
+
+// Compares a Value with a Filter step's literal. Returns <0, 0 or >0, or 2 if they're of
+// incompatible types (which makes every comparison but `!=` false.)
+static int compareLiteral(Value val, Path::Step const& step) {
+    static constexpr int kIncomparable = 2;
+    auto cmp = [](auto a, auto b) {return (a > b) - (a < b);};
+    switch (step.literalType) {
+        case Path::Step::NullLiteral:
+            return val.type() == Type::Null ? 0 : kIncomparable;
+        case Path::Step::BoolLiteral:
+            if (val.type() != Type::Bool)
+                return kIncomparable;
+            return val.asBool() == bool(step.number) ? 0 : kIncomparable;
+        case Path::Step::NumberLiteral:
+            if (!val.isNumber())
+                return kIncomparable;
+            return cmp(val.asNumber<double>(), step.number);
+        case Path::Step::StringLiteral:
+            switch (val.type()) {
+                case Type::String:  return cmp(val.as<String>().str(), string_view(step.name));
+                case Type::Symbol:  return cmp(val.as<Symbol>().str(), string_view(step.name));
+                default:            return kIncomparable;
+            }
+    }
+    return kIncomparable;
+}
+
+
+bool Path::matches(Step const& filter, Value val) const {
+    Value found;
+    eval(filter.filter, 0, val, [&](Value v) {found = v; return false;});
+    if (!found)
+        return false;
+    if (filter.op == Step::Exists)
+        return true;
+    int c = compareLiteral(found, filter);
+    switch (filter.op) {
+        case Step::EQ:  return c == 0;
+        case Step::NE:  return c != 0;
+        case Step::LT:  return c == -1;
+        case Step::LE:  return c == -1 || c == 0;
+        case Step::GT:  return c == 1;
+        case Step::GE:  return c == 1 || c == 0;
+        default:        return false;
+    }
+}
+
+
+bool Path::visit(Value root, Visitor visitor) const {
+    if (!valid() || !root)
+        return true;
+    useSymbolsOf(root);
+    return eval(_steps, 0, root, visitor);
+}
+
+
+Value Path::first(Value root) const {
+    Value result;
+    visit(root, [&](Value v) {result = v; return false;});
+    return result;
+}
+
+
+size_t Path::count(Value root) const {
+    size_t n = 0;
+    visit(root, [&](Value) {++n; return true;});
+    return n;
+}
+
+
+Maybe<Vector> Path::all(Value root) const {
+    // Count the matches first, so the Vector can be allocated at the right size before
+    // walking the document again. (Allocating during the walk could trigger GC.)
+    size_t n = count(root);
+    Handle hRoot(&root, *_heap);
+    unless(vec, newVector(heapsize(n), *_heap)) {return nullvalue;}
+    visit(root, [&](Value v) {
+        __unused bool ok = vec.append(v);
+        assert(ok);
+        return true;
+    });
+    return vec;
+}
+
+}
@@ -0,0 +1,256 @@
+//
+// PerfCounters.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "PerfCounters.hh"
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace snej::smol {
+
+using namespace std;
+
+
+const char* PerfEventName(PerfEvent event) {
+    static constexpr const char* kNames[kNumPerfEvents] = {
+        "Cycles", "Instructions", "L1DMisses", "LLCMisses", "DTLBMisses", "PageFaults"};
+    return (size_t(event) < kNumPerfEvents) ? kNames[size_t(event)] : "?";
+}
+
+
+PerfCounts& PerfCounts::operator+= (PerfCounts const& other) {
+    for (size_t i = 0; i < kNumPerfEvents; ++i)
+        values[i] += other.values[i];
+    return *this;
+}
+
+
+PerfCounts PerfCounts::operator- (PerfCounts const& other) const {
+    PerfCounts result;
+    for (size_t i = 0; i < kNumPerfEvents; ++i)
+        result.values[i] = values[i] - other.values[i];
+    return result;
+}
+
+
+#pragma mark - THREAD COUNTERS:
+
+
+#ifdef __linux__
+
+// The `config` of a PERF_TYPE_HW_CACHE event counting read misses in a cache.
+static constexpr uint64_t cacheEvent(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+
+// The counters of one thread. All the events are opened as one group, so they can be read
+// together with a single system call.
+class ThreadCounters {
+public:
+    ThreadCounters() {
+        static constexpr struct {uint32_t type; uint64_t config;} kEvents[kNumPerfEvents] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D)},
+            {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_LL)},
+            {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB)},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        };
+        for (size_t i = 0; i < kNumPerfEvents; ++i) {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = kEvents[i].type;
+            attr.config = kEvents[i].config;
+            attr.exclude_kernel = 1;        // Only count this process's own work
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                             | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            // The first event that opens becomes the group leader:
+            int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, _leader, 0));
+            if (fd < 0)
+                continue;
+            if (_leader < 0)
+                _leader = fd;
+            _fds[_nOpen] = fd;
+            _slot[i] = int8_t(_nOpen++);
+        }
+    }
+
+    ~ThreadCounters() {
+        for (size_t i = 0; i < _nOpen; ++i)
+            close(_fds[i]);
+    }
+
+    bool available() const pure                 {return _leader >= 0;}
+    bool available(PerfEvent e) const pure      {return _slot[size_t(e)] >= 0;}
+
+    PerfCounts read() const {
+        PerfCounts counts;
+        if (_leader < 0)
+            return counts;
+        struct {
+            uint64_t nr, timeEnabled, timeRunning;
+            uint64_t values[kNumPerfEvents];
+        } buf;
+        if (::read(_leader, &buf, sizeof(buf)) < ssize_t(3 * sizeof(uint64_t)))
+            return counts;
+        // If the kernel had to multiplex the counters, scale up to estimate the full count:
+        double scale = 1.0;
+        if (buf.timeRunning > 0 && buf.timeRunning < buf.timeEnabled)
+            scale = double(buf.timeEnabled) / buf.timeRunning;
+        for (size_t i = 0; i < kNumPerfEvents; ++i) {
+            if (int slot = _slot[i]; slot >= 0 && uint64_t(slot) < buf.nr)
+                counts.values[i] = uint64_t(buf.values[slot] * scale);
+        }
+        return counts;
+    }
+
+private:
+    int     _leader = -1;
+    int     _fds[kNumPerfEvents];
+    size_t  _nOpen = 0;
+    int8_t  _slot[kNumPerfEvents] = {-1, -1, -1, -1, -1, -1};  // Index of each event in a read
+};
+
+#else
+
+class ThreadCounters {
+public:
+    bool available() const pure                 {return false;}
+    bool available(PerfEvent) const pure        {return false;}
+    PerfCounts read() const                     {return {};}
+};
+
+#endif
+
+
+static ThreadCounters& threadCounters() {
+    static thread_local ThreadCounters sCounters;
+    return sCounters;
+}
+
+
+PerfCounts PerfCounts::now()                {return threadCounters().read();}
+bool PerfCounts::available()                {return threadCounters().available();}
+bool PerfCounts::available(PerfEvent e)     {return threadCounters().available(e);}
+
+
+#pragma mark - REGIONS:
+
+
+atomic<bool> PerfRegion::sEnabled = false;
+
+static mutex        sRegionsMutex;
+static PerfRegion*  sFirstRegion = nullptr;     // Linked list of all regions, newest first
+
+PerfRegion GCPerf("GC");
+PerfRegion JSONParsePerf("JSON parse");
+
+
+PerfRegion::PerfRegion(const char *name)
+:_name(name)
+{
+    unique_lock<mutex> lock(sRegionsMutex);
+    _next = sFirstRegion;
+    sFirstRegion = this;
+}
+
+
+void PerfRegion::add(PerfCounts const& counts) {
+    _runs.fetch_add(1, memory_order_relaxed);
+    for (size_t i = 0; i < kNumPerfEvents; ++i)
+        _totals[i].fetch_add(counts.values[i], memory_order_relaxed);
+}
+
+
+PerfCounts PerfRegion::totals() const {
+    PerfCounts counts;
+    for (size_t i = 0; i < kNumPerfEvents; ++i)
+        counts.values[i] = _totals[i].load(memory_order_relaxed);
+    return counts;
+}
+
+
+void PerfRegion::reset() {
+    _runs = 0;
+    for (auto &total : _totals)
+        total = 0;
+}
+
+
+bool PerfRegion::setEnabled(bool enabled) {
+    enabled = enabled && PerfCounts::available();
+    sEnabled = enabled;
+    return enabled;
+}
+
+
+void PerfRegion::resetAll() {
+    unique_lock<mutex> lock(sRegionsMutex);
+    for (auto region = sFirstRegion; region; region = region->_next)
+        region->reset();
+}
+
+
+void PerfRegion::writeStats(std::ostream &out) {
+    out << left << setfill(' ') << setw(16) << "region" << right << setw(8) << "runs";
+    for (size_t i = 0; i < kNumPerfEvents; ++i)
+        out << setw(14) << PerfEventName(PerfEvent(i));
+    out << setw(6) << "IPC" << '\n';
+
+    unique_lock<mutex> lock(sRegionsMutex);
+    for (auto region = sFirstRegion; region; region = region->_next) {
+        if (region->runs() == 0)
+            continue;
+        PerfCounts totals = region->totals();
+        out << left << setw(16) << region->name() << right << setw(8) << region->runs();
+        for (auto value : totals.values)
+            out << setw(14) << value;
+        out << setw(6) << fixed << setprecision(2) << totals.ipc() << defaultfloat << '\n';
+    }
+}
+
+
+void PerfRegion::writeJSON(std::ostream &out) {
+    out << '{';
+    bool first = true;
+    unique_lock<mutex> lock(sRegionsMutex);
+    for (auto region = sFirstRegion; region; region = region->_next) {
+        if (region->runs() == 0)
+            continue;
+        if (!first) out << ',';
+        first = false;
+        out << '"' << region->name() << "\":{\"runs\":" << region->runs();
+        PerfCounts totals = region->totals();
+        for (size_t i = 0; i < kNumPerfEvents; ++i)
+            out << ",\"" << PerfEventName(PerfEvent(i)) << "\":" << totals.values[i];
+        out << '}';
+    }
+    out << '}';
+}
+
+}
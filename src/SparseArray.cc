@@ -21,32 +21,30 @@
 
 /*  A SparseArray is represented as an Array.
      - Item 0 is a Blob containing a bitmap, one bit per slot in the table.
-     - The rest of its items are Arrays called buckets.
-     - Each bucket contains the Values for kBitsPerBucket slots, with nulls omitted.
+     - The next items are Arrays called buckets.
+     - Each bucket contains the Values for kItemsPerBucket slots, with nulls omitted. Its items
+       are packed at the start; any extra space at the end is null.
+     - The last item is the pool: an Array of kNumSizeClasses free lists of unused buckets, one
+       per size class. A free bucket is all nulls except item 0, the next bucket in its list.
+       (Arrays created before there were pools lack this item; they just don't pool buckets.)
+
+    Buckets grow by doubling, to the next size class; when that happens, the old bucket goes
+    into the pool, to be picked up by the next bucket that needs that size. So a growing table
+    mostly reuses its discarded buckets instead of leaving them as garbage.
  */
 
 namespace snej::smol {
 
 
-// Number of items a bucket grows by at once. Larger values reduce the number of bucket reallocs
-// and copies; smaller values have less space overhead.
-constexpr unsigned kBucketGrowsBy = 4;
-
-
-template <typename INT> unsigned popcount(INT);
-#if defined(__clang__) || defined(__GNUC__)
-inline unsigned popcount(uint64_t value)  {return __builtin_popcountll(value);}
-#else
-#   error "Haven't added popcount support for this platform yet"
-#endif
-
-
 Array SparseArray::makeArray(unsigned size, Heap &heap) {
     auto nBuckets = (size + kItemsPerBucket - 1) / kItemsPerBucket;
-    unless(array, newArray(1 + nBuckets, heap)) {throw std::bad_alloc();}
+    unless(array, newArray(1 + nBuckets + 1, heap)) {throw std::bad_alloc();}
+    Handle ha(&array, heap);
     auto nInts = (size + 64 - 1) / 64;
     unless(bitmap, newBlob(nInts * sizeof(uint64_t), heap)) {throw std::bad_alloc();}
     array[0] = bitmap;
+    unless(pool, newArray(kNumSizeClasses, heap)) {throw std::bad_alloc();}
+    array[1 + nBuckets] = pool;
     return array;
 }
 
@@ -63,14 +61,26 @@ SparseArray::SparseArray(Array array, Heap& heap)
 { }
 
 
-unsigned SparseArray::nonNullCount() const {
+// Builds without `-mpopcnt` (or `SMOL_NATIVE`) would otherwise count bits in software; on x86
+// Linux, let the loader pick a clone using the POPCNT instruction if the CPU has it.
+// (This calls `std::popcount`, not `popcount64`, whose software fallback would be compiled
+// into the POPCNT clone too.)
+#if defined(__x86_64__) && defined(__ELF__) && !defined(__POPCNT__)
+    __attribute__((target_clones("popcnt", "default")))
+#endif
+static unsigned countBits(slice<uint64_t> words) {
     unsigned total = 0;
-    for (uint64_t bits : bitmap())
-        total += popcount(bits);
+    for (uint64_t bits : words)
+        total += unsigned(std::popcount(bits));
     return total;
 }
 
 
+unsigned SparseArray::nonNullCount() const {
+    return countBits(bitmap());
+}
+
+
 bool SparseArray::allNull() const {
     uint64_t ored = 0;
     for (uint64_t bits : bitmap())
@@ -79,6 +89,17 @@ bool SparseArray::allNull() const {
 }
 
 
+// The number of items in the bucket containing index `i`.
+unsigned SparseArray::bucketItemCount(unsigned i) const {
+    slice<uint64_t> words = bitmap();
+    unsigned w = (i / 64) & ~1u;
+    unsigned count = popcount64(words[w]);
+    if (w + 1 < words.size())
+        count += popcount64(words[w + 1]);
+    return count;
+}
+
+
 bool SparseArray::contains(unsigned i) const {
     assert(i < size());
     return (bitmap()[i / 64] & maskFor(i)) != 0;
@@ -86,9 +107,11 @@ bool SparseArray::contains(unsigned i) const {
 
 
 Value SparseArray::get(unsigned i) const {
-    if (!contains(i))
+    assert(i < size());
+    slice<uint64_t> words = bitmap();
+    if (!(words[i / 64] & maskFor(i)))
         return nullvalue;
-    return bucketFor(i).value()[indexInBucket(i)];
+    return bucketFor(i).value()[indexInBucket(words, i)];
 }
 
 
@@ -104,7 +127,8 @@ bool SparseArray::put(unsigned i, Value value) {
             bucket.value()[indexInBucket] = value;
         } else {
             // Removal:
-            Value newBucketVal = deleteFromBucket(bucket.value(), indexInBucket);
+            Value newBucketVal = deleteFromBucket(bucket.value(), indexInBucket,
+                                                  bucketItemCount(i));
             _array[1 + (i / kItemsPerBucket)] = newBucketVal;
             bitmap()[i / 64] &= ~mask;
         }
@@ -127,13 +151,17 @@ Maybe<Array> SparseArray::insertIntoBucket(Maybe<Array> bucket_, unsigned index)
         auto bucketSize = bucket.size();
         assert(index <= bucketSize);
         if (index == bucketSize || bucket[bucketSize-1] != nullval) {
-            // Bucket is full; allocate a new one and copy values:
+            // Bucket is full; move its values into one of the next size class:
             Handle hb(&bucket_, *_heap);
-            unless(newBucket, newArray(bucket.size() + kBucketGrowsBy, *_heap)) {
+            unsigned newSize = std::clamp(std::bit_ceil(bucketSize + 1),
+                                          kMinBucketSize, kItemsPerBucket);
+            unless(newBucket, allocBucket(newSize)) {
                 return nullvalue;
             }
+            bucket = bucket_.value();       // (allocating may have triggered GC)
             for (int i = bucketSize - 1; i >= 0; --i)
                 newBucket[i + (i >= index)] = bucket[i];
+            releaseBucket(bucket);
             return newBucket;
        } else {
            // There's room to append to this bucket:
@@ -144,37 +172,117 @@ Maybe<Array> SparseArray::insertIntoBucket(Maybe<Array> bucket_, unsigned index)
     } else {
         // Bucket was nil -- allocate a small one
         assert(index == 0);
-        return newArray(bucket.size() + kBucketGrowsBy, *_heap);
+        return allocBucket(kMinBucketSize);
     }
 }
 
 
-Value SparseArray::deleteFromBucket(Array bucket, unsigned index) {
-    if (unsigned bucketSize = bucket.size(); bucketSize > 1) {
-        Handle hb(&bucket, *_heap);
-        Maybe<Array> newBucket = newArray(bucketSize - 1, *_heap);
-        if (!newBucket)
-            newBucket = bucket; // If allocation fails, reuse the bucket leaving space at the end
-        for (unsigned i = 0; i < bucketSize; ++i)
-            newBucket.value()[i - (i > index)] = bucket[i];
-        if (newBucket == bucket)
-            bucket[bucket.size() - 1] = nullvalue;
-        return newBucket;
-    } else {
+// Removes the item at `index` from a bucket holding `count` items, and returns the bucket to use
+// in its place: the same one, a smaller one, or null if it's now empty.
+Value SparseArray::deleteFromBucket(Array bucket, unsigned index, unsigned count) {
+    if (count <= 1) {
+        releaseBucket(bucket);
         return nullvalue;
     }
+    unsigned bucketSize = bucket.size();
+    if (count - 1 <= bucketSize / 4 && bucketSize / 2 >= kMinBucketSize) {
+        // The bucket's mostly empty; move the remaining items into one half the size.
+        // (Not sooner, or alternating inserts and deletes would keep reallocating.)
+        Handle hb(&bucket, *_heap);
+        if_let(newBucket, allocBucket(bucketSize / 2)) {
+            for (unsigned i = 0, j = 0; i < count; ++i) {
+                if (i != index)
+                    newBucket[j++] = bucket[i];
+            }
+            releaseBucket(bucket);
+            return newBucket;
+        }
+        // If allocation fails, just remove the item in place.
+    }
+    for (unsigned i = index; i + 1 < count; ++i)
+        bucket[i] = bucket[i + 1];
+    bucket[count - 1] = nullvalue;
+    return bucket;
 }
 
 
-unsigned SparseArray::indexInBucket(unsigned i) const {
-    auto bitmap = this->bitmap();
-    uint64_t* bits = &bitmap[i / 64];
-    unsigned index = popcount(*bits & (maskFor(i) - 1));
-    // Add in the earlier bits in the same bucket:
-    uint64_t* b = &bitmap[((i / kItemsPerBucket) * kItemsPerBucket) / 64];
-    while (b < bits)
-        index += popcount(*b++);
-    return index;
+#pragma mark - BUCKET POOL:
+
+
+// The index of a bucket's size class, or -1 if it's not a size class (from an older version.)
+int SparseArray::sizeClass(unsigned bucketSize) {
+    if (bucketSize < kMinBucketSize || bucketSize > kItemsPerBucket || !std::has_single_bit(bucketSize))
+        return -1;
+    return std::countr_zero(bucketSize) - std::countr_zero(kMinBucketSize);
+}
+
+
+Maybe<Array> SparseArray::bucketPool() const {
+    if (unsigned i = 1 + bucketCount(); _array.size() == i + 1) {
+        if_let(pool, _array[i].maybeAs<Array>()) {
+            if (pool.size() == kNumSizeClasses)
+                return pool;
+        }
+    }
+    return nullvalue;
+}
+
+
+// Returns an empty bucket Array, taking it from the pool if possible.
+Maybe<Array> SparseArray::allocBucket(unsigned size) {
+    if (int sc = sizeClass(size); sc >= 0) {
+        if_let(pool, bucketPool()) {
+            if_let(bucket, pool[sc].maybeAs<Array>()) {
+                if (bucket.size() == size) {
+                    pool[sc] = bucket[0];
+                    bucket[0] = nullvalue;
+                    return bucket;
+                }
+            }
+        }
+    }
+    return newArray(size, *_heap);
+}
+
+
+// Clears a bucket that's no longer used and adds it to the pool. (Never allocates.)
+void SparseArray::releaseBucket(Array bucket) {
+    if (int sc = sizeClass(bucket.size()); sc >= 0) {
+        if_let(pool, bucketPool()) {
+            for (Val &item : bucket)
+                item = nullvalue;
+            bucket[0] = pool[sc];
+            pool[sc] = bucket;
+        }
+    }
+}
+
+
+void SparseArray::recycleBucketsFrom(SparseArray &other) {
+    assert(other._heap == _heap);
+    unsigned n = other.bucketCount();
+    for (unsigned b = 1; b <= n; ++b) {
+        if_let(bucket, other._array[b].maybeAs<Array>()) {
+            other._array[b] = nullvalue;
+            releaseBucket(bucket);
+        }
+    }
+    for (uint64_t &word : other.bitmap())
+        word = 0;
+}
+
+
+unsigned SparseArray::pooledBucketCount() const {
+    unsigned count = 0;
+    if_let(pool, bucketPool()) {
+        for (unsigned sc = 0; sc < kNumSizeClasses; ++sc) {
+            unsigned size = kMinBucketSize << sc;
+            for (auto bucket = pool[sc].maybeAs<Array>(); bucket && bucket.value().size() == size;
+                    bucket = bucket.value()[0].maybeAs<Array>())
+                ++count;
+        }
+    }
+    return count;
 }
 
 
@@ -7,9 +7,25 @@
 #pragma once
 #include "Collections.hh"
 #include "Heap.hh"
+#include <algorithm>
+#include <bit>
 
 namespace snej::smol {
 
+    /// Population count. Without the POPCNT instruction (`-mpopcnt`, or `SMOL_NATIVE`), x86
+    /// compilers call a libgcc function for `std::popcount`; this inline version is faster.
+    inline unsigned popcount64(uint64_t x) {
+#if defined(__x86_64__) && !defined(__POPCNT__)
+        x = x - ((x >> 1) & 0x5555555555555555);
+        x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
+        return unsigned((x * 0x0101010101010101) >> 56);
+#else
+        return unsigned(std::popcount(x));
+#endif
+    }
+
+
     /// An object that acts like an Array but only allocates spaces for its non-null items.
     class SparseArray {
     public:
@@ -40,35 +56,107 @@ namespace snej::smol {
 
         friend std::ostream& operator<< (std::ostream &out, SparseArray const& array);
 
-        /// Calls the function `v` for every item. Its signature should be `(unsigned,Value)->bool`.
+        /// Calls the function `v` for every non-null item, in order. Its signature should be
+        /// `(unsigned,Value)->bool`; if it returns false, iteration stops and `visit` returns
+        /// false. The visitor may allocate, even triggering GC, but must not modify this array.
         template <typename Visitor>
         bool visit(Visitor v) const {
-            unsigned start = 0;
+            // Jumps straight to the set bits, and walks each bucket's items in order instead of
+            // computing each one's index. The bucket is looked up again for every item, though,
+            // in case the visitor triggered a GC that moved it.
             unsigned nWords = _bitmap.size() / 8;
-            for (unsigned word = 0; word < nWords; ++word) {
-                uint64_t bits = bitmap()[word], mask = 1;
-                for (unsigned i = 0; i < 64; ++i, mask <<= 1) {
-                    if ((bits & mask) && !v(start + i, get(start + i)))
-                        return false;
+            for (unsigned word = 0; word < nWords; word += kWordsPerBucket) {
+                unsigned bucket = 1 + word / kWordsPerBucket;
+                unsigned item = 0;
+                for (unsigned w = word; w < std::min(word + kWordsPerBucket, nWords); ++w) {
+                    for (uint64_t bits = bitmap()[w]; bits != 0; bits &= bits - 1) {
+                        unsigned i = w * 64 + std::countr_zero(bits);
+                        if (!v(i, Value(_array[bucket].as<Array>()[item++])))
+                            return false;
+                    }
                 }
-                start += 64;
             }
             return true;
         }
 
+        /// Starting at index `i`, calls `match` with consecutive non-null items, wrapping around
+        /// at the end of the array, until it returns true or the next item is null. Returns the
+        /// index where it stopped, and true if `match` returned true there.
+        /// This is a linear probe, as in a hash table: it finds the item's position in its
+        /// bucket once, then steps through the bucket. The array must contain a null, and
+        /// `match` (with signature `(Value)->bool`) must not allocate.
+        template <typename Match>
+        std::pair<unsigned,bool> probe(unsigned i, Match match) const {
+            assert(i < size());
+            slice<uint64_t> words = bitmap();
+            while (words[i / 64] & maskFor(i)) {
+                Array bucket = bucketFor(i).value();
+                unsigned item = indexInBucket(words, i);
+                unsigned end = std::min((i / kItemsPerBucket + 1) * kItemsPerBucket, size());
+                do {
+                    if (match(Value(bucket[item++])))
+                        return {i, true};
+                } while (++i < end && (words[i / 64] & maskFor(i)));
+                if (i == size())
+                    i = 0;
+            }
+            return {i, false};
+        }
+
+        /// Hints to the CPU that item `i` will be looked up soon, by prefetching its bitmap
+        /// word and the start of its bucket. Lets a caller with several lookups to do overlap
+        /// their cache misses, instead of waiting for each in turn.
+        void prefetch(unsigned i) const {
+            assert(i < size());
+            _prefetch(&bitmap()[i / 64]);
+            _prefetch(_array[1 + i / kItemsPerBucket].block());
+        }
+
+        /// Moves all of `other`'s buckets into this array's pool of free buckets, to be reused
+        /// as this array's buckets grow; `other` is left empty. Both must be in the same Heap.
+        /// A hash table calls this after migrating its items into a bigger array.
+        void recycleBucketsFrom(SparseArray &other);
+
+        /// The number of free bucket Arrays in the pool, waiting to be reused.
+        unsigned pooledBucketCount() const;
+
         void setHeap(Heap &heap)   {_heap = &heap; _array.setHeap(heap); _bitmap.setHeap(heap);}
 
     private:
         static constexpr unsigned kItemsPerBucket = 2 * 64;
         static constexpr unsigned kBytesPerBucket = kItemsPerBucket / 8;
+        static constexpr unsigned kWordsPerBucket = kItemsPerBucket / 64;
+
+        // Bucket Arrays come in power-of-two size classes, from kMinBucketSize to kItemsPerBucket.
+        static constexpr unsigned kMinBucketSize  = 4;
+        static constexpr unsigned kNumSizeClasses = 6;
+        static_assert(kMinBucketSize << (kNumSizeClasses - 1) == kItemsPerBucket);
 
         static Array makeArray(unsigned size, Heap &);
         slice<uint64_t> bitmap() const {return slice_cast<uint64_t>(_bitmap.bytes());}
+        unsigned bucketCount() const              {return (size() + kItemsPerBucket - 1) / kItemsPerBucket;}
         Maybe<Array> bucketFor(unsigned i) const  {return _array[1 + (i / kItemsPerBucket)].maybeAs<Array>();}
-        uint64_t maskFor(unsigned i) const         {return 1ull << (i & 63);}
-        unsigned indexInBucket(unsigned i) const;
+        unsigned bucketItemCount(unsigned i) const;
+        static uint64_t maskFor(unsigned i)        {return 1ull << (i & 63);}
+        unsigned indexInBucket(unsigned i) const   {return indexInBucket(bitmap(), i);}
+
+        /// The number of non-null items before `i` in its bucket: the popcount of the bits before
+        /// it in its bitmap word, plus, if that's the bucket's second word, the popcount of the
+        /// first. (Computed without branching, since hash-table indexes are unpredictable.)
+        static unsigned indexInBucket(slice<uint64_t> words, unsigned i) {
+            static_assert(kWordsPerBucket == 2);
+            unsigned w = i / 64;
+            unsigned first = popcount64(words[w & ~1u]) & -(w & 1);
+            return first + popcount64(words[w] & (maskFor(i) - 1));
+        }
+
         Maybe<Array> insertIntoBucket(Maybe<Array> bucket, unsigned index);
-        Value deleteFromBucket(Array bucket, unsigned index);
+        Value deleteFromBucket(Array bucket, unsigned index, unsigned count);
+
+        static int sizeClass(unsigned bucketSize);
+        Maybe<Array> bucketPool() const;
+        Maybe<Array> allocBucket(unsigned size);
+        void releaseBucket(Array bucket);
 
         Heap*           _heap;      // The heap; needed for reallocating bucket arrays
         Handle<Array>   _array;     // The root array
@@ -18,8 +18,8 @@
 
 #include "SymbolTable.hh"
 #include "Heap.hh"
-#include <iomanip>
-#include <iostream>
+#include "Log.hh"
+#include <atomic>
 #include <cmath>
 
 namespace snej::smol {
@@ -74,14 +74,21 @@ std::unique_ptr<SymbolTable> SymbolTable::rebuild(Heap *heap) {
     });
     assert(maxID < 0xFFFF);
     table->_nextID = Symbol::ID(maxID + 1);
-    if (!ok)
+    if (!ok) {
+        SMOL_LOG(SymbolLog, Warning, "Couldn't rebuild symbol table of heap %p", (void*)heap);
         return nullptr;
+    }
+    SMOL_LOG(SymbolLog, Info, "Rebuilt symbol table of heap %p: %u symbols", (void*)heap, count);
     return table;
 }
 
 
+static std::atomic<uint64_t> sLastSerial = 0;
+
+
 SymbolTable::SymbolTable(Heap *heap, Array array, bool empty)
 :_table(*heap, array)
+,_serial(++sLastSerial)
 {
     if (!empty) {
         int maxID = -1;
@@ -97,21 +104,84 @@ SymbolTable::SymbolTable(Heap *heap, Array array, bool empty)
 
 
 Maybe<Symbol> SymbolTable::create(string_view str) {
-    if (_nextID == Symbol::ID::None)
+    Symbol::ID firstID = _nextID;
+    auto sym = create(str, HashSet::computeHash(str));
+    if (_nextID != firstID)
+        _table.heap().setSymbolTableArray(_table.array());
+    return sym;
+}
+
+
+// Finds or creates a Symbol, but doesn't update the Heap's symbol table pointer.
+Maybe<Symbol> SymbolTable::create(string_view str, int32_t hashCode) {
+    if (_nextID == Symbol::ID::None) {
+        if_let(sym, Maybe<Symbol>(_table.find(str, hashCode)))
+            return sym;
+        SMOL_LOG(SymbolLog, Warning, "Symbol table of heap %p is full; can't add \"%.*s\"",
+                 (void*)&_table.heap(), int(str.size()), str.data());
         return nullvalue;           // Overflow!
+    }
     bool inserted = false;
-    auto sym = _table.findOrInsert(str, [&](Heap &heap) {
+    auto sym = _table.findOrInsert(str, hashCode, [&](Heap &heap) {
         inserted = true;
         return Maybe<Symbol>(Symbol::create(_nextID, str, heap));
     });
-    if (inserted) {
+    if (inserted)
         _nextID = Symbol::ID(unsigned(_nextID) + 1);
-        _table.heap().setSymbolTableArray(_table.array());
-    }
     return Maybe<Symbol>(sym);
 }
 
 
+// `createBatch` works on this many strings at a time, so their hashes fit on the stack.
+static constexpr uint32_t kBatchSize = 64;
+
+
+bool SymbolTable::createBatch(slice<const string_view> strs, slice<Maybe<Symbol>> symbols) {
+    assert(symbols.size() >= strs.size());
+    Symbol::ID firstID = _nextID;
+    bool ok = true;
+    _table.heap().preventGCDuring([&] {
+        for (uint32_t start = 0; start < strs.size(); start += kBatchSize) {
+            uint32_t n = std::min(strs.size() - start, kBatchSize);
+            auto names = strs(start, n);
+            auto results = symbols(start, n);
+
+            // Hash all the strings first, prefetching the table slot each one will probe...
+            int32_t hashes[kBatchSize];
+            for (uint32_t i = 0; i < n; ++i) {
+                hashes[i] = HashSet::computeHash(names[i]);
+                _table.prefetch(hashes[i]);
+            }
+            // ...so that by the time they're looked up, the slots are likely in the cache:
+            uint32_t misses = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                results[i] = Maybe<Symbol>(_table.find(names[i], hashes[i]));
+                if (!results[i])
+                    ++misses;
+            }
+            if (misses == 0)
+                continue;
+
+            // Create the missing Symbols, making room for all of them at once:
+            if (!_table.reserve(misses)) {
+                ok = false;
+                return;
+            }
+            for (uint32_t i = 0; i < n; ++i) {
+                if (!results[i]) {
+                    // (A string may be repeated in the batch, in which case this finds it.)
+                    results[i] = create(names[i], hashes[i]);
+                    ok = ok && results[i];
+                }
+            }
+        }
+    });
+    if (_nextID != firstID)
+        _table.heap().setSymbolTableArray(_table.array());
+    return ok;
+}
+
+
 Maybe<Symbol> SymbolTable::find(Symbol::ID id) const {
     Maybe<Symbol> result;
     visit([&](Symbol key) {
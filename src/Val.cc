@@ -89,7 +89,7 @@ const char* TypeName(Type t) {
     static constexpr const char* kTypeNames[int(Type::Max)+1] = {
         "float", "bigint", "string", "symbol", "blob",
         "array", "vector", "dict",
-        "?8?", "?9?", "?10?", "?11?", "?12?", "?13?", "?14?", "?15?",
+        "pad", "?9?", "?10?", "?11?", "?12?", "?13?", "?14?", "?15?",
         "null", "bool", "int"
     };
     if (t > Type::Max) return "!BAD_TYPE!";
@@ -0,0 +1,168 @@
+//
+// Test_Compare.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "smol_world.hh"
+#include "HashTable.hh"
+#include "catch.hpp"
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace snej::smol;
+
+
+TEST_CASE("Deep Compare Scalars", "[compare]") {
+    Heap heap(10000);
+    UsingHeap u(heap);
+
+    // Values in ascending order; adjacent ones in a group are deeply equal.
+    vector<vector<Value>> groups = {
+        {nullvalue},
+        {Bool(false)},
+        {Bool(true)},
+        {newFloat(-1e30, heap).value()},
+        {-12, newBigInt(-12, heap).value()},
+        {0},
+        {newFloat(-0.0, heap).value(), newFloat(0.0, heap).value()},
+        {newFloat(0.5, heap).value()},
+        {newInt(int64_t(1) << 40, heap), newBigInt(int64_t(1) << 40, heap).value()},
+        {newFloat(1e30, heap).value()},
+        {newFloat(NAN, heap).value(), newFloat(-NAN, heap).value()},
+        {newString("", heap).value()},
+        {newString("hello", heap).value(), newString("hello", heap).value()},
+        {newString("hello!", heap).value()},
+        {newString("help", heap).value()},
+        {newSymbol("hello", heap).value()},
+        {newBlob("\x00\xFF", 2, heap).value(), newBlob("\x00\xFF", 2, heap).value()},
+        {newBlob("\x01", 1, heap).value()},
+    };
+
+    vector<pair<size_t,Value>> all;
+    for (size_t g = 0; g < groups.size(); ++g)
+        for (Value v : groups[g])
+            all.emplace_back(g, v);
+    for (auto [g1, a] : all) {
+        for (auto [g2, b] : all) {
+            INFO("Comparing " << a << " with " << b);
+            int expected = (g1 < g2) ? -1 : (g1 > g2);
+            int cmp = deepCompare(a, b);
+            CHECK((cmp < 0 ? -1 : cmp > 0) == expected);
+            CHECK(deepEquals(a, b) == (expected == 0));
+            if (expected == 0)
+                CHECK(deepHash(a) == deepHash(b));
+            // Scalars hash and compare the same as HashMap keys:
+            CHECK(HashMap::keysEqual(a, b) == deepEquals(a, b));
+        }
+        CHECK(HashMap::computeHash(a) == deepHash(a));
+    }
+
+    // An integer equal to a Float sorts first, but they aren't equal:
+    CHECK(!deepEquals(7, newFloat(7.0, heap).value()));
+    CHECK(deepCompare(7, newFloat(7.0, heap).value()) < 0);
+    CHECK(deepCompare(newFloat(7.0, heap).value(), 7) > 0);
+    CHECK(deepCompare(8, newFloat(7.5, heap).value()) > 0);
+    CHECK(deepCompare(newBigInt(INT64_MAX, heap).value(), newFloat(0x1p63, heap).value()) < 0);
+    CHECK(deepCompare(newBigInt(INT64_MIN, heap).value(), newFloat(-0x1p63, heap).value()) < 0);
+}
+
+
+TEST_CASE("Deep Compare Containers", "[compare]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    string json = R"({"name": "Alice", "tags": ["x", "y", 1.5, null, true],
+                      "addr": {"city": "Paris", "zip": 75001, "geo": [48.85, 2.35]},
+                      "empty": {}, "none": []})";
+    Handle a(newFromJSON(json, heap), heap);
+    Handle b(newFromJSON(json, heap), heap);
+    REQUIRE(a.is<Dict>());
+    REQUIRE(Value(a) != Value(b));
+
+    CHECK(deepEquals(a, b));
+    CHECK(deepCompare(a, b) == 0);
+    CHECK(deepHash(a) == deepHash(b));
+    CHECK(deepEquals(a, a));
+
+    auto check = [&](const char *json1, const char *json2, int expected) {
+        INFO("Comparing " << json1 << " with " << json2);
+        Handle x(newFromJSON(string_view(json1), heap), heap);
+        Handle y(newFromJSON(string_view(json2), heap), heap);
+        int cmp = deepCompare(x, y);
+        CHECK((cmp < 0 ? -1 : cmp > 0) == expected);
+        CHECK((deepCompare(y, x) < 0 ? -1 : deepCompare(y, x) > 0) == -expected);
+        CHECK(deepEquals(x, y) == (expected == 0));
+        if (expected == 0)
+            CHECK(deepHash(x) == deepHash(y));
+        else
+            CHECK(deepHash(x) != deepHash(y));      // (not guaranteed, but very likely)
+    };
+    check("[]", "[]", 0);
+    check("[1, [2, [3]]]", "[1, [2, [3]]]", 0);
+    check("[1, [2, [3]]]", "[1, [2, [4]]]", -1);
+    check("[1, 2]", "[1, 2, 3]", -1);
+    check("[1, 2, 3]", "[2]", -1);
+    check("[[1, 2], 3]", "[[1, 2, 0]]", -1);
+    check("[[1], [2]]", "[[1, 2]]", -1);
+    check("[-0.0]", "[0.0]", 0);
+    check(R"(["a", "b"])", R"(["a", "b"])", 0);
+    check(R"({"a": 1, "b": [2]})", R"({"b": [2], "a": 1})", 0);
+    check(R"({"a": 1, "b": [2]})", R"({"a": 1, "b": [3]})", -1);
+    check(R"({"a": 1})", R"({"a": 1, "b": 2})", -1);
+    check(R"({"a": 1})", R"({"b": 1})", deepCompare(newSymbol("a", heap).value(),
+                                                    newSymbol("b", heap).value()));
+    check("[1]", R"({"a": 1})", -1);
+    check("[1]", "1", 1);
+
+    // Arrays and Vectors with the same items aren't equal:
+    Handle vec(newFromJSON(string_view("[1, 2]"), heap), heap);
+    REQUIRE(vec.is<Vector>());
+    Handle arr(newArray(vec.as<Vector>().items(), 2, heap).value(), heap);
+    REQUIRE(arr.is<Array>());
+    CHECK(!deepEquals(vec, arr));
+    CHECK(deepCompare(arr, vec) < 0);
+
+    // Results don't change across GC:
+    Array pair = newArray(2, heap).value();
+    pair[0] = a;
+    pair[1] = b;
+    heap.setRoot(pair);
+    int32_t hash = deepHash(a);
+    GarbageCollector::run(heap);
+    Array root = heap.root().value().as<Array>();
+    CHECK(Value(root[0]) != Value(root[1]));
+    CHECK(deepEquals(root[0], root[1]));
+    CHECK(deepHash(root[0]) == hash);
+}
+
+
+TEST_CASE("Deep Compare Deep Nesting", "[compare]") {
+    // Comparison doesn't recurse, so very deep nesting doesn't overflow the stack:
+    constexpr int kDepth = 100000;
+    Heap heap(kDepth * 64);
+    UsingHeap u(heap);
+    auto nest = [&](Value v) {
+        for (int i = 0; i < kDepth; ++i)
+            v = newArray(1, v, heap).value();
+        return v;
+    };
+    Value a = nest(1), b = nest(1), c = nest(2);
+    CHECK(deepEquals(a, b));
+    CHECK(deepHash(a) == deepHash(b));
+    CHECK(deepCompare(a, b) == 0);
+    CHECK(!deepEquals(a, c));
+    CHECK(deepCompare(a, c) < 0);
+}
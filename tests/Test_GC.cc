@@ -17,8 +17,12 @@
 //
 
 #include "smol_world.hh"
+#include "HeapProfiler.hh"
+#include "Log.hh"
 #include "catch.hpp"
+#include <algorithm>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
 using namespace snej::smol;
@@ -31,11 +35,11 @@ TEST_CASE("GC", "[gc]") {
 
     auto gc = [&] {
         cout << "__________ BEFORE GC __________\n";
-        heap.dump(cout);
+        heap.dump(cout, true);
         CHECK(heap.validate());
         GarbageCollector::run(heap);
         cout << "__________ AFTER GC __________\n";
-        heap.dump(cout);
+        heap.dump(cout, true);
         CHECK(heap.validate());
     };
 
@@ -96,3 +100,221 @@ TEST_CASE("GC On Demand", "[gc]") {
     }
     cout << "End -- used " << heap.used() << " free " << heap.available() << endl;
 }
+
+
+TEST_CASE("GC Order", "[gc]") {
+    Heap heap(10000);
+    UsingHeap u(heap);
+    string json = R"([[["a"], ["b"]], [["c"], ["d"]], {"x": [1, "e"]}])";
+    heap.setRoot(newFromJSON(json, heap).as<Object>());
+    string expectedJSON = toJSON(heap.root());
+
+    auto posOf = [&](std::initializer_list<int> path) {
+        Value v = heap.root();
+        for (int i : path)
+            v = v.as<Vector>()[i];
+        return heap.pos(v.block());
+    };
+
+    // Breadth-first: all of the second level precedes the third.
+    GarbageCollector::run(heap, GCOrder::BreadthFirst);
+    CHECK(heap.validate());
+    CHECK(toJSON(heap.root()) == expectedJSON);
+    CHECK(posOf({0, 0, 0}) > posOf({1, 1}));
+
+    // Depth-first: the children of [0] are followed by their subtrees, before [1]'s children.
+    GarbageCollector::run(heap, GCOrder::DepthFirst);
+    CHECK(heap.validate());
+    CHECK(toJSON(heap.root()) == expectedJSON);
+    CHECK(posOf({0}) < posOf({1}));
+    CHECK(posOf({0, 0}) < posOf({0, 1}));
+    CHECK(posOf({0, 1}) < posOf({0, 0, 0}));
+    CHECK(posOf({0, 1, 0}) < posOf({1, 0}));
+    CHECK(posOf({2}) < posOf({0, 0}));      // but a container's children are still together
+}
+
+
+TEST_CASE("GC Deduplicate", "[gc]") {
+    Heap heap(10000);
+    UsingHeap u(heap);
+    string json = R"([{"user": {"name": "x", "tags": ["a", "b"]}, "n": 1.5},
+                      {"user": {"name": "x", "tags": ["a", "b"]}, "n": 1.5},
+                      {"user": {"name": "y", "tags": ["a", "b"]}, "n": 2},
+                      "a", "hello", "hello", []])";
+    heap.setRoot(newFromJSON(json, heap).as<Object>());
+    string expectedJSON = toJSON(heap.root());
+    auto at = [&](std::initializer_list<int> path) {
+        Value v = heap.root();
+        for (int i : path)
+            v = v.is<Vector>() ? Value(v.as<Vector>()[i]) : Value(v.as<Dict>().begin()[i].value);
+        return v;
+    };
+    CHECK(at({0}) != at({1}));
+    CHECK(at({4}) != at({5}));
+
+    size_t used = heap.used();
+    size_t shared = GarbageCollector::runDeduplicating(heap);
+    cout << "Deduplicated " << shared << " bytes; heap went from " << used << " to "
+         << heap.used() << endl;
+    CHECK(shared > 0);
+    CHECK(heap.used() < used);
+    CHECK(heap.validate());
+    CHECK(toJSON(heap.root()) == expectedJSON);
+
+    // Identical subtrees are now the same objects:
+    CHECK(at({0}) == at({1}));
+    CHECK(at({4}) == at({5}));
+    CHECK(at({3}) == at({0, 0, 1, 0}));                 // "a", at top level and in a tag list
+    CHECK(at({0, 0, 1}) == at({2, 0, 1}));              // ["a", "b"] inside different users
+    CHECK(at({0, 0}) != at({2, 0}));
+
+    // Doing it again finds nothing more:
+    CHECK(GarbageCollector::deduplicate(heap, heap.root()) == 0);
+
+    // An aligned Blob isn't replaced by an identical one that isn't aligned:
+    Array pair = newArray(2, heap).value();
+    heap.setRoot(pair);
+    Block *aligned = heap.allocBlock(64, Type::Blob, 64);
+    REQUIRE(aligned);
+    aligned->fill(slice<byte>{});
+    pair[0] = Value(aligned);
+    pair[1] = newBlob(aligned->dataPtr(), 64, heap).value();
+    CHECK(uintptr_t(pair[1].block()->dataPtr()) % 64 != 0);
+    GarbageCollector::runDeduplicating(heap);
+    CHECK(heap.validate());
+    pair = heap.root().value().as<Array>();
+    CHECK(uintptr_t(pair[0].block()->dataPtr()) % 64 == 0);
+}
+
+
+TEST_CASE("GC Deduplicate Cycles", "[gc]") {
+    Heap heap(10000);
+    UsingHeap u(heap);
+    // Two identical arrays that each contain themselves, and two identical strings:
+    Handle<Array> root = newArray(4, heap).value();
+    heap.setRoot(root);
+    for (int i = 0; i < 2; ++i) {
+        Array a = newArray(2, heap).value();
+        root[i] = a;
+        a[0] = a;
+        root[i + 2] = newString("same", heap).value();
+        root[i].as<Array>()[1] = root[i + 2];
+    }
+    CHECK(GarbageCollector::runDeduplicating(heap) > 0);
+    CHECK(heap.validate());
+    auto item = [&](int i) {return Value(heap.root().value().as<Array>()[i]);};
+    CHECK(item(2) == item(3));
+    CHECK(Value(item(0).as<Array>()[0]) == item(0));   // the cycles are intact
+    CHECK(Value(item(1).as<Array>()[0]) == item(1));
+    CHECK(Value(item(0).as<Array>()[1]) == item(2));
+}
+
+
+static vector<string> sLogMessages;
+
+TEST_CASE("GC Logging", "[gc]") {
+    setLogSink([](LogDomain const& domain, LogLevel level, const char *message) {
+        sLogMessages.push_back(string(domain.name()) + ": " + message);
+    });
+    GCLog.setLevel(LogLevel::Info);
+    HeapLog.setLevel(LogLevel::Verbose);
+
+    {
+        Heap heap(10000);
+        UsingHeap u(heap);
+        GarbageCollector::runOnDemand(heap);
+        for (int i = 0; i < 20; ++i)
+            REQUIRE(newBlob(1000, heap));
+    }
+
+    setLogSink(nullptr);
+    GCLog.setLevel(LogLevel::Warning);
+    HeapLog.setLevel(LogLevel::Warning);
+
+    for (auto &msg : sLogMessages)
+        cout << msg << endl;
+    auto logged = [&](const char *prefix) {
+        return std::any_of(sLogMessages.begin(), sLogMessages.end(), [&](string const& msg) {
+            return msg.starts_with(prefix);
+        });
+    };
+    if (kMaxLogLevel >= LogLevel::Verbose)      // (Verbose messages are compiled out with NDEBUG)
+        CHECK(logged("Heap: Heap "));
+    CHECK(logged("GC: Collected heap "));
+    sLogMessages.clear();
+}
+
+
+TEST_CASE("Heap Profiler", "[gc]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    HeapProfiler profiler(heap, 1024);
+    GarbageCollector::runOnDemand(heap);
+
+    Handle<Array> keep = newArray(50, heap).value();
+    heap.setRoot(keep);
+    for (int i = 0; i < 500; ++i) {
+        if (i % 10 == 0) {
+            HeapProfiler::Tag tag("keep");
+            keep[i / 10] = newBlob(900, heap).value();
+        } else {
+            HeapProfiler::Tag tag("temp");
+            REQUIRE(newString(string(400, 'x'), heap));
+        }
+    }
+    profiler.dump(cout);
+
+    // Only the tagged blobs in the root array, and recent garbage, should be live:
+    auto sites = profiler.liveSites();
+    REQUIRE(!sites.empty());
+    size_t keepBytes = 0, tempBytes = 0;
+    for (auto &site : sites) {
+        if (site.name == "keep") {
+            CHECK(site.type == Type::Blob);
+            keepBytes += site.bytes;
+        } else if (site.name == "temp") {
+            CHECK(site.type == Type::String);
+            tempBytes += site.bytes;
+        }
+    }
+    CHECK(keepBytes > 40 * 900);
+    CHECK(keepBytes < 60 * 900);
+    CHECK(tempBytes < 100000);
+
+    HeapCensus census(heap);
+    census.write(cout);
+    CHECK(census.byType[int(Type::Blob)].live.count == 50);
+    CHECK(census.byType[int(Type::Array)].live.count == 1);
+    CHECK(census.byType[int(Type::String)].live.count == 0);
+    CHECK(census.live.bytes + census.dead.bytes == heap.used() - Heap::Overhead);
+    CHECK(census.headerBytes == 50 * 4 + 2);
+}
+
+
+TEST_CASE("GC Perf Counters", "[gc]") {
+    Heap heap(10000);
+    UsingHeap u(heap);
+    heap.setRoot(newString("root", heap).value());
+    for (int i = 0; i < 20; ++i)
+        REQUIRE(newString("garbage", heap));
+
+    PerfRegion::resetAll();
+    if (PerfRegion::setEnabled(true)) {
+        GarbageCollector::run(heap);
+        GarbageCollector::run(heap);
+        PerfRegion::setEnabled(false);
+        CHECK(GCPerf.runs() == 2);
+        if (PerfCounts::available(PerfEvent::Instructions))
+            CHECK(GCPerf.totals()[PerfEvent::Instructions] > 0);
+        PerfRegion::writeStats(cout);
+        stringstream json;
+        PerfRegion::writeJSON(json);
+        CHECK(json.str().find("\"GC\":{\"runs\":2,") != string::npos);
+    } else {
+        // Counters aren't available on this platform or machine, so nothing is counted:
+        GarbageCollector::run(heap);
+        CHECK(!PerfRegion::enabled());
+        CHECK(GCPerf.runs() == 0);
+    }
+    PerfRegion::resetAll();
+}
@@ -17,8 +17,13 @@
 //
 
 #include "smol_world.hh"
+#include "HeapProfiler.hh"
 #include "catch.hpp"
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 using namespace std;
 using namespace snej::smol;
@@ -165,3 +170,357 @@ TEST_CASE("Alloc Bigger Objects", "[heap]")     {testAllocRangeOfSizes(900,   50
 TEST_CASE("Alloc Big Objects", "[heap]")        {testAllocRangeOfSizes(Block::LargeSize - 50, 100);}
 TEST_CASE("Alloc Real Big Objects", "[heap]")   {testAllocRangeOfSizes(99990,  20);}
 TEST_CASE("Alloc Huge Objects", "[heap]")       {testAllocRangeOfSizes(Block::MaxSize - 2,  2);}
+
+
+TEST_CASE("Heap Containing", "[heap]") {
+    std::vector<std::unique_ptr<Heap>> heaps;
+    for (int i = 0; i < 100; ++i)
+        heaps.push_back(std::make_unique<Heap>(1000));
+    std::vector<Block*> blocks;
+    for (auto &heap : heaps)
+        blocks.push_back(heap->allocBlock(10, Type::Blob));
+
+    for (size_t i = 0; i < heaps.size(); ++i) {
+        CHECK(Heap::heapContaining(blocks[i]) == heaps[i].get());
+        CHECK(Heap::heapContaining(blocks[i]->dataPtr()) == heaps[i].get());
+        // Unallocated space past `used` isn't contained:
+        CHECK(Heap::heapContaining((byte*)heaps[i]->base() + heaps[i]->used()) == nullptr);
+    }
+    int local;
+    CHECK(Heap::heapContaining(&local) == nullptr);
+
+    // After a Heap is destroyed or moved, lookups reflect that:
+    Block *block = blocks[10];
+    CHECK(Heap::heapContaining(block) == heaps[10].get());
+    heaps[10].reset();
+    CHECK(Heap::heapContaining(block) == nullptr);
+
+    Heap moved = std::move(*heaps[20]);
+    CHECK(Heap::heapContaining(blocks[20]) == &moved);
+
+    // GC swaps the memory of two Heaps:
+    Heap &heap = *heaps[30];
+    UsingHeap u(heap);
+    heap.setRoot(Value(heap.allocBlock(10, Type::Blob)).as<Object>());
+    Block *oldRoot = heap.root().value().block();
+    CHECK(Heap::heapContaining(oldRoot) == &heap);
+    GarbageCollector::run(heap);
+    CHECK(Heap::heapContaining(oldRoot) == nullptr);
+    CHECK(Heap::heapContaining(heap.root().value().block()) == &heap);
+}
+
+
+TEST_CASE("Heap Containing Nested", "[heap]") {
+    // A Heap that lives in a Blob inside another Heap:
+    Heap outer(10000);
+    Block *before = outer.allocBlock(10, Type::Blob);
+    Block *blob = outer.allocBlock(2000, Type::Blob);
+    Block *after = outer.allocBlock(10, Type::Blob);
+
+    Heap original(2000);
+    Block *originalBlock = original.allocBlock(10, Type::Blob);
+    byte *innerBase = (byte*)blob->dataPtr();
+    ::memcpy(innerBase, original.base(), original.used());
+    Heap inner = Heap::existing({innerBase, original.used()}, 2000);
+    REQUIRE(!inner.invalid());
+    Block *innerBlock = (Block*)(innerBase + ((byte*)originalBlock - (byte*)original.base()));
+
+    // Look up each address twice, to exercise the cache:
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(Heap::heapContaining(before) == &outer);
+        CHECK(Heap::heapContaining(innerBlock) == &inner);
+        CHECK(Heap::heapContaining(after) == &outer);
+        CHECK(Heap::heapContaining(innerBlock) == &inner);
+        // Space in the Blob past the inner Heap's end belongs to the outer Heap:
+        CHECK(Heap::heapContaining(innerBase + inner.capacity() - 1) == &outer);
+        CHECK(Heap::heapContaining(before) == &outer);
+    }
+}
+
+
+TEST_CASE("Heap Containing Many Nested", "[heap]") {
+    // Many Heaps in Blobs of one outer Heap, with one more nested in the first of them:
+    Heap outer(100000);
+    std::vector<Block*> gaps;
+    std::vector<std::unique_ptr<Heap>> inners;
+    for (int i = 0; i < 50; ++i) {
+        gaps.push_back(outer.allocBlock(10, Type::Blob));
+        Block *blob = outer.allocBlock(1000, Type::Blob);
+        inners.push_back(std::make_unique<Heap>(blob->dataPtr(), 1000));
+    }
+    Block *innerBlob = inners[0]->allocBlock(500, Type::Blob);
+    auto innermost = std::make_unique<Heap>(innerBlob->dataPtr(), 500);
+    Block *innermostBlock = innermost->allocBlock(10, Type::Blob);
+    Block *last = outer.allocBlock(10, Type::Blob);
+
+    std::vector<Block*> innerBlocks;
+    for (auto &inner : inners)
+        innerBlocks.push_back(inner->allocBlock(10, Type::Blob));
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < inners.size(); ++i) {
+            CHECK(Heap::heapContaining(gaps[i]) == &outer);
+            CHECK(Heap::heapContaining(innerBlocks[i]) == inners[i].get());
+        }
+        CHECK(Heap::heapContaining(innermostBlock) == innermost.get());
+        CHECK(Heap::heapContaining(last) == &outer);
+    }
+
+    // Removing the middle Heap re-links the innermost one to the outer:
+    inners[0].reset();
+    CHECK(Heap::heapContaining(innermostBlock) == innermost.get());
+    CHECK(Heap::heapContaining(innerBlocks[0]) == &outer);
+    innermost.reset();
+    CHECK(Heap::heapContaining(innermostBlock) == &outer);
+
+    // A Heap opened on another's contents shares its base, and takes precedence:
+    Heap copy = Heap::existing(inners[1]->contents(), inners[1]->used());
+    REQUIRE(!copy.invalid());
+    CHECK(Heap::heapContaining(innerBlocks[1]) == &copy);
+    CHECK(Heap::heapContaining(gaps[2]) == &outer);
+}
+
+
+TEST_CASE("Heap Threads", "[heap]") {
+    // Each worker creates its own Heaps, concurrently, and looks up its blocks:
+    std::atomic<int> failures = 0;
+    auto worker = [&](int n) {
+        for (int i = 0; i < 100; ++i) {
+            Heap heap(1000);
+            UsingHeap u(heap);
+            Block *block = heap.allocBlock(8, Type::Blob);
+            if (!heap.isOwnedByCurrentThread() || Heap::heapContaining(block) != &heap)
+                ++failures;
+            if (i % 10 == n % 10)
+                GarbageCollector::run(heap);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int n = 0; n < 4; ++n)
+        threads.emplace_back(worker, n);
+    for (auto &thread : threads)
+        thread.join();
+    CHECK(failures == 0);
+
+    // Hand a Heap off to another thread and back:
+    Heap heap(10000);
+    CHECK(heap.owner() == std::this_thread::get_id());
+    heap.release();
+    CHECK(heap.owner() == std::thread::id());
+    std::thread([&] {
+        heap.acquire();
+        CHECK(heap.isOwnedByCurrentThread());
+        {
+            UsingHeap u(heap);
+            heap.setRoot(newString("made in another thread", heap).value());
+        }
+        heap.release();                 // (a Heap can't be released while it's current)
+    }).join();
+    heap.acquire();
+    CHECK(heap.isOwnedByCurrentThread());
+    {
+        UsingHeap u(heap);
+        CHECK(heap.validate());
+        CHECK(heap.root().value().as<String>().str() == "made in another thread");
+    }
+
+    heap.transferTo(std::thread::id());   // (same as release)
+    CHECK(!heap.isOwnedByCurrentThread());
+    heap.acquire();
+}
+
+
+TEST_CASE("Heap Census", "[heap]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    Handle<Array> root = newArray(6, heap).value();
+    heap.setRoot(root);
+    root[0] = newString("hello", heap).value();
+    root[1] = newString("hello", heap).value();
+    root[2] = newString("goodbye", heap).value();
+    root[3] = newBlob(1000, heap).value();
+    root[4] = newVector(10, heap).value();
+    root[5] = newDict(4, heap).value();
+    newString("garbage", heap);
+
+    HeapCensus census(heap);
+    census.write(cout);
+    CHECK(census.live.count == 7);
+    CHECK(census.dead.count == 1);
+    CHECK(census.byType[int(Type::String)].live.count == 3);
+    CHECK(census.byType[int(Type::String)].dead.count == 1);
+    CHECK(census.largeHeaderCount == 1);
+    CHECK(census.largeHeaderFraction() == Approx(1.0 / 7));
+    CHECK(census.uniqueStrings == 2);
+    CHECK(census.duplicateStrings.count == 1);
+    CHECK(census.duplicateStrings.bytes == Block::sizeForData(5));
+    CHECK(census.unusedVectorBytes == 10 * sizeof(Val));
+    CHECK(census.unusedDictBytes == 4 * sizeof(DictEntry));
+
+    stringstream json;
+    census.writeJSON(json);
+    cout << json.str() << endl;
+    CHECK(json.str().starts_with(R"({"live":{"count":7,"bytes":)"));
+    CHECK(json.str().find(R"("duplicateStrings":{"count":1,"bytes":)"
+                          + to_string(Block::sizeForData(5)) + "}}") != string::npos);
+}
+
+
+static size_t countLiveBlocks(Heap &heap) {
+    size_t n = 0;
+    heap.visitBlocks([&](Block const&) {++n; return true;});
+    return n;
+}
+
+TEST_CASE("Heap Validate", "[heap]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    Handle<Array> root = newArray(2, heap).value();
+    heap.setRoot(root);
+
+    Handle<Vector> vec = newVector(4, heap).value();
+    root[0] = vec;
+    vec.append(newString("first", heap).value());
+    vec.append(newString("stale", heap).value());
+    vec.clear();                                // leaves a stale pointer in unused capacity
+    vec.append(newString("live", heap).value());
+
+    Handle<Dict> dict = newDict(4, heap).value();
+    root[1] = dict;
+    CHECK(dict.set(newSymbol("", heap).value(), 1));
+    CHECK(dict.set(newSymbol("b", heap).value(), 2));
+    CHECK(heap.validate());
+
+    // Only the used part of a Vector is live, so visitBlocks agrees with the GC:
+    size_t nLive = countLiveBlocks(heap);
+    CHECK(HeapCensus(heap).byType[int(Type::String)].live.count == 1);
+    GarbageCollector::run(heap);
+    CHECK(heap.validate());
+    CHECK(countLiveBlocks(heap) == nLive);
+
+    // A bad Vector count is detected:
+    Val &count = const_cast<Val&>(vec.block()->vals()[0]);
+    count = Value(100);
+    CHECK(!heap.validate());
+    count = Value(1);
+    CHECK(heap.validate());
+
+    // Out-of-order Dict keys are detected:
+    slice<Val> entries = dict.block()->vals();
+    Value key0 = entries[0], key1 = entries[2];
+    const_cast<Val&>(entries[0]) = key1;
+    const_cast<Val&>(entries[2]) = key0;
+    CHECK(!heap.validate());
+}
+
+
+TEST_CASE("Aligned Alloc", "[heap]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    CHECK(uintptr_t(heap.base()) % Block::kMaxAlignment == 0);
+    Handle<Array> root = newArray(12, heap).value();
+    heap.setRoot(root);
+
+    static constexpr heapsize kAlignments[] = {4, 8, 16, 64};
+    static constexpr heapsize kSizes[] = {1, 100, Block::LargeSize + 10};
+    int i = 0;
+    for (heapsize alignment : kAlignments) {
+        for (heapsize size : kSizes) {
+            REQUIRE(newString("garbage", heap));    // perturb the alignment
+            Block *block = heap.allocBlock(size, Type::Blob, alignment);
+            REQUIRE(block);
+            CHECK(uintptr_t(block->dataPtr()) % alignment == 0);
+            CHECK(block->dataSize() == size);
+            block->fill(slice<byte>{});
+            if (i % 2 == 0)
+                root[i / 2] = Value(block);
+            ++i;
+        }
+    }
+    // An aligned container works too:
+    Block *vecBlock = heap.allocBlock(8 * sizeof(Val), Type::Vector, 16);
+    REQUIRE(vecBlock);
+    vecBlock->fill(slice<Val>{});
+    vecBlock->vals()[0] = Value(0);
+    root[11] = Value(vecBlock);
+    CHECK(heap.validate());
+
+    // The GC preserves alignment, and drops the Pad blocks of garbage:
+    GarbageCollector::run(heap);
+    CHECK(heap.validate());
+    i = 0;
+    for (heapsize alignment : kAlignments) {
+        for (heapsize size : kSizes) {
+            if (i % 2 == 0) {
+                Block const* block = root[i / 2].block();
+                CHECK(uintptr_t(block->dataPtr()) % alignment == 0);
+                CHECK(block->dataSize() == size);
+            }
+            ++i;
+        }
+    }
+    CHECK(uintptr_t(root[11].block()->dataPtr()) % 16 == 0);
+    CHECK(HeapCensus(heap).byType[int(Type::Pad)].dead.count == 7);
+}
+
+
+TEST_CASE("Heap Splice", "[heap]") {
+    static constexpr std::string_view kJSON =
+        R"({"zebra":[1,"two",{"apple":3.5,"mango":null}],"apple":{"zebra":true},"kiwi":"fruit"})";
+    // Build the message in its own Heap, on another thread, along with an aligned Blob:
+    std::unique_ptr<Heap> message;
+    std::thread([&] {
+        message = std::make_unique<Heap>(10000);
+        {
+            UsingHeap u(*message);
+            Handle<Value> v = newFromJSON(kJSON, *message);
+            // (A parsed Dict has no spare capacity, so make room for another key:)
+            Handle<Dict> dict = message->grow(v.as<Dict>(), 4).value();
+            Symbol blobKey = newSymbol("blob", *message).value();
+            Block *blob = message->allocBlock(100, Type::Blob, 64);
+            blob->fill(slice<byte>{});
+            blob->data()[0] = byte(99);
+            CHECK(dict.set(blobKey, Value(blob)));
+            message->setRoot(dict);
+        }
+        message->release();
+    }).join();
+    message->acquire();
+    size_t messageUsed = message->used();
+
+    // The recipient already has some of the Symbols, with different IDs:
+    Heap heap(100000);
+    UsingHeap u(heap);
+    Handle<Value> before = newFromJSON(std::string_view(R"({"kiwi":1,"mango":2,"apple":3})"), heap);
+    heap.setRoot(before.as<Object>());
+    REQUIRE(newString("perturb the alignment", heap));
+
+    Handle<Maybe<Object>> spliced = heap.splice(*message);
+    REQUIRE(spliced);
+    CHECK(message->used() == messageUsed);
+    Dict dict = spliced.value().as<Dict>();
+    Block const* blob = dict.get(newSymbol("blob", heap).value()).block();
+    REQUIRE(blob);
+    CHECK(uintptr_t(blob->dataPtr()) % 64 == 0);
+    CHECK(blob->data()[0] == byte(99));
+    dict.remove(newSymbol("blob", heap).value());
+    // (Dicts are ordered by Symbol ID, and this Heap has different IDs:)
+    CHECK(toJSON(dict) == R"({"kiwi":"fruit","apple":{"zebra":true},"zebra":[1,"two",{"mango":null,"apple":3.5}]})");
+
+    // Keys are this Heap's Symbols, so lookups and validation work:
+    CHECK(dict.get(newSymbol("kiwi", heap).value()).as<String>().str() == "fruit");
+    CHECK(heap.symbolTable().find("zebra"));
+    CHECK(heap.validate());
+
+    // The copied Symbols are garbage, and don't confuse a rebuilt SymbolTable:
+    GarbageCollector::run(heap);
+    CHECK(heap.validate());
+    heap.dropSymbolTable();
+    CHECK(heap.symbolTable().size() == 5);
+    CHECK(toJSON(before) == R"({"kiwi":1,"mango":2,"apple":3})");
+
+    // An empty message, or one that doesn't fit, isn't spliced:
+    Heap empty(1000);
+    CHECK(!heap.splice(empty));
+    Heap tiny(100);
+    CHECK(!tiny.splice(*message));
+}
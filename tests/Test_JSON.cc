@@ -68,6 +68,98 @@ TEST_CASE("JSON", "[object],[json]") {
 }
 
 
+TEST_CASE("Wide JSON Objects", "[object],[json]") {
+    Heap heap(1000000);
+    UsingHeap u(heap);
+    GarbageCollector::runOnDemand(heap);
+
+    // An object with many keys, some of whose values are objects sharing some of its keys:
+    constexpr int NumKeys = 200;
+    string json = "{";
+    for (int i = 0; i < NumKeys; ++i) {
+        if (i > 0) json += ",";
+        json += "\"key" + std::to_string(i) + "\":";
+        if (i % 50 == 0)
+            json += "{\"key" + std::to_string(i) + "\":" + std::to_string(-i) + ",\"inner\":[{}]}";
+        else
+            json += std::to_string(i);
+    }
+    json += "}";
+
+    string err;
+    Handle<Value> v = newFromJSON(json, heap, &err);
+    INFO("Error is " << err);
+    REQUIRE(v);
+    Dict dict = v.as<Dict>();
+    CHECK(dict.size() == NumKeys);
+    CHECK(dict.capacity() == NumKeys);
+    CHECK(heap.symbolTable().size() == NumKeys + 1);
+    for (int i = 0; i < NumKeys; ++i) {
+        Symbol key = newSymbol("key" + std::to_string(i), heap).value();
+        Value val = v.as<Dict>().get(key);
+        if (i % 50 == 0) {
+            Dict inner = val.as<Dict>();
+            CHECK(inner.size() == 2);
+            CHECK(inner.get(key) == -i);
+        } else {
+            CHECK(val == i);
+        }
+    }
+    CHECK(toJSON(v).size() == json.size());
+
+    // Duplicate keys are an error:
+    CHECK(!newFromJSON(string_view(R"({"a":1,"b":2,"a":3})"), heap));
+}
+
+
+TEST_CASE("JSON Projection", "[object],[json]") {
+    Heap heap(1000000);
+    UsingHeap u(heap);
+
+    auto parse = [&](string_view json, JSONProjection const& projection) -> string {
+        string err;
+        Value v = newFromJSON(json, heap, projection, &err);
+        INFO("Error is " << err);
+        return v ? toJSON(v) : "ERROR";
+    };
+
+    string_view kJSON = R"({"statuses": [{"id": 1, "text": "hi", "user": {"name": "x", "lang": "en"}},)"
+                        R"({"id": 2, "user": {"name": "y"}, "tags": [1, [2, 3], {"a": 4}]}],)"
+                        R"("count": 2, "meta": {"next": null}})";
+    CHECK(parse(kJSON, {"statuses.*.id", "statuses.*.user.name"})
+          == R"({"statuses":[{"id":1,"user":{"name":"x"}},{"id":2,"user":{"name":"y"}}]})");
+    CHECK(parse(kJSON, {"count"}) == R"({"count":2})");
+    CHECK(parse(kJSON, {"count", "meta"}) == R"({"count":2,"meta":{"next":null}})");
+    CHECK(parse(kJSON, {"statuses.1.tags"}) == R"({"statuses":[{"tags":[1,[2,3],{"a":4}]}]})");
+    CHECK(parse(kJSON, {"statuses.*.tags.2.a"}) == R"({"statuses":[{},{"tags":[{"a":4}]}]})");
+    CHECK(parse(kJSON, {"statuses.*.*.name"})
+          == R"({"statuses":[{"user":{"name":"x"}},{"user":{"name":"y"},"tags":[]}]})");
+    CHECK(parse(kJSON, {"nope"}) == "{}");
+    CHECK(parse(kJSON, {}) == "{}");
+    CHECK(parse(kJSON, {""}) == toJSON(newFromJSON(kJSON, heap)));
+    CHECK(parse("[10, 20, 30]", {"1"}) == "[20]");
+    CHECK(parse("17", {"foo"}) == "17");
+
+    // Syntax errors in skipped parts are still caught:
+    CHECK(parse(R"({"count": 2, "meta": {"next": nul}})", {"count"}) == "ERROR");
+    CHECK(parse(R"({"count": 2, "meta": [1, 2})", {"count"}) == "ERROR");
+
+    // Skipping most of a big document allocates much less:
+    string json = readFile(JSON_TEST_DATA_DIR "twitter.json");
+    heap.reset();
+    REQUIRE(newFromJSON(json, heap));
+    size_t fullSize = heap.used();
+    heap.reset();
+    Value v = newFromJSON(json, heap, {"statuses.*.user.screen_name", "statuses.*.id"});
+    REQUIRE(v);
+    size_t projectedSize = heap.used();
+    cout << "Projected twitter.json uses " << projectedSize << " bytes, vs " << fullSize << endl;
+    CHECK(projectedSize * 10 < fullSize);
+    Value statuses = v.as<Dict>().get(newSymbol("statuses", heap).value());
+    CHECK(statuses.as<Vector>().size() == 100);
+}
+
+
 static void testReadJSON(const char *path) {
     Heap heap(1000000);
     UsingHeap u(heap);
@@ -0,0 +1,230 @@
+//
+// Test_LazyJSON.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "smol_world.hh"
+#include "catch.hpp"
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+using namespace snej::smol;
+
+
+static string readFile(const char *path) {
+    INFO("Reading " << path);
+    FILE *f=fopen(path,"rb");
+    REQUIRE(f != NULL);
+    fseek(f,0,SEEK_END);
+    long len=ftell(f);
+    fseek(f,0,SEEK_SET);
+    string contents(len, 0);
+    fread(contents.data(),1,len,f);
+    fclose(f);
+    return contents;
+}
+
+
+TEST_CASE("LazyJSON", "[json]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    string err;
+    auto doc = LazyJSON::create(R"( {"name": "Alice", "age": 37, "tags": ["x", "y\n", 1.5e3],
+                                     "addr": {"city": "Paris", "zip1": null},
+                                     "ok": true, "no": false, "empty": {}, "none": []} )",
+                                heap, &err);
+    REQUIRE(doc);
+    CHECK(err.empty());
+
+    // Navigating doesn't allocate:
+    size_t used = heap.used();
+    LazyJSON::Item root = doc->root();
+    CHECK(root.isObject());
+    CHECK(root.count() == 8);
+    CHECK(root["name"].json() == R"("Alice")");
+    CHECK(root["tags"].isArray());
+    CHECK(root["tags"].count() == 3);
+    CHECK(root["tags"][1].json() == R"("y\n")");
+    CHECK(!root["tags"][3]);
+    CHECK(root["addr"]["city"].json() == R"("Paris")");
+    CHECK(root["addr"]["zip1"].json() == "null");
+    CHECK(root["addr"].json() == R"({"city": "Paris", "zip1": null})");
+    CHECK(root["empty"].count() == 0);
+    CHECK(root["none"].json() == "[]");
+    CHECK(!root["nope"]);
+    CHECK(!root[0]);
+    CHECK(!root["name"]["x"]);
+    CHECK(heap.used() == used);
+
+    // Building values:
+    CHECK(root["name"].value().as<String>().str() == "Alice");
+    CHECK(root["age"].value().asInt() == 37);
+    CHECK(root["tags"][1].value().as<String>().str() == "y\n");
+    CHECK(root["tags"][2].value().asNumber<double>() == 1500.0);
+    CHECK(root["ok"].value() == Bool(true));
+    CHECK(root["no"].value() == Bool(false));
+    CHECK(root["addr"]["zip1"].value().isNullish());
+    CHECK(toJSON(root["tags"].value()) == toJSON(newFromJSON(string_view(R"(["x","y\n",1.5e3])"),
+                                                               heap)));
+
+    // A container is built once, then cached, even across GC:
+    Value addr = root["addr"].value();
+    REQUIRE(addr.is<Dict>());
+    CHECK(addr.as<Dict>().size() == 2);
+    CHECK(root["addr"].value() == addr);
+    heap.setRoot(doc->array());
+    GarbageCollector::run(heap);
+    CHECK(heap.validate());
+    CHECK(toJSON(root["addr"].value()) == R"({"city":"Paris","zip1":null})");
+    used = heap.used();
+    CHECK(root["addr"].value().is<Dict>());
+    CHECK(heap.used() == used);
+
+    // Building the root reuses the cached "addr", and caches the other containers inside it:
+    Value rootDict = root.value();
+    auto member = [&](const char *key) {
+        return rootDict.as<Dict>().get(heap.symbolTable().find(key).value());
+    };
+    CHECK(member("addr") == root["addr"].value());
+    used = heap.used();
+    CHECK(root["tags"].value() == member("tags"));
+    CHECK(root["empty"].value() == member("empty"));
+    CHECK(heap.used() == used);
+
+    // It can be wrapped again from its Array:
+    auto doc2 = LazyJSON::existing(heap, heap.root().value());
+    REQUIRE(doc2);
+    CHECK(doc2->root()["name"].json() == R"("Alice")");
+    CHECK(doc2->root()["addr"].value().as<Dict>().size() == 2);
+    CHECK(toJSON(doc2->root().value()) == toJSON(newFromJSON(doc2->json(), heap)));
+
+    // ...but not from an Array that isn't a LazyJSON's:
+    CHECK(!LazyJSON::existing(heap, nullvalue));
+    CHECK(!LazyJSON::existing(heap, newString("{}", heap).value()));
+    CHECK(!LazyJSON::existing(heap, newArray(2, heap).value()));
+    CHECK(!LazyJSON::existing(heap, newArray(3, heap).value()));
+    Array bogus = newArray(3, heap).value();
+    bogus[0] = doc2->array()[0];
+    bogus[1] = doc2->array()[0];
+    CHECK(!LazyJSON::existing(heap, bogus));       // index isn't valid
+    bogus[1] = doc2->array()[1];
+    bogus[2] = newString("x", heap).value();
+    CHECK(!LazyJSON::existing(heap, bogus));       // cache isn't an Array
+    bogus[2] = nullvalue;
+    CHECK(LazyJSON::existing(heap, bogus));
+
+    // Scalar roots, and errors:
+    auto doc3 = LazyJSON::create(" 1234 ", heap);
+    REQUIRE(doc3);
+    CHECK(doc3->root().json() == "1234");
+    CHECK(doc3->root().value().asInt() == 1234);
+    for (const char *bad : {"", "  ", "[1, 2", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "[01]", "-",
+                            "1.", "1e", "1e999", "tru", "nul", "\"abc", "\"\\x\"", "\"\\u12G4\"",
+                            "\"\\uD800\"", "\"\\uDC00\"", "\"\t\"", "{} []", "{1: 2}",
+                            "{\"a\": 1, \"a\": 2}", "{\"a\": 1, \"\\u0061\": 2}",
+                            "[{\"x\": {\"b\": 1, \"a\": 2, \"b\": 3}}]"}) {
+        INFO("JSON is `" << bad << "`");
+        err.clear();
+        CHECK(!LazyJSON::create(bad, heap, &err));
+        CHECK(!err.empty());
+    }
+
+    // Keys only have to be unique within their object:
+    auto doc4 = LazyJSON::create(R"({"a": {"a": 1, "b": 2}, "b": {"a": 3}})", heap, &err);
+    REQUIRE(doc4);
+    CHECK(toJSON(doc4->root().value()) == R"({"a":{"a":1,"b":2},"b":{"a":3}})");
+
+    // ...which is checked differently in wide objects:
+    string wide = "{";
+    for (int i = 0; i < 40; ++i)
+        wide += "\"k" + std::to_string(i) + "\": " + std::to_string(i) + ", ";
+    CHECK(LazyJSON::create(wide + "\"k\": 0}", heap));
+    CHECK(!LazyJSON::create(wide + "\"k17\": 0}", heap));
+    CHECK(!LazyJSON::create(wide + "\"\\u006b17\": 0}", heap));
+}
+
+
+TEST_CASE("LazyJSON Corrupt Index", "[json]") {
+    Heap heap(4000000);
+    UsingHeap u(heap);
+    auto doc = LazyJSON::create(R"({"name": "Alice", "tags": ["x", "y\n", [1.5]], "addr": {}})", heap);
+    REQUIRE(doc);
+    Blob text = doc->array()[0].as<Blob>();
+    auto index = doc->array()[1].as<Blob>().bytes();
+    std::vector<uint32_t> words(index.size() / 4);
+    ::memcpy(words.data(), index.begin(), index.size());
+
+    // Change each word of the index in various ways. Either `existing` rejects the result, or
+    // it's still safe to navigate (which the sanitizer builds check):
+    int rejected = 0, accepted = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        for (uint32_t w : {words[i] + 1, words[i] - 1, 0u, uint32_t(words.size()), UINT32_MAX}) {
+            if (w == words[i])
+                continue;
+            std::vector<uint32_t> bad = words;
+            bad[i] = w;
+            Array array = newArray(3, heap).value();
+            array[0] = text;
+            array[1] = newBlob(bad.data(), bad.size() * 4, heap).value();
+            auto doc2 = LazyJSON::existing(heap, array);
+            if (!doc2) {
+                ++rejected;
+                continue;
+            }
+            ++accepted;
+            auto root = doc2->root();
+            (void)root.json();
+            for (auto key : {"name", "tags", "addr"}) {
+                auto item = root[key];
+                (void)item.json();
+                for (uint32_t n = 0; n < item.count() + 1; ++n)
+                    (void)item[n].json();
+            }
+            (void)root.value();
+        }
+    }
+    CHECK(rejected > 0);
+    cout << "Corrupted indexes: " << rejected << " rejected, " << accepted << " accepted\n";
+}
+
+
+TEST_CASE("LazyJSON Big Document", "[json]") {
+    string json = readFile("./tests/data/twitter.json");
+    Heap heap(json.size() * 4);
+    UsingHeap u(heap);
+    auto doc = LazyJSON::create(json, heap);
+    REQUIRE(doc);
+    size_t lazySize = heap.used();
+
+    auto statuses = doc->root()["statuses"];
+    CHECK(statuses.count() == 100);
+    CHECK(statuses[99]["user"]["screen_name"].value().as<String>().str() == "2no38mae");
+    Value user = statuses[0]["user"].value();
+    CHECK(user.as<Dict>().size() > 10);
+
+    // Building everything gives the same result as parsing normally, and reuses `user`:
+    string all = toJSON(doc->root().value());
+    CHECK(all == toJSON(newFromJSON(json, heap)));
+    CHECK(statuses[0]["user"].value() == user);
+    CHECK(statuses[0].value().as<Dict>().size() > 10);
+    Value status0 = statuses.value().as<Vector>()[0];
+    CHECK(status0 == statuses[0].value());
+
+    Heap heap2(json.size() * 4);
+    REQUIRE(newFromJSON(json, heap2));
+    cout << "Lazy twitter.json uses " << lazySize << " bytes, vs " << heap2.used() << endl;
+}
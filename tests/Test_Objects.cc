@@ -240,6 +240,35 @@ TEST_CASE("Sparse Arrays", "[object]") {
 //            if (n == len / 8)
 //                cout << array;
         }
+        // `visit` calls back with exactly the non-null items, in order:
+        int nVisited = 0, prev = -1;
+        CHECK(array.visit([&](unsigned i, Value val) {
+            CHECK(int(i) > prev);
+            CHECK(val.maybeAs<String>() == strs[i]);
+            prev = i;
+            ++nVisited;
+            return true;
+        }));
+        CHECK(nVisited == len / 2);
+        CHECK(!array.visit([&](unsigned, Value) {return false;}));
+        // `probe` steps through consecutive non-null items, wrapping around, to the next null:
+        for (unsigned start = 0; start < unsigned(len); ++start) {
+            unsigned expected = start;
+            while (array.contains(expected))
+                expected = (expected + 1) % len;
+            unsigned nProbed = 0;
+            auto [end, matched] = array.probe(start, [&](Value val) {
+                CHECK(val == array.get((start + nProbed++) % len));
+                return false;
+            });
+            CHECK(!matched);
+            CHECK(end == expected);
+            if (array.contains(start)) {
+                auto [at, found] = array.probe(start, [&](Value val) {return val == strs[start];});
+                CHECK(found);
+                CHECK(at == start);
+            }
+        }
         int count = 0;
         for (int i = 0; i < len; ++i) {
             INFO("i is " << i);
@@ -258,6 +287,54 @@ TEST_CASE("Sparse Arrays", "[object]") {
 }
 
 
+TEST_CASE("Sparse Array Bucket Pool", "[object]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    SparseArray array(256, heap);
+
+    // Filling a bucket grows it through the size classes 4, 8, 16, 32, 64; the smaller ones
+    // are kept for reuse:
+    for (int i = 0; i < 40; ++i)
+        REQUIRE(array.put(i, i + 1));
+    CHECK(array.pooledBucketCount() == 4);
+
+    // Another bucket takes the size-4 array from the pool instead of allocating:
+    size_t used = heap.used();
+    REQUIRE(array.put(200, 201));
+    CHECK(heap.used() == used);
+    CHECK(array.pooledBucketCount() == 3);
+
+    // Emptying the first bucket shrinks it, and finally pools it:
+    for (int i = 0; i < 40; ++i) {
+        REQUIRE(array.put(i, nullvalue));
+        for (int j = i + 1; j < 40; ++j)
+            CHECK(array.get(j) == Value(j + 1));
+    }
+    CHECK(array.nonNullCount() == 1);
+    CHECK(array.get(200) == Value(201));
+    CHECK(array.pooledBucketCount() == 5);
+
+    // Refilling it allocates nothing:
+    used = heap.used();
+    for (int i = 0; i < 40; ++i)
+        REQUIRE(array.put(i, i + 1));
+    CHECK(heap.used() == used);
+    CHECK(array.pooledBucketCount() == 4);
+
+    // Another array can take over all the buckets:
+    SparseArray array2(256, heap);
+    array2.recycleBucketsFrom(array);
+    CHECK(array.allNull());
+    CHECK(array.pooledBucketCount() == 4);
+    CHECK(array2.pooledBucketCount() == 2);
+    used = heap.used();
+    for (int i = 0; i < 4; ++i)
+        REQUIRE(array2.put(i, i + 1));
+    CHECK(heap.used() == used);
+    CHECK(array2.get(3) == Value(4));
+}
+
+
 TEST_CASE("Vectors", "[object]") {
     Heap heap(1000);
     UsingHeap u(heap);
@@ -427,3 +504,199 @@ TEST_CASE("Symbols", "[object],[hash]") {
 
     cout << table2 << endl;
 }
+
+
+TEST_CASE("Symbol Batches", "[object],[hash]") {
+    Heap heap(1000000);
+    SymbolTable& table = heap.symbolTable();
+    unless(foo, table.create("foo")) {FAIL("Failed to create 'foo'");}
+
+    // A batch bigger than `createBatch`'s chunk size, with an existing name and repeated ones:
+    constexpr size_t NumNames = 150;
+    vector<string> names;
+    for (size_t i = 0; i < NumNames; ++i)
+        names.push_back("Sym" + std::to_string(i % 100));
+    names[17] = "foo";
+    vector<string_view> strs(names.begin(), names.end());
+    vector<Maybe<Symbol>> syms(NumNames);
+
+    REQUIRE(table.createBatch({strs.data(), strs.size()}, {syms.data(), syms.size()}));
+    CHECK(table.size() == 101);         // "foo" and "Sym0"..."Sym99"; 100...149 are repeats
+    CHECK(syms[17] == foo);
+    for (size_t i = 0; i < NumNames; ++i) {
+        REQUIRE(syms[i]);
+        CHECK(syms[i].value().str() == names[i]);
+        CHECK(table.find(names[i]) == syms[i]);
+        if (i >= 100 && i != 117)
+            CHECK(syms[i] == syms[i - 100]);
+    }
+
+    // A batch of existing names doesn't allocate anything:
+    size_t used = heap.used();
+    vector<Maybe<Symbol>> syms2(NumNames);
+    REQUIRE(table.createBatch({strs.data(), strs.size()}, {syms2.data(), syms2.size()}));
+    CHECK(syms2 == syms);
+    CHECK(table.size() == 101);
+    CHECK(heap.used() == used);
+
+    // The Heap's symbol table is saved, so a reopened Heap has the new Symbols:
+    Heap heap2 = Heap::existing(heap.contents(), heap.capacity());
+    CHECK(heap2.symbolTable().size() == 101);
+    CHECK(heap2.symbolTable().find("Sym42"));
+}
+
+
+TEST_CASE("HashSet Incremental Resize", "[object],[hash]") {
+    Heap heap(1000000);
+    UsingHeap u(heap);
+    HashSet set(heap, 8u);
+    vector<string> names;
+    auto checkAll = [&](HashSet const& s) {
+        CHECK(s.count() == names.size());
+        for (auto &name : names)
+            CHECK(s.find(name).maybeAs<String>().value().str() == name);
+        size_t visited = 0;
+        s.visit([&](Value) {++visited; return true;});
+        CHECK(visited == names.size());
+    };
+    auto add = [&] {
+        names.push_back("string " + std::to_string(names.size()));
+        string_view name = names.back();
+        Value str = set.findOrInsert(name, [&](Heap &heap) -> Value {
+            return newString(name, heap);
+        });
+        REQUIRE(str);
+        CHECK(set.findOrInsert(name, [](Heap&) -> Value {FAIL("shouldn't create"); return {};}) == str);
+    };
+
+    // Grow the set until it's in the middle of a resize:
+    while (!set.isResizing())
+        add();
+    add();
+    REQUIRE(set.isResizing());
+    checkAll(set);
+    CHECK(!set.insert(set.find(names[0])));
+
+    // The persistent form survives GC and can resume the resize:
+    heap.setRoot(set.array());
+    GarbageCollector::run(heap);
+    {
+        HashSet set2(heap, heap.root().value().as<Array>());
+        CHECK(set2.isResizing());
+        checkAll(set2);
+    }
+    checkAll(set);
+
+    // Each insertion moves a few more items, until the resize is done:
+    unsigned steps = 0;
+    while (set.isResizing()) {
+        add();
+        ++steps;
+    }
+    CHECK(steps > 1);
+    checkAll(set);
+    HashSet set3(heap, set.array());
+    CHECK(!set3.isResizing());
+    checkAll(set3);
+
+    // Reserving more room than the new table has, in mid-resize, finishes that resize and grows
+    // once; then the reserved insertions don't start another resize after that one finishes:
+    while (!set.isResizing())
+        add();
+    constexpr uint32_t kReserve = 2000;
+    REQUIRE(set.reserve(kReserve));
+    CHECK(set.isResizing());
+    checkAll(set);
+    bool resized = false;
+    for (uint32_t i = 0; i < kReserve; ++i) {
+        add();
+        if (!set.isResizing())
+            resized = true;
+        else if (resized)
+            FAIL("started another resize after reserving");
+    }
+    CHECK(resized);
+    checkAll(set);
+}
+
+
+TEST_CASE("HashMap", "[object],[hash]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    GarbageCollector::runOnDemand(heap);        // growing the map will trigger GC
+
+    HashMap map(heap);
+    heap.setRoot(map.array());
+    CHECK(map.count() == 0);
+    CHECK(map.get(1) == nullvalue);
+
+    // Integer keys:
+    constexpr int N = 1000;
+    for (int i = 0; i < N; ++i) {
+        REQUIRE(map.set(i * 7, i));
+        heap.setRoot(map.array());
+    }
+    CHECK(map.count() == N);
+    for (int i = 0; i < N; ++i)
+        CHECK(map.get(i * 7) == i);
+    CHECK(!map.contains(3));
+
+    // String keys are compared by contents; Symbols are different keys from Strings:
+    REQUIRE(map.set(newString("hello", heap).value(), 17));
+    CHECK(map.get(newString("hello", heap).value()) == 17);
+    CHECK(!map.contains(newSymbol("hello", heap).value()));
+    REQUIRE(map.set(newSymbol("hello", heap).value(), 18));
+    CHECK(map.get(newSymbol("hello", heap).value()) == 18);
+    CHECK(map.get(newString("hello", heap).value()) == 17);
+
+    // Ints and BigInts are compared by value; Floats by value, including -0 and NaN:
+    REQUIRE(map.set(newInt(int64_t(1) << 40, heap), 40));
+    CHECK(map.get(newBigInt(int64_t(1) << 40, heap).value()) == 40);
+    CHECK(map.get(newBigInt(7, heap).value()) == 1);
+    REQUIRE(map.set(newFloat(-0.0, heap).value(), -1));
+    CHECK(map.get(newFloat(0.0, heap).value()) == -1);
+    REQUIRE(map.set(newFloat(NAN, heap).value(), -2));
+    CHECK(map.get(newFloat(NAN, heap).value()) == -2);
+    CHECK(!map.contains(newFloat(7.0, heap).value()));     // not the same as the Int 7
+
+    // Null and Bools, and a null value:
+    REQUIRE(map.set(nullvalue, Bool(true)));
+    REQUIRE(map.set(Bool(false), nullvalue));
+    CHECK(map.get(nullvalue) == Bool(true));
+    CHECK(map.contains(Bool(false)));
+    CHECK(map.get(Bool(false)) == nullvalue);
+    CHECK(!map.contains(Bool(true)));
+    CHECK(map.get(0) == 0);                                 // not the same as false
+
+    // Containers can't be keys:
+    CHECK(!HashMap::isValidKey(newArray(1, heap).value()));
+    CHECK(!map.set(newArray(1, heap).value(), 1));
+    CHECK(map.count() == N + 7);
+
+    // Replace, and remove half the integer keys:
+    REQUIRE(map.set(14, -2));
+    CHECK(map.get(14) == -2);
+    CHECK(map.count() == N + 7);
+    for (int i = 0; i < N; i += 2)
+        CHECK(map.remove(i * 7));
+    CHECK(!map.remove(0));
+    CHECK(map.count() == N / 2 + 7);
+    for (int i = 0; i < N; ++i)
+        CHECK(map.get(i * 7) == ((i % 2) ? Value(i) : Value()));
+
+    size_t n = 0;
+    map.visit([&](Value key, Value value) {
+        CHECK(map.get(key) == value);
+        ++n;
+        return true;
+    });
+    CHECK(n == map.count());
+
+    // The map survives GC, and can be reopened from its Array:
+    GarbageCollector::run(heap);
+    HashMap map2(heap, heap.root().value().as<Array>());
+    CHECK(map2.count() == N / 2 + 7);
+    CHECK(map2.get(7) == 1);
+    CHECK(map2.get(newString("hello", heap).value()) == 17);
+    CHECK(heap.validate());
+}
@@ -0,0 +1,188 @@
+//
+// Test_Path.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "smol_world.hh"
+#include "catch.hpp"
+#include <iostream>
+
+using namespace std;
+using namespace snej::smol;
+
+
+static constexpr string_view kStoreJSON = R"({
+    "store": {
+        "book": [
+            {"category": "reference", "author": "Nigel Rees", "title": "Sayings of the Century",
+             "price": 8.5},
+            {"category": "fiction", "author": "Evelyn Waugh", "title": "Sword of Honour",
+             "price": 12.75},
+            {"category": "fiction", "author": "Herman Melville", "title": "Moby Dick",
+             "isbn": "0-553-21311-3", "price": 8.25},
+            {"category": "fiction", "author": "J. R. R. Tolkien", "title": "The Lord of the Rings",
+             "isbn": "0-395-19395-8", "price": 22.5}
+        ],
+        "bicycle": {"color": "red", "price": 19.5, "a/b": 1, "m~n": 2, "7": "seven"}
+    },
+    "expensive": 10
+})";
+
+
+// Evaluates a path and returns its results as a JSON array string.
+static string query(string_view pathStr, Value root, Heap &heap) {
+    Path path(pathStr, heap);
+    INFO("Path is " << pathStr);
+    if (!path.valid())
+        FAIL("Invalid path: " << path.error());
+    unless(results, path.all(root)) {FAIL("Path::all failed");}
+    CHECK(results.size() == path.count(root));
+    string json = toJSON(results);
+    cerr << pathStr << "  -->  " << json << endl;
+    return json;
+}
+
+
+TEST_CASE("Path", "[path]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    Handle<Value> root = newFromJSON(kStoreJSON, heap);
+    REQUIRE(root);
+
+    CHECK(query("$", root, heap) == "[" + toJSON(root) + "]");
+    CHECK(query("$.expensive", root, heap) == "[10]");
+    CHECK(query(".expensive", root, heap) == "[10]");
+    CHECK(query("$.store.book[0].title", root, heap) == R"(["Sayings of the Century"])");
+    CHECK(query("$['store']['book'][-1].title", root, heap) == R"(["The Lord of the Rings"])");
+    CHECK(query("$.store.book[4].title", root, heap) == "[]");
+    CHECK(query("$.store.book[-5]", root, heap) == "[]");
+    CHECK(query("$.store.book[*].author", root, heap)
+          == R"(["Nigel Rees","Evelyn Waugh","Herman Melville","J. R. R. Tolkien"])");
+    // (Dict items are ordered by Symbol ID, and "price" was seen before "color":)
+    CHECK(query("$.store.bicycle.*", root, heap) == R"([19.5,"red",1,2,"seven"])");
+    CHECK(query("$..isbn", root, heap) == R"(["0-553-21311-3","0-395-19395-8"])");
+    CHECK(query("$.store..price", root, heap) == "[8.5,12.75,8.25,22.5,19.5]");
+    CHECK(query("$..book[2].author", root, heap) == R"(["Herman Melville"])");
+    CHECK(query("$..*", root, heap).size() > 300);
+
+    // Nonexistent keys, including ones that aren't even Symbols in the Heap:
+    CHECK(query("$.store.book[0].nope", root, heap) == "[]");
+    CHECK(query("$.expensive.store", root, heap) == "[]");
+    CHECK(query("$.store[0]", root, heap) == "[]");
+
+    // Filters:
+    CHECK(query("$.store.book[?(@.isbn)].title", root, heap)
+          == R"(["Moby Dick","The Lord of the Rings"])");
+    CHECK(query("$.store.book[?(@.price < 10)].price", root, heap) == "[8.5,8.25]");
+    CHECK(query("$.store.book[?(@.price>=12.75)].price", root, heap) == "[12.75,22.5]");
+    CHECK(query("$.store.book[?(@.category == 'reference')].author", root, heap)
+          == R"(["Nigel Rees"])");
+    CHECK(query("$.store.book[?(@.category != \"fiction\")].author", root, heap)
+          == R"(["Nigel Rees"])");
+    CHECK(query("$.store.book[?(@.author > 'I')].author", root, heap)
+          == R"(["Nigel Rees","J. R. R. Tolkien"])");
+    CHECK(query("$.store.book[?(@.price == 'cheap')]", root, heap) == "[]");
+    CHECK(query("$..[?(@.color == 'red')].price", root, heap) == "[19.5]");
+
+    // JSON Pointer:
+    CHECK(query("/store/book/1/author", root, heap) == R"(["Evelyn Waugh"])");
+    CHECK(query("/store/bicycle/a~1b", root, heap) == "[1]");
+    CHECK(query("/store/bicycle/m~0n", root, heap) == "[2]");
+    CHECK(query("/store/bicycle/7", root, heap) == R"(["seven"])");
+    CHECK(query("/store/book/01", root, heap) == "[]");
+    CHECK(query("/store/book/-", root, heap) == "[]");
+
+    // `first`, and early exit from `visit`:
+    Path author("$..author", heap);
+    CHECK(author.first(root).as<String>().str() == "Nigel Rees");
+    CHECK(author.count(root) == 4);
+    int n = 0;
+    CHECK(!author.visit(root, [&](Value) {return ++n < 2;}));
+    CHECK(n == 2);
+    CHECK(!Path("$.nope", heap).first(root));
+}
+
+
+TEST_CASE("Path Many Roots", "[path]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    // Compile the path before any of its keys exist as Symbols:
+    Path path("$.person.name", heap);
+    REQUIRE(path.valid());
+
+    Handle<Value> doc1 = newFromJSON(string_view(R"({"person": {"name": "Alice"}})"), heap);
+    Handle<Value> doc2 = newFromJSON(string_view(R"({"person": {"age": 7}})"), heap);
+    Handle<Value> doc3 = newFromJSON(string_view(R"([{"person": {"name": "Bob"}}])"), heap);
+    CHECK(path.first(doc1).as<String>().str() == "Alice");
+    CHECK(!path.first(doc2));
+    CHECK(!path.first(doc3));
+
+    // Still works after GC moves everything:
+    GarbageCollector::run(heap);
+    CHECK(path.first(doc1).as<String>().str() == "Alice");
+    Handle<Value> doc4 = newFromJSON(string_view(R"({"person": {"name": "Carol"}})"), heap);
+    CHECK(path.first(doc4).as<String>().str() == "Carol");
+}
+
+
+TEST_CASE("Path Errors", "[path]") {
+    Heap heap(10000);
+    for (const char *str : {"$.", "$[", "$[*", "$['foo", "$[foo]", "$.foo bar", "$[?(@.x < )]",
+                            "$[?(@.x == wat)]", "$[?(x)]", "$[--1]", "/a/~2", "$$"}) {
+        INFO("Path is " << str);
+        Path path(str, heap);
+        CHECK(!path.valid());
+        CHECK(!path.error().empty());
+        cerr << str << "  -->  " << path.error() << endl;
+    }
+}
+
+
+TEST_CASE("Path Symbol Tables", "[path]") {
+    Heap heap(100000);
+    UsingHeap u(heap);
+    Path path("$.b.a", heap);
+    REQUIRE(path.valid());
+    Handle<Value> doc = newFromJSON(string_view(R"({"a": 1, "b": {"a": 2}})"), heap);
+    CHECK(path.first(doc) == 2);
+
+    // After a reset the Symbols get different IDs, which the Path has to look up again:
+    doc = nullvalue;
+    heap.reset();
+    doc = newFromJSON(string_view(R"({"b": {"z": 0, "a": 5}})"), heap);
+    CHECK(path.first(doc) == 5);
+
+    // Likewise for a value in a different Heap:
+    {
+        Heap heap2(10000);
+        UsingHeap u2(heap2);
+        Handle<Value> doc2 = newFromJSON(string_view(R"({"x": 0, "y": 0, "b": {"a": 7}})"), heap2);
+        CHECK(path.first(doc2) == 7);
+    }
+    CHECK(path.first(doc) == 5);
+
+    // Evaluating doesn't create a symbol table, even in a Heap that has Symbols but no table:
+    heap.setRoot(doc.as<Object>());
+    vector<byte> copy(heap.contents().begin(), heap.contents().end());
+    Heap heap3 = Heap::existing({copy.data(), copy.size()}, copy.size() + 10000);
+    REQUIRE(!heap3.invalid());
+    UsingHeap u3(heap3);
+    heap3.dropSymbolTable();
+    size_t used = heap3.used();
+    CHECK(path.first(heap3.root()) == 5);
+    CHECK(!Path("$.b.nope", heap3).first(heap3.root()));
+    CHECK(heap3.used() == used);
+}
@@ -188,3 +188,122 @@ TEST_CASE("Dense Hash", "[sparse]") {
         CHECK(sparse.get(to_string(i)));
 }
 
+
+
+template <class Hash>
+static void testErase(Hash &hash) {
+    for (size_t i = 0; i < 1000; ++i)
+        REQUIRE(hash.insert(to_string(i)));
+    CHECK(hash.count() == 1000);
+
+    // Heterogeneous lookup, with a C string and a string_view:
+    CHECK(hash.contains("123"));
+    CHECK(hash.get(string_view("999")));
+    CHECK(!hash.contains("1000"));
+
+    // Remove every odd number; the rest must still be reachable:
+    for (size_t i = 1; i < 1000; i += 2)
+        CHECK(hash.erase(to_string(i)));
+    CHECK(!hash.erase("1"));
+    CHECK(!hash.erase("xyzzy"));
+    CHECK(hash.count() == 500);
+    for (size_t i = 0; i < 1000; ++i)
+        CHECK(hash.contains(to_string(i)) == (i % 2 == 0));
+
+    // Backward-shift deletion leaves every item within one probe run of its home slot:
+    size_t visited = 0;
+    hash.visit([&](size_t, string const& item) {
+        ++visited;
+        CHECK(hash.probe_count(item) < 50);
+        return true;
+    });
+    CHECK(visited == 500);
+
+    for (size_t i = 1; i < 1000; i += 2)
+        CHECK(hash.insert(to_string(i)));
+    for (size_t i = 0; i < 1000; ++i)
+        CHECK(hash.erase(to_string(i)));
+    CHECK(hash.count() == 0);
+    CHECK(hash.empty());
+}
+
+
+TEST_CASE("Sparse Hash Erase", "[sparse]") {
+    SECTION("Sparse") {
+        sparse_hash_table<string_view,string,strHash> hash;
+        testErase(hash);
+    }
+    SECTION("Dense") {
+        dense_hash_table<string_view,string,strHash> hash;
+        testErase(hash);
+    }
+}
+
+
+TEST_CASE("Sparse Hash Reserve", "[sparse]") {
+    sparse_hash_table<string_view,string,strHash> hash;
+    hash.insert("first");
+    hash.reserve(5000);
+    CHECK(hash.capacity() >= 5000);
+    size_t tableSize = hash.table_size();
+    size_t memory = hash.memory_used();
+    CHECK(hash.get("first"));
+
+    for (size_t i = 0; i < 4999; ++i)
+        hash.insert(to_string(i));
+    CHECK(hash.count() == 5000);
+    CHECK(hash.table_size() == tableSize);          // it didn't grow
+    CHECK(hash.memory_used() == memory + 4999 * sizeof(string));
+
+    hash.clear();
+    CHECK(hash.count() == 0);
+    CHECK(!hash.get("first"));
+    CHECK(hash.table_size() == tableSize);
+}
+
+
+namespace {
+    // A map entry whose value is move-only.
+    struct Entry {
+        string              key;
+        unique_ptr<int>     value;
+
+        Entry() = default;
+        explicit Entry(string_view k)           :key(k) { }
+        Entry(string_view k, int v)             :key(k), value(make_unique<int>(v)) { }
+        operator string_view() const            {return key;}
+        friend bool operator== (Entry const& e, string_view k) {return e.key == k;}
+    };
+}
+
+
+TEST_CASE("Sparse Hash Move-Only", "[sparse]") {
+    sparse_hash_table<string_view,Entry,strHash> map;
+    for (int i = 0; i < 500; ++i) {
+        auto [entry, inserted] = map.insert_item(Entry(to_string(i), i));
+        CHECK(inserted);
+        CHECK(*entry->value == i);
+    }
+    auto [entry, inserted] = map.insert_item(Entry("7", -1));
+    CHECK(!inserted);
+    CHECK(*entry->value == 7);
+
+    // Growing and erasing must move the values, not lose them:
+    for (int i = 0; i < 500; i += 3)
+        CHECK(map.erase(to_string(i)));
+    for (int i = 0; i < 500; ++i) {
+        Entry const* e = map.get(to_string(i));
+        if (i % 3 == 0) {
+            CHECK(!e);
+        } else {
+            REQUIRE(e);
+            REQUIRE(e->value);
+            CHECK(*e->value == i);
+        }
+    }
+
+    Entry *added = map.put("new");
+    CHECK(!added->value);
+    added->value = make_unique<int>(1234);
+    CHECK(*map.get("new")->value == 1234);
+}
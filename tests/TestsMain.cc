@@ -0,0 +1,9 @@
+//
+// TestsMain.cc
+//
+// Copyright © 2023 Jens Alfke. All rights reserved.
+//
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+#include "CaseListReporter.hh"